@@ -3,3 +3,65 @@
 //
 
 #include "Cpu6502.h"
+
+void Cpu6502::powerOn() {
+    a = x = y = 0;
+    s = 0xFD;
+    p = I | U;
+    pc = 0;
+    nmi_pending = irq_line = false;
+}
+
+void Cpu6502::adc(uint8_t m) {
+    const unsigned carry_in = (p & C) ? 1 : 0;
+    const unsigned sum = a + m + carry_in;
+
+    if ((p & D) && decimal_mode) {
+        // NMOS 6502 behaviour. Z comes from the binary sum, N and V from the intermediate result
+        // http://www.6502.org/tutorials/decimal_mode.html#A
+        unsigned lo = (a & 0x0Fu) + (m & 0x0Fu) + carry_in;
+        if (lo > 0x09) {
+            lo += 0x06;
+        }
+        unsigned r = (a & 0xF0u) + (m & 0xF0u) + (lo > 0x0F ? 0x10u : 0u) + (lo & 0x0Fu);
+        setFlag(Z, (sum & 0xFFu) == 0);
+        setFlag(N, r & 0x80u);
+        setFlag(V, (~(a ^ m) & (a ^ r) & 0x80u) != 0);
+        if ((r & 0x1F0u) > 0x90) {
+            r += 0x60;
+        }
+        setFlag(C, (r & 0xFF0u) > 0xF0);
+        a = static_cast<uint8_t>(r);
+        return;
+    }
+
+    setFlag(C, sum > 0xFF);
+    setFlag(V, (~(a ^ m) & (a ^ sum) & 0x80u) != 0);
+    a = static_cast<uint8_t>(sum);
+    setNZ(a);
+}
+
+void Cpu6502::sbc(uint8_t m) {
+    if ((p & D) && decimal_mode) {
+        // NMOS 6502 behaviour. All flags come from the binary result
+        const unsigned borrow = (p & C) ? 0 : 1;
+        const unsigned diff = a - m - borrow;
+        unsigned lo = (a & 0x0Fu) - (m & 0x0Fu) - borrow;
+        unsigned hi = (a >> 4u) - (m >> 4u);
+        if (lo & 0x10u) {
+            lo -= 6;
+            hi--;
+        }
+        if (hi & 0x10u) {
+            hi -= 6;
+        }
+        setFlag(C, diff < 0x100);
+        setFlag(V, ((a ^ m) & (a ^ diff) & 0x80u) != 0);
+        setNZ(static_cast<uint8_t>(diff));
+        a = static_cast<uint8_t>(((hi & 0x0Fu) << 4u) | (lo & 0x0Fu));
+        return;
+    }
+
+    // Binary subtraction is addition of the ones complement
+    adc(static_cast<uint8_t>(~m));
+}
@@ -7,17 +7,319 @@
 
 #include <cstdint>
 
+#include "Cpu6502_instructions.h"
+
 class Cpu6502 {
 public:
 
 
     // Resisters
     // https://wiki.nesdev.com/w/index.php/CPU_registers
-    uint8_t a,x,y,s,p;
+    // pc first, so that there is no padding between them (see machine_state)
     uint16_t pc;
+    uint8_t a,x,y,s,p;
+
+    // Status flags
+    // https://wiki.nesdev.com/w/index.php/Status_flags
+    enum flag : uint8_t
+    {
+        C = 1u << 0u,
+        Z = 1u << 1u,
+        I = 1u << 2u,
+        D = 1u << 3u,
+        B = 1u << 4u,
+        U = 1u << 5u,
+        V = 1u << 6u,
+        N = 1u << 7u,
+    };
+
+    // Interrupt inputs. NMI is edge triggered, so whoever raises it sets nmi_pending and the CPU clears it
+    bool nmi_pending;
+    bool irq_line;
+
+    // The 2A03 has no decimal mode, but plain 6502 images (e.g. 6502_functional_test.bin) test it
+    bool decimal_mode;
+
+    // Power up state https://wiki.nesdev.com/w/index.php/CPU_power_up_state
+    void powerOn();
+
+    template<typename Bus>
+    void reset(Bus &bus);
 
+    // Executes one instruction, or enters a pending interrupt
+    // Returns the number of cycles taken
+    // Bus must provide uint8_t read(uint16_t) and void write(uint16_t, uint8_t) for data,
+    // and uint8_t fetch(uint16_t) and uint8_t fetchOperand(uint16_t) for the instruction stream
+    template<typename Bus>
+    unsigned step(Bus &bus);
 
+    // True if the next step enters an interrupt rather than executing the instruction at pc
+    bool interruptPending() const { return nmi_pending || (irq_line && !(p & I)); }
+
+private:
+    template<typename Bus>
+    uint16_t read16(Bus &bus, uint16_t addr);
+
+    template<typename Bus>
+    uint16_t fetchOperand16(Bus &bus, uint16_t addr);
+
+    template<typename Bus>
+    void push(Bus &bus, uint8_t v);
+
+    template<typename Bus>
+    uint8_t pull(Bus &bus);
+
+    template<typename Bus>
+    void interrupt(Bus &bus, uint16_t vector, bool brk);
+
+    void setNZ(uint8_t v);
+    void setFlag(flag f, bool v);
+    void adc(uint8_t m);
+    void sbc(uint8_t m);
+    void compare(uint8_t reg, uint8_t m);
 };
 
+inline void Cpu6502::setNZ(uint8_t v) {
+    p = static_cast<uint8_t>((p & ~(Z | N)) | (v == 0 ? Z : 0) | (v & N));
+}
+
+inline void Cpu6502::setFlag(flag f, bool v) {
+    p = static_cast<uint8_t>(v ? (p | f) : (p & ~f));
+}
+
+inline void Cpu6502::compare(uint8_t reg, uint8_t m) {
+    setFlag(C, reg >= m);
+    setNZ(static_cast<uint8_t>(reg - m));
+}
+
+template<typename Bus>
+uint16_t Cpu6502::read16(Bus &bus, uint16_t addr) {
+    return static_cast<uint16_t>(bus.read(addr) | (bus.read(static_cast<uint16_t>(addr + 1)) << 8u));
+}
+
+template<typename Bus>
+uint16_t Cpu6502::fetchOperand16(Bus &bus, uint16_t addr) {
+    return static_cast<uint16_t>(bus.fetchOperand(addr) | (bus.fetchOperand(static_cast<uint16_t>(addr + 1)) << 8u));
+}
+
+template<typename Bus>
+void Cpu6502::push(Bus &bus, uint8_t v) {
+    bus.write(static_cast<uint16_t>(0x100u | s), v);
+    s--;
+}
+
+template<typename Bus>
+uint8_t Cpu6502::pull(Bus &bus) {
+    s++;
+    return bus.read(static_cast<uint16_t>(0x100u | s));
+}
+
+template<typename Bus>
+void Cpu6502::interrupt(Bus &bus, uint16_t vector, bool brk) {
+    push(bus, static_cast<uint8_t>(pc >> 8u));
+    push(bus, static_cast<uint8_t>(pc));
+    // B only exists on the stack, and is only set there by BRK and PHP
+    // https://wiki.nesdev.com/w/index.php/Status_flags#The_B_flag
+    push(bus, static_cast<uint8_t>((p & ~B) | U | (brk ? B : 0)));
+    p |= I;
+    pc = read16(bus, vector);
+}
+
+template<typename Bus>
+void Cpu6502::reset(Bus &bus) {
+    s = static_cast<uint8_t>(s - 3);
+    p |= I;
+    nmi_pending = false;
+    pc = read16(bus, 0xFFFC);
+}
+
+template<typename Bus>
+unsigned Cpu6502::step(Bus &bus) {
+    // https://wiki.nesdev.com/w/index.php/CPU_interrupts
+    if (nmi_pending) {
+        nmi_pending = false;
+        interrupt(bus, 0xFFFA, false);
+        return 7;
+    }
+    if (irq_line && !(p & I)) {
+        interrupt(bus, 0xFFFE, false);
+        return 7;
+    }
+
+    const instruction instr = instructions[bus.fetch(pc)];
+    const auto operand_addr = static_cast<uint16_t>(pc + 1);
+    pc = static_cast<uint16_t>(pc + instr.bytes);
+    unsigned cycles = instr.cycles;
+
+    // Work out the effective address
+    // http://www.obelisk.me.uk/6502/addressing.html
+    uint16_t addr = 0;
+    bool page_crossed = false;
+    auto indexed = [&addr, &page_crossed](uint16_t base, uint8_t index) {
+        addr = static_cast<uint16_t>(base + index);
+        page_crossed = (base ^ addr) & 0xFF00u;
+    };
+    switch (instr.mode) {
+        case addressing_mode::ACCUM:
+        case addressing_mode::IMPL: break;
+        case addressing_mode::IMM: addr = operand_addr; break;
+        case addressing_mode::ZP: addr = bus.fetchOperand(operand_addr); break;
+        case addressing_mode::ZPX: addr = static_cast<uint8_t>(bus.fetchOperand(operand_addr) + x); break;
+        case addressing_mode::ZPY: addr = static_cast<uint8_t>(bus.fetchOperand(operand_addr) + y); break;
+        case addressing_mode::ABS: addr = fetchOperand16(bus, operand_addr); break;
+        case addressing_mode::ABSX: indexed(fetchOperand16(bus, operand_addr), x); break;
+        case addressing_mode::ABSY: indexed(fetchOperand16(bus, operand_addr), y); break;
+        case addressing_mode::REL: {
+            const auto offset = static_cast<int8_t>(bus.fetchOperand(operand_addr));
+            addr = static_cast<uint16_t>(pc + offset);
+            page_crossed = (pc ^ addr) & 0xFF00u;
+            break;
+        }
+        case addressing_mode::INDX: {
+            const auto zp = static_cast<uint8_t>(bus.fetchOperand(operand_addr) + x);
+            addr = static_cast<uint16_t>(bus.read(zp) | (bus.read(static_cast<uint8_t>(zp + 1)) << 8u));
+            break;
+        }
+        case addressing_mode::INDY: {
+            const uint8_t zp = bus.fetchOperand(operand_addr);
+            indexed(static_cast<uint16_t>(bus.read(zp) | (bus.read(static_cast<uint8_t>(zp + 1)) << 8u)), y);
+            break;
+        }
+        case addressing_mode::IND: {
+            // The high byte is fetched without carrying in to the page
+            // https://wiki.nesdev.com/w/index.php/Errata
+            const uint16_t ptr = fetchOperand16(bus, operand_addr);
+            const auto ptr_hi = static_cast<uint16_t>((ptr & 0xFF00u) | static_cast<uint8_t>(ptr + 1));
+            addr = static_cast<uint16_t>(bus.read(ptr) | (bus.read(ptr_hi) << 8u));
+            break;
+        }
+    }
+    if (instr.special == special_duration::ADD_ONE_IF_CROSS && page_crossed) {
+        cycles++;
+    }
+
+    // Immediate operands are part of the instruction stream, everything else is a data read
+    auto load = [&]() { return instr.mode == addressing_mode::IMM ? bus.fetchOperand(addr) : bus.read(addr); };
+
+    auto branch = [&](bool taken) {
+        if (taken) {
+            cycles += page_crossed ? 2 : 1;
+            pc = addr;
+        }
+    };
+
+    // Read-modify-write instructions write the unmodified value back first
+    auto rmw = [&](auto op) {
+        if (instr.mode == addressing_mode::ACCUM) {
+            a = op(a);
+            setNZ(a);
+        } else {
+            const uint8_t v = bus.read(addr);
+            bus.write(addr, v);
+            const uint8_t r = op(v);
+            bus.write(addr, r);
+            setNZ(r);
+        }
+    };
+    auto asl = [this](uint8_t v) { setFlag(C, v & 0x80u); return static_cast<uint8_t>(v << 1u); };
+    auto lsr = [this](uint8_t v) { setFlag(C, v & 0x01u); return static_cast<uint8_t>(v >> 1u); };
+    auto rol = [this](uint8_t v) {
+        const bool carry_in = p & C;
+        setFlag(C, v & 0x80u);
+        return static_cast<uint8_t>((v << 1u) | (carry_in ? 1u : 0u));
+    };
+    auto ror = [this](uint8_t v) {
+        const bool carry_in = p & C;
+        setFlag(C, v & 0x01u);
+        return static_cast<uint8_t>((v >> 1u) | (carry_in ? 0x80u : 0u));
+    };
+
+    switch (instr.code) {
+        case operation::ADC: adc(load()); break;
+        case operation::AND: a &= load(); setNZ(a); break;
+        case operation::ASL: rmw(asl); break;
+        case operation::BCC: branch(!(p & C)); break;
+        case operation::BCS: branch(p & C); break;
+        case operation::BEQ: branch(p & Z); break;
+        case operation::BIT: {
+            const uint8_t m = load();
+            setFlag(Z, (a & m) == 0);
+            p = static_cast<uint8_t>((p & ~(N | V)) | (m & (N | V)));
+            break;
+        }
+        case operation::BMI: branch(p & N); break;
+        case operation::BNE: branch(!(p & Z)); break;
+        case operation::BPL: branch(!(p & N)); break;
+        case operation::BRK:
+            // BRK skips a padding byte
+            pc++;
+            interrupt(bus, 0xFFFE, true);
+            break;
+        case operation::BVC: branch(!(p & V)); break;
+        case operation::BVS: branch(p & V); break;
+        case operation::CLC: setFlag(C, false); break;
+        case operation::CLD: setFlag(D, false); break;
+        case operation::CLI: setFlag(I, false); break;
+        case operation::CLV: setFlag(V, false); break;
+        case operation::CMP: compare(a, load()); break;
+        case operation::CPX: compare(x, load()); break;
+        case operation::CPY: compare(y, load()); break;
+        case operation::DEC: rmw([](uint8_t v) { return static_cast<uint8_t>(v - 1); }); break;
+        case operation::DEX: x--; setNZ(x); break;
+        case operation::DEY: y--; setNZ(y); break;
+        case operation::EOR: a ^= load(); setNZ(a); break;
+        case operation::INC: rmw([](uint8_t v) { return static_cast<uint8_t>(v + 1); }); break;
+        case operation::INX: x++; setNZ(x); break;
+        case operation::INY: y++; setNZ(y); break;
+        case operation::JMP: pc = addr; break;
+        case operation::JSR: {
+            const auto ret = static_cast<uint16_t>(pc - 1);
+            push(bus, static_cast<uint8_t>(ret >> 8u));
+            push(bus, static_cast<uint8_t>(ret));
+            pc = addr;
+            break;
+        }
+        case operation::LDA: a = load(); setNZ(a); break;
+        case operation::LDX: x = load(); setNZ(x); break;
+        case operation::LDY: y = load(); setNZ(y); break;
+        case operation::LSR: rmw(lsr); break;
+        case operation::NOP: break;
+        case operation::ORA: a |= load(); setNZ(a); break;
+        case operation::PHA: push(bus, a); break;
+        case operation::PHP: push(bus, static_cast<uint8_t>(p | B | U)); break;
+        case operation::PLA: a = pull(bus); setNZ(a); break;
+        case operation::PLP: p = static_cast<uint8_t>((pull(bus) & ~B) | U); break;
+        case operation::ROL: rmw(rol); break;
+        case operation::ROR: rmw(ror); break;
+        case operation::RTI: {
+            p = static_cast<uint8_t>((pull(bus) & ~B) | U);
+            const uint8_t lo = pull(bus);
+            pc = static_cast<uint16_t>(lo | (pull(bus) << 8u));
+            break;
+        }
+        case operation::RTS: {
+            const uint8_t lo = pull(bus);
+            pc = static_cast<uint16_t>((lo | (pull(bus) << 8u)) + 1);
+            break;
+        }
+        case operation::SBC: sbc(load()); break;
+        case operation::SEC: setFlag(C, true); break;
+        case operation::SED: setFlag(D, true); break;
+        case operation::SEI: setFlag(I, true); break;
+        case operation::STA: bus.write(addr, a); break;
+        case operation::STX: bus.write(addr, x); break;
+        case operation::STY: bus.write(addr, y); break;
+        case operation::TAX: x = a; setNZ(x); break;
+        case operation::TAY: y = a; setNZ(y); break;
+        case operation::TSX: x = s; setNZ(x); break;
+        case operation::TXA: a = x; setNZ(a); break;
+        case operation::TXS: s = x; break;
+        case operation::TYA: a = y; setNZ(a); break;
+        case operation::ILL: break; // We don't implement illegal instructions, treat them as a one byte NOP
+    }
+
+    return cycles;
+}
+
 
 #endif //NESEMU_CPU6502_H
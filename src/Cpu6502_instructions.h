@@ -14,11 +14,10 @@
 
 #include <cstdint>
 #include <array>
-#include <ios>
-#include <iomanip>
+#include <string>
+#include <string_view>
 
 #include <magic_enum.hpp>
-#include <fmt/core.h>
 
 // http://archive.6502.org/datasheets/rockwell_r650x_r651x.pdf
 // https://wiki.nesdev.com/w/index.php/CPU
@@ -101,30 +100,6 @@ enum class addressing_mode
     IND, // Absolute indirect
 };
 
-// Disassembly formats are from here http://www.thealmightyguru.com/Games/Hacking/Wiki/index.php/Addressing_Modes
-inline static std::string_view get_format_specifier(addressing_mode mode)
-{
-    switch(mode)
-    {
-        case addressing_mode::ACCUM:
-        case addressing_mode::IMPL: return "{}";
-        case addressing_mode::IMM:  return "{} #${:02X}";
-        case addressing_mode::ABS:  return "{} ${:04X}";
-        case addressing_mode::REL:
-        case addressing_mode::ZP:   return "{} ${:02X}";
-        case addressing_mode::ZPX:  return "{} ${:02X},X";
-        case addressing_mode::ZPY:  return "{} ${:02X},Y";
-        case addressing_mode::ABSX: return "{} ${:04X},X";
-        case addressing_mode::ABSY: return "{} ${:04X},Y";
-        case addressing_mode::INDX: return "{} (${:02X},X)";
-        case addressing_mode::INDY: return "{} (${:02X}),Y";
-        case addressing_mode::IND:  return "{} (${:04X})";
-    }
-    // Could throw for invalid, but for not just return empty to print nothing
-    // Will only happen if someone does something silly like cast an int to the enum
-    return "";
-}
-
 enum class special_duration
 {
     NONE,
@@ -141,9 +116,100 @@ struct instruction
     special_duration special;
 };
 
+// Longest possible output of disassemble_instruction, e.g. "ORA ($12),Y"
+static constexpr size_t max_disassembly_length = 11;
+
+// Writes the disassembly to out without allocating, and returns the number of characters written (no terminator)
+// out must have room for max_disassembly_length characters
+// Disassembly formats are from here http://www.thealmightyguru.com/Games/Hacking/Wiki/index.php/Addressing_Modes
+inline size_t disassemble_instruction(char *out, instruction instr, uint16_t operand)
+{
+    constexpr std::string_view hex_digits = "0123456789ABCDEF";
+    char *p = out;
+    auto put = [&p](std::string_view s) { for (char c : s) { *p++ = c; } };
+    auto put_hex = [&p, &hex_digits](uint16_t v, int digits) {
+        for (int shift = (digits - 1) * 4; shift >= 0; shift -= 4) { *p++ = hex_digits[(v >> static_cast<unsigned>(shift)) & 0xFu]; }
+    };
+
+    put(magic_enum::enum_name(instr.code));
+    switch(instr.mode)
+    {
+        case addressing_mode::ACCUM:
+        case addressing_mode::IMPL: break;
+        case addressing_mode::IMM:  put(" #$"); put_hex(operand, 2); break;
+        case addressing_mode::ABS:  put(" $"); put_hex(operand, 4); break;
+        case addressing_mode::REL:
+        case addressing_mode::ZP:   put(" $"); put_hex(operand, 2); break;
+        case addressing_mode::ZPX:  put(" $"); put_hex(operand, 2); put(",X"); break;
+        case addressing_mode::ZPY:  put(" $"); put_hex(operand, 2); put(",Y"); break;
+        case addressing_mode::ABSX: put(" $"); put_hex(operand, 4); put(",X"); break;
+        case addressing_mode::ABSY: put(" $"); put_hex(operand, 4); put(",Y"); break;
+        case addressing_mode::INDX: put(" ($"); put_hex(operand, 2); put(",X)"); break;
+        case addressing_mode::INDY: put(" ($"); put_hex(operand, 2); put("),Y"); break;
+        case addressing_mode::IND:  put(" ($"); put_hex(operand, 4); put(")"); break;
+    }
+    return static_cast<size_t>(p - out);
+}
+
 inline std::string disassemble_instruction(instruction instr, uint16_t operand)
 {
-    return fmt::format(get_format_specifier(instr.mode), magic_enum::enum_name(instr.code), operand);
+    char buf[max_disassembly_length];
+    return std::string(buf, disassemble_instruction(buf, instr, operand));
+}
+
+constexpr bool is_branch(operation code)
+{
+    switch(code)
+    {
+        case operation::BCC:
+        case operation::BCS:
+        case operation::BEQ:
+        case operation::BMI:
+        case operation::BNE:
+        case operation::BPL:
+        case operation::BVC:
+        case operation::BVS: return true;
+        default: return false;
+    }
+}
+
+// How an instruction touches the memory its operand points to (if at all)
+// N.B. JMP and JSR are control flow, not data accesses, so they report NONE
+enum class memory_access
+{
+    NONE,
+    READ,
+    WRITE,
+    READ_MODIFY_WRITE
+};
+
+constexpr memory_access get_memory_access(instruction instr)
+{
+    switch(instr.mode)
+    {
+        case addressing_mode::ACCUM:
+        case addressing_mode::IMM:
+        case addressing_mode::IMPL:
+        case addressing_mode::REL:
+        case addressing_mode::IND: return memory_access::NONE;
+        default: break;
+    }
+
+    switch(instr.code)
+    {
+        case operation::STA:
+        case operation::STX:
+        case operation::STY: return memory_access::WRITE;
+        case operation::ASL:
+        case operation::LSR:
+        case operation::ROL:
+        case operation::ROR:
+        case operation::INC:
+        case operation::DEC: return memory_access::READ_MODIFY_WRITE;
+        case operation::JMP:
+        case operation::JSR: return memory_access::NONE;
+        default: return memory_access::READ;
+    }
 }
 
 // The parameters of an illegal instruction are somewhat arbitrary since we don't support them
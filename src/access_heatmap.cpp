@@ -0,0 +1,55 @@
+#include "access_heatmap.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// v -= v / 8, rounded up so that counts below 8 still reach zero. (v & 7) + 7 is 8 or more exactly when v / 8 has a
+// remainder, and unlike v + 7 can't overflow
+void decayCounts(std::array<uint32_t, AccessHeatmap::entries> &counts) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i seven = _mm_set1_epi32(7);
+    auto *p = reinterpret_cast<__m128i *>(counts.data());
+    for (; i < counts.size() / 4; i++) {
+        const __m128i v = _mm_load_si128(p + i);
+        const __m128i round = _mm_srli_epi32(_mm_add_epi32(_mm_and_si128(v, seven), seven), 3);
+        _mm_store_si128(p + i, _mm_sub_epi32(_mm_sub_epi32(v, _mm_srli_epi32(v, 3)), round));
+    }
+    i *= 4;
+#endif
+    for (; i < counts.size(); i++) {
+        const uint32_t v = counts[i];
+        counts[i] = v - (v >> 3u) - (((v & 7u) + 7u) >> 3u);
+    }
+}
+
+}
+
+void AccessHeatmap::decay() {
+    decayCounts(reads);
+    decayCounts(writes);
+    decayCounts(executes);
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i step = _mm_set1_epi8(static_cast<char>(write_heat_decay));
+    auto *p = reinterpret_cast<__m128i *>(write_heat.data());
+    for (; i < write_heat.size() / 16; i++) {
+        _mm_store_si128(p + i, _mm_subs_epu8(_mm_load_si128(p + i), step));
+    }
+    i *= 16;
+#endif
+    for (; i < write_heat.size(); i++) {
+        write_heat[i] = static_cast<uint8_t>(write_heat[i] > write_heat_decay ? write_heat[i] - write_heat_decay : 0);
+    }
+}
+
+void AccessHeatmap::clear() {
+    reads.fill(0);
+    writes.fill(0);
+    executes.fill(0);
+    write_heat.fill(0);
+}
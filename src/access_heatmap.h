@@ -0,0 +1,42 @@
+#ifndef IMNES_ACCESS_HEATMAP_H
+#define IMNES_ACCESS_HEATMAP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Per byte read, write and execute counts over the CPU address space, for showing where memory is busy
+// Each counter is its own array so the per frame decay streams through memory. RAM mirrors are folded on to $0000-$07FF
+class AccessHeatmap {
+public:
+    static constexpr size_t entries = 0x10000;
+    // Write heat is set to this by a write, and fades to zero over max_write_heat / write_heat_decay frames
+    static constexpr uint8_t max_write_heat = 255;
+    static constexpr uint8_t write_heat_decay = 4;
+
+    void read(uint16_t addr) { reads[fold(addr)]++; }
+
+    void write(uint16_t addr) {
+        const uint16_t a = fold(addr);
+        writes[a]++;
+        write_heat[a] = max_write_heat;
+    }
+
+    void execute(uint16_t addr) { executes[fold(addr)]++; }
+
+    // Counters lose an eighth of their value and write heat fades. Call once per frame
+    void decay();
+
+    void clear();
+
+    alignas(64) std::array<uint32_t, entries> reads{};
+    alignas(64) std::array<uint32_t, entries> writes{};
+    alignas(64) std::array<uint32_t, entries> executes{};
+    alignas(64) std::array<uint8_t, entries> write_heat{};
+
+private:
+    static uint16_t fold(uint16_t addr) { return addr < 0x2000 ? static_cast<uint16_t>(addr & 0x7FFu) : addr; }
+};
+
+
+#endif //IMNES_ACCESS_HEATMAP_H
@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "allocation_guard.h"
+
+#if defined(IMNES_ENABLE_ALLOCATION_GUARD) && __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define IMNES_HAVE_BACKTRACE 1
+#endif
+
+namespace {
+
+// Trivially constructed, so that it is usable from operator new at any point in a thread's life
+struct guard_state
+{
+    allocation_counts counts;
+    const char *scope = nullptr; // Innermost allocation free scope
+    unsigned allowed = 0;        // AllowAllocations depth
+    bool armed = false;
+    bool reporting = false;      // Printing the stack trace may itself allocate
+};
+thread_local guard_state this_thread;
+
+#ifdef IMNES_ENABLE_ALLOCATION_GUARD
+void allocated(size_t size) {
+    guard_state &t = this_thread;
+    t.counts.allocations++;
+    if (t.scope == nullptr || !t.armed || t.allowed != 0 || t.reporting) [[likely]] {
+        return;
+    }
+    t.reporting = true;
+    std::fprintf(stderr, "Allocation of %zu bytes in allocation free scope \"%s\"\n", size, t.scope);
+#ifdef IMNES_HAVE_BACKTRACE
+    void *frames[64];
+    backtrace_symbols_fd(frames, backtrace(frames, 64), 2);
+#endif
+    std::abort();
+}
+
+void *allocate(size_t size) {
+    allocated(size);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *allocateAligned(size_t size, std::align_val_t al) {
+    allocated(size);
+    const auto align = static_cast<size_t>(al);
+#ifdef _WIN32
+    void *p = _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc wants a multiple of the alignment
+    void *p = std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+    if (p) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void deallocate(void *p) {
+    if (p) {
+        this_thread.counts.deallocations++;
+        std::free(p);
+    }
+}
+
+void deallocateAligned(void *p) {
+    if (p) {
+        this_thread.counts.deallocations++;
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+}
+#endif
+
+}
+
+#ifdef IMNES_ENABLE_ALLOCATION_GUARD
+// The array, nothrow and sized forms all end up in these
+void *operator new(size_t size) {
+    return allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t al) {
+    return allocateAligned(size, al);
+}
+
+void *operator new[](size_t size, std::align_val_t al) {
+    return allocateAligned(size, al);
+}
+
+void operator delete(void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    deallocateAligned(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    deallocateAligned(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    deallocateAligned(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+    deallocateAligned(p);
+}
+#endif
+
+allocation_counts thread_allocation_counts() {
+    return this_thread.counts;
+}
+
+void arm_allocation_guard(bool armed) {
+    this_thread.armed = armed;
+}
+
+AllocationFreeScope::AllocationFreeScope(const char *name) : outer(this_thread.scope) {
+    this_thread.scope = name;
+}
+
+AllocationFreeScope::~AllocationFreeScope() {
+    this_thread.scope = outer;
+}
+
+AllowAllocations::AllowAllocations() {
+    this_thread.allowed++;
+}
+
+AllowAllocations::~AllowAllocations() {
+    this_thread.allowed--;
+}
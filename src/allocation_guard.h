@@ -0,0 +1,58 @@
+#ifndef IMNES_ALLOCATION_GUARD_H
+#define IMNES_ALLOCATION_GUARD_H
+
+#include <cstdint>
+
+// Catches heap allocations that creep in to the emulation loop
+// Built with IMNES_ENABLE_ALLOCATION_GUARD, a debug option, the global operator new and delete are replaced with ones
+// that count allocations per thread. Once a thread is armed, an allocation inside one of its allocation free scopes
+// prints a stack trace and aborts. Arm a thread once it has warmed up, so that buffers have grown to their working size
+// Without it the scopes compile to nothing
+
+#ifdef IMNES_ENABLE_ALLOCATION_GUARD
+static constexpr bool allocation_guard_available = true;
+#define IMNES_ALLOCATION_CONCAT(a, b) a##b
+#define IMNES_ALLOCATION_VAR(prefix, line) IMNES_ALLOCATION_CONCAT(prefix, line)
+// The rest of the scope mustn't allocate. name is reported if it does, and must be a string literal
+#define IMNES_ALLOCATION_FREE(name) const AllocationFreeScope IMNES_ALLOCATION_VAR(imnes_allocation_free_, __LINE__)(name)
+// The rest of the scope may allocate, even inside an allocation free scope. For rare paths, like a table growing
+#define IMNES_ALLOW_ALLOCATIONS() const AllowAllocations IMNES_ALLOCATION_VAR(imnes_allow_allocations_, __LINE__)
+#else
+static constexpr bool allocation_guard_available = false;
+#define IMNES_ALLOCATION_FREE(name) static_cast<void>(0)
+#define IMNES_ALLOW_ALLOCATIONS() static_cast<void>(0)
+#endif
+
+struct allocation_counts
+{
+    uint64_t allocations = 0;
+    uint64_t deallocations = 0;
+};
+
+// This thread's allocations so far. Always zero without the guard
+allocation_counts thread_allocation_counts();
+
+// Start checking this thread's allocation free scopes, or stop
+void arm_allocation_guard(bool armed);
+
+class AllocationFreeScope {
+public:
+    explicit AllocationFreeScope(const char *name);
+    ~AllocationFreeScope();
+    AllocationFreeScope(const AllocationFreeScope &) = delete;
+    AllocationFreeScope &operator=(const AllocationFreeScope &) = delete;
+
+private:
+    const char *outer;
+};
+
+class AllowAllocations {
+public:
+    AllowAllocations();
+    ~AllowAllocations();
+    AllowAllocations(const AllowAllocations &) = delete;
+    AllowAllocations &operator=(const AllowAllocations &) = delete;
+};
+
+
+#endif //IMNES_ALLOCATION_GUARD_H
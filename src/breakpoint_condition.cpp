@@ -0,0 +1,257 @@
+#include <array>
+#include <cctype>
+#include <stdexcept>
+
+#include "breakpoint_condition.h"
+#include "console.h"
+
+// Recursive descent, one function per precedence level. Each returns the register holding its result
+// Registers are allocated like a stack, so the left operand of a binary operator is always the result register
+class BreakpointCondition::parser {
+public:
+    parser(std::string_view t, std::vector<instruction> &c) : text(t), code(c) {}
+
+    void parse() {
+        parseBinary(0);
+        skipSpace();
+        if (pos != text.size()) {
+            fail("unexpected input");
+        }
+    }
+
+private:
+    struct binary_op
+    {
+        std::string_view token;
+        opcode op;
+    };
+
+    // Operators from loosest to tightest binding. Longer tokens come before their prefixes
+    static constexpr std::array<std::array<binary_op, 4>, 9> levels = {{
+        {{{"||", opcode::LOGICAL_OR}}},
+        {{{"&&", opcode::LOGICAL_AND}}},
+        {{{"|", opcode::OR}}},
+        {{{"^", opcode::XOR}}},
+        {{{"&", opcode::AND}}},
+        {{{"==", opcode::EQ}, {"!=", opcode::NE}}},
+        {{{"<=", opcode::LE}, {">=", opcode::GE}, {"<", opcode::LT}, {">", opcode::GT}}},
+        {{{"<<", opcode::SHL}, {">>", opcode::SHR}}},
+        {{{"+", opcode::ADD}, {"-", opcode::SUB}}},
+    }};
+
+    [[noreturn]] void fail(const char *what) const {
+        throw std::runtime_error("Condition error at column " + std::to_string(pos + 1) + ": " + what);
+    }
+
+    void skipSpace() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) {
+            pos++;
+        }
+    }
+
+    // Matches a token, but not where it is the start of a longer operator (e.g. "&" in "&&", "<" in "<<")
+    bool accept(std::string_view token) {
+        skipSpace();
+        if (text.substr(pos, token.size()) != token) {
+            return false;
+        }
+        if (token.size() == 1 && pos + 1 < text.size()) {
+            const char next = text[pos + 1];
+            if ((token[0] == '&' || token[0] == '|' || token[0] == '<' || token[0] == '>') && next == token[0]) {
+                return false;
+            }
+            if ((token[0] == '<' || token[0] == '>' || token[0] == '!') && next == '=') {
+                return false;
+            }
+        }
+        pos += token.size();
+        return true;
+    }
+
+    uint8_t allocate() {
+        if (next_register >= max_registers) {
+            fail("expression too deeply nested");
+        }
+        return next_register++;
+    }
+
+    uint8_t emit(opcode op, uint8_t dst, uint8_t lhs = 0, uint8_t rhs = 0, int32_t imm = 0) {
+        code.push_back({op, dst, lhs, rhs, imm});
+        return dst;
+    }
+
+    uint8_t parseBinary(size_t level) {
+        if (level == levels.size()) {
+            return parseUnary();
+        }
+        const uint8_t lhs = parseBinary(level + 1);
+        for (;;) {
+            const binary_op *match = nullptr;
+            for (const auto &candidate : levels[level]) {
+                if (!candidate.token.empty() && accept(candidate.token)) {
+                    match = &candidate;
+                    break;
+                }
+            }
+            if (match == nullptr) {
+                return lhs;
+            }
+            const uint8_t rhs = parseBinary(level + 1);
+            emit(match->op, lhs, lhs, rhs);
+            next_register = static_cast<uint8_t>(lhs + 1);
+        }
+    }
+
+    uint8_t parseUnary() {
+        if (accept("!")) {
+            const uint8_t r = parseUnary();
+            return emit(opcode::NOT, r, r);
+        }
+        if (accept("~")) {
+            const uint8_t r = parseUnary();
+            return emit(opcode::BIT_NOT, r, r);
+        }
+        if (accept("-")) {
+            const uint8_t r = parseUnary();
+            return emit(opcode::NEG, r, r);
+        }
+        return parsePrimary();
+    }
+
+    uint8_t parsePrimary() {
+        skipSpace();
+        if (accept("(")) {
+            const uint8_t r = parseBinary(0);
+            if (!accept(")")) {
+                fail("expected )");
+            }
+            return r;
+        }
+        if (accept("[")) {
+            const uint8_t r = parseBinary(0);
+            if (!accept("]")) {
+                fail("expected ]");
+            }
+            return emit(opcode::PEEK, r, r);
+        }
+        if (pos < text.size() && (text[pos] == '$' || std::isdigit(static_cast<unsigned char>(text[pos])))) {
+            return emit(opcode::CONST, allocate(), 0, 0, parseNumber());
+        }
+        if (pos < text.size() && std::isalpha(static_cast<unsigned char>(text[pos]))) {
+            return emit(opcode::LOAD, allocate(), 0, 0, static_cast<int32_t>(parseName()));
+        }
+        fail("expected a value");
+    }
+
+    int32_t parseNumber() {
+        int base = 10;
+        if (text[pos] == '$') {
+            base = 16;
+            pos++;
+        } else if (text.substr(pos, 2) == "0x" || text.substr(pos, 2) == "0X") {
+            base = 16;
+            pos += 2;
+        }
+        int64_t v = 0;
+        size_t digits = 0;
+        for (; pos < text.size(); pos++, digits++) {
+            const auto ch = static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(text[pos])));
+            int digit;
+            if (std::isdigit(ch)) {
+                digit = ch - '0';
+            } else if (base == 16 && ch >= 'a' && ch <= 'f') {
+                digit = ch - 'a' + 10;
+            } else {
+                break;
+            }
+            v = v * base + digit;
+            if (v > INT32_MAX) {
+                fail("number too large");
+            }
+        }
+        if (digits == 0) {
+            fail("expected digits");
+        }
+        return static_cast<int32_t>(v);
+    }
+
+    value parseName() {
+        const size_t start = pos;
+        while (pos < text.size() && std::isalnum(static_cast<unsigned char>(text[pos]))) {
+            pos++;
+        }
+        std::string name(text.substr(start, pos - start));
+        for (auto &ch : name) {
+            ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+        }
+        static constexpr std::array<std::pair<std::string_view, value>, 10> names = {{
+            {"a", value::A}, {"x", value::X}, {"y", value::Y}, {"s", value::S}, {"p", value::P},
+            {"pc", value::PC}, {"scanline", value::SCANLINE}, {"dot", value::DOT},
+            {"frame", value::FRAME}, {"cycle", value::CYCLE},
+        }};
+        for (const auto &[n, v] : names) {
+            if (n == name) {
+                return v;
+            }
+        }
+        pos = start;
+        fail("unknown name");
+    }
+
+    std::string_view text;
+    std::vector<instruction> &code;
+    size_t pos = 0;
+    uint8_t next_register = 0;
+};
+
+BreakpointCondition::BreakpointCondition(std::string_view expression) : source(expression) {
+    parser(source, code).parse();
+}
+
+bool BreakpointCondition::evaluate(const Console &c) const {
+    std::array<int32_t, max_registers> r{};
+    for (const instruction &i : code) {
+        const int32_t lhs = r[i.lhs];
+        const int32_t rhs = r[i.rhs];
+        int32_t result = 0;
+        switch (i.op) {
+            case opcode::CONST: result = i.imm; break;
+            case opcode::LOAD:
+                switch (static_cast<value>(i.imm)) {
+                    case value::A: result = c.cpu.a; break;
+                    case value::X: result = c.cpu.x; break;
+                    case value::Y: result = c.cpu.y; break;
+                    case value::S: result = c.cpu.s; break;
+                    case value::P: result = c.cpu.p; break;
+                    case value::PC: result = c.cpu.pc; break;
+                    case value::SCANLINE: result = c.ppu.scanline; break;
+                    case value::DOT: result = c.ppu.dot; break;
+                    case value::FRAME: result = static_cast<int32_t>(c.ppu.frame & INT32_MAX); break;
+                    case value::CYCLE: result = static_cast<int32_t>(c.cycles & INT32_MAX); break;
+                }
+                break;
+            case opcode::PEEK: result = c.bus.peek(static_cast<uint16_t>(lhs)); break;
+            case opcode::NOT: result = !lhs; break;
+            case opcode::BIT_NOT: result = ~lhs; break;
+            case opcode::NEG: result = static_cast<int32_t>(0u - static_cast<uint32_t>(lhs)); break;
+            case opcode::ADD: result = static_cast<int32_t>(static_cast<uint32_t>(lhs) + static_cast<uint32_t>(rhs)); break;
+            case opcode::SUB: result = static_cast<int32_t>(static_cast<uint32_t>(lhs) - static_cast<uint32_t>(rhs)); break;
+            case opcode::SHL: result = static_cast<int32_t>(static_cast<uint32_t>(lhs) << (static_cast<uint32_t>(rhs) & 31u)); break;
+            case opcode::SHR: result = static_cast<int32_t>(static_cast<uint32_t>(lhs) >> (static_cast<uint32_t>(rhs) & 31u)); break;
+            case opcode::AND: result = lhs & rhs; break;
+            case opcode::OR: result = lhs | rhs; break;
+            case opcode::XOR: result = lhs ^ rhs; break;
+            case opcode::EQ: result = lhs == rhs; break;
+            case opcode::NE: result = lhs != rhs; break;
+            case opcode::LT: result = lhs < rhs; break;
+            case opcode::LE: result = lhs <= rhs; break;
+            case opcode::GT: result = lhs > rhs; break;
+            case opcode::GE: result = lhs >= rhs; break;
+            // Operands have no side effects, so there is nothing to gain from short circuiting
+            case opcode::LOGICAL_AND: result = lhs && rhs; break;
+            case opcode::LOGICAL_OR: result = lhs || rhs; break;
+        }
+        r[i.dst] = result;
+    }
+    return r[0] != 0;
+}
@@ -0,0 +1,62 @@
+#ifndef IMNES_BREAKPOINT_CONDITION_H
+#define IMNES_BREAKPOINT_CONDITION_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class Console;
+
+// A breakpoint condition such as "A == $40 && [$0300] > 3 && scanline < 20"
+// The expression is parsed once in to a small register machine program, which is only run when the
+// breakpoint's address is hit
+//
+// Operands: numbers ($hex, 0xhex or decimal), registers a x y s p pc, scanline, dot, frame, cycle,
+// and [expr] for a byte of CPU memory (read without side effects)
+// Operators, loosest first: || && | ^ & (== !=) (< <= > >=) (<< >>) (+ -) and unary ! ~ -
+class BreakpointCondition {
+public:
+    // N.B. constructor throws runtime_error if the expression doesn't parse
+    explicit BreakpointCondition(std::string_view expression);
+
+    bool evaluate(const Console &c) const;
+
+    const std::string &text() const { return source; }
+
+    // Number of instructions in the compiled program
+    size_t size() const { return code.size(); }
+
+    static constexpr size_t max_registers = 16;
+
+private:
+    enum class opcode : uint8_t
+    {
+        CONST, LOAD, PEEK,
+        NOT, BIT_NOT, NEG,
+        ADD, SUB, SHL, SHR, AND, OR, XOR,
+        EQ, NE, LT, LE, GT, GE, LOGICAL_AND, LOGICAL_OR,
+    };
+
+    enum class value : uint8_t
+    {
+        A, X, Y, S, P, PC, SCANLINE, DOT, FRAME, CYCLE,
+    };
+
+    struct instruction
+    {
+        opcode op;
+        uint8_t dst;
+        uint8_t lhs;
+        uint8_t rhs;
+        int32_t imm;
+    };
+
+    class parser;
+
+    std::string source;
+    std::vector<instruction> code;
+};
+
+
+#endif //IMNES_BREAKPOINT_CONDITION_H
@@ -0,0 +1,68 @@
+#ifndef IMNES_BREAKPOINTS_H
+#define IMNES_BREAKPOINTS_H
+
+#include <array>
+#include <cstdint>
+
+// Execute, read and write breakpoints over the CPU and PPU address spaces
+// Each address has a byte of flags, so checking an access is a single load
+class Breakpoints {
+public:
+    enum kind : uint8_t
+    {
+        EXECUTE = 1u << 0u,
+        READ = 1u << 1u,
+        WRITE = 1u << 2u,
+    };
+
+    enum class space : uint8_t
+    {
+        CPU,
+        PPU,
+    };
+
+    void set(space s, uint16_t addr, uint8_t kinds) {
+        update(s, addr, static_cast<uint8_t>(get(s, addr) | kinds));
+    }
+
+    void clear(space s, uint16_t addr, uint8_t kinds) {
+        update(s, addr, static_cast<uint8_t>(get(s, addr) & ~kinds));
+    }
+
+    void clearAll() {
+        cpu.fill(0);
+        ppu.fill(0);
+        count = 0;
+    }
+
+    uint8_t get(space s, uint16_t addr) const {
+        return s == space::CPU ? cpu[addr] : ppu[addr & 0x3FFFu];
+    }
+
+    // Number of addresses with at least one breakpoint
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    bool testCpu(uint16_t addr, kind k) const { return (cpu[addr] & k) != 0; }
+
+    bool testPpu(uint16_t addr, kind k) const { return (ppu[addr & 0x3FFFu] & k) != 0; }
+
+private:
+    void update(space s, uint16_t addr, uint8_t kinds) {
+        uint8_t &flags = s == space::CPU ? cpu[addr] : ppu[addr & 0x3FFFu];
+        if (flags == 0 && kinds != 0) {
+            count++;
+        } else if (flags != 0 && kinds == 0) {
+            count--;
+        }
+        flags = kinds;
+    }
+
+    std::array<uint8_t, 0x10000> cpu{};
+    std::array<uint8_t, 0x4000> ppu{};
+    size_t count = 0;
+};
+
+
+#endif //IMNES_BREAKPOINTS_H
@@ -0,0 +1,130 @@
+#include <algorithm>
+
+#include "bus.h"
+#include "ppu.h"
+
+void Bus::mapPages(uint16_t first_addr, size_t size, const uint8_t *read, uint8_t *write, page_type type) {
+    for (size_t offset = 0; offset < size; offset += 0x100) {
+        const size_t page = (first_addr + offset) >> 8u;
+        read_pages[page] = read ? read + offset : nullptr;
+        write_pages[page] = write ? write + offset : nullptr;
+        page_types[page] = type;
+    }
+}
+
+void Bus::mapMemory(uint16_t first_addr, size_t size, CowMemory &memory, page_type type) {
+    for (size_t i = 0; i < size / CowMemory::page_size; i++) {
+        const size_t page = (first_addr >> 8u) + i;
+        read_pages[page] = memory.page(i);
+        write_pages[page] = memory.isWritable(i) ? memory.writablePage(i) : nullptr;
+        page_types[page] = type;
+    }
+}
+
+void Bus::remapMemory() {
+    if (flat_ram.size() != 0) {
+        mapMemory(0, flat_ram.size(), flat_ram, page_type::RAM);
+        return;
+    }
+    // 2K of RAM mirrored 4 times
+    for (uint16_t mirror = 0; mirror < 0x2000; mirror += 0x800) {
+        mapMemory(mirror, ram.size(), ram, page_type::RAM);
+    }
+    mapMemory(0x6000, prg_ram.size(), prg_ram, page_type::PRG_RAM);
+}
+
+void Bus::forkFrom(Bus &parent, Ppu &p) {
+    *this = parent;
+    if (ppu) {
+        ppu = &p;
+    }
+    // Every page is shared now, so neither side can write straight to one any more
+    remapMemory();
+    parent.remapMemory();
+}
+
+void Bus::mapNes(Ppu &p, const uint8_t *prg_rom, size_t prg_rom_size) {
+    ppu = &p;
+    flat_ram = CowMemory();
+    read_pages.fill(nullptr);
+    write_pages.fill(nullptr);
+    page_types.fill(page_type::OPEN_BUS);
+    prg_rom_offsets.fill(-1);
+
+    remapMemory();
+    mapPages(0x2000, 0x2020, nullptr, nullptr, page_type::IO);
+
+    // ROM is mirrored to fill $8000-$FFFF. Writes go nowhere until we have mappers with registers
+    if (prg_rom_size != 0) {
+        const size_t size = std::min(prg_rom_size, size_t{0x8000});
+        for (size_t mirror = 0x8000; mirror < 0x10000; mirror += size) {
+            mapPages(static_cast<uint16_t>(mirror), size, prg_rom, nullptr, page_type::PRG_ROM);
+            for (size_t offset = 0; offset < size; offset += 0x100) {
+                prg_rom_offsets[(mirror + offset) >> 8u] = static_cast<int32_t>(offset);
+            }
+        }
+    }
+}
+
+void Bus::mapFlat(std::span<const uint8_t> image, uint16_t load_addr) {
+    ppu = nullptr;
+    prg_rom_offsets.fill(-1);
+    flat_ram = CowMemory(0x10000);
+    const size_t size = std::min(image.size(), flat_ram.size() - load_addr);
+    for (size_t i = 0; i < size; i++) {
+        flat_ram.write(load_addr + i, image[i]);
+    }
+    remapMemory();
+}
+
+uint8_t Bus::readIo(uint16_t addr) {
+    if (ppu && addr >= 0x2000 && addr < 0x4000) {
+        return ppu->readRegister(addr);
+    }
+    if (addr == 0x4016 || addr == 0x4017) {
+        // Serial read, the upper bits are open bus
+        const size_t port = addr & 1u;
+        if (controller_strobe) {
+            controller_shift[port] = buttons[port];
+        }
+        const uint8_t bit = controller_shift[port] & 1u;
+        controller_shift[port] = static_cast<uint8_t>((controller_shift[port] >> 1u) | 0x80u);
+        return static_cast<uint8_t>(0x40u | bit);
+    }
+    // Open bus. The last value on the bus is normally the high byte of the address
+    return static_cast<uint8_t>(addr >> 8u);
+}
+
+void Bus::writeIo(uint16_t addr, uint8_t value) {
+    const page_type type = pageType(addr);
+    if (type == page_type::RAM || type == page_type::PRG_RAM) {
+        // The page is shared with a fork or has never been written. Take our own copy of it
+        if (flat_ram.size() != 0) {
+            flat_ram.write(addr, value);
+        } else if (type == page_type::RAM) {
+            ram.write(addr & 0x7FFu, value);
+        } else {
+            prg_ram.write(addr - 0x6000u, value);
+        }
+        remapMemory();
+        return;
+    }
+    if (ppu && addr >= 0x2000 && addr < 0x4000) {
+        ppu->writeRegister(addr, value);
+        return;
+    }
+    if (ppu && addr == 0x4014) {
+        // OAM DMA https://wiki.nesdev.com/w/index.php/PPU_registers#OAMDMA
+        for (unsigned i = 0; i < 256; i++) {
+            ppu->oam[static_cast<uint8_t>(ppu->oam_addr + i)] = read(static_cast<uint16_t>((value << 8u) | i));
+        }
+        dma_cycles += 513;
+        return;
+    }
+    if (addr == 0x4016) {
+        controller_strobe = value & 1u;
+        if (controller_strobe) {
+            controller_shift = buttons;
+        }
+    }
+}
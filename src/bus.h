@@ -0,0 +1,116 @@
+#ifndef IMNES_BUS_H
+#define IMNES_BUS_H
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include "cow_memory.h"
+
+class Ppu;
+
+// Everything about the bus that changes as the machine runs, apart from memory. There are no pointers, so it can be
+// copied as is in to a save state
+struct bus_state
+{
+    // Standard controllers, one bit per button: A, B, Select, Start, Up, Down, Left, Right
+    // https://wiki.nesdev.com/w/index.php/Standard_controller
+    std::array<uint8_t, 2> buttons{};
+    std::array<uint8_t, 2> controller_shift{};
+    bool controller_strobe = false;
+
+    // Padding spelt out and zeroed, as it is saved (see machine_state)
+    std::array<uint8_t, 3> reserved{};
+    unsigned dma_cycles = 0;
+};
+
+// CPU address space
+// https://wiki.nesdev.com/w/index.php/CPU_memory_map
+// Memory is reached through a table of page pointers so the common case is a single lookup
+// Pages without a pointer are memory mapped I/O (or open bus)
+// RAM is copy on write, so that forks can share it. Pages that are shared have no write pointer, and the first
+// write to one takes a copy and remaps it
+class Bus : public bus_state {
+public:
+    enum class page_type : uint8_t
+    {
+        RAM,
+        PRG_RAM,
+        PRG_ROM,
+        IO,
+        OPEN_BUS,
+    };
+    static constexpr size_t page_type_count = 5;
+
+    // NROM mapping: 2K RAM, PPU and APU/IO registers, 8K PRG RAM and up to 32K of PRG ROM
+    void mapNes(Ppu &ppu, const uint8_t *prg_rom, size_t prg_rom_size);
+
+    // 64K of flat RAM with no I/O, for plain 6502 images. image is loaded at load_addr
+    void mapFlat(std::span<const uint8_t> image, uint16_t load_addr);
+
+    // Makes this a copy of parent, with all of its RAM shared until one of them writes to it. ppu is this bus's PPU
+    void forkFrom(Bus &parent, Ppu &ppu);
+
+    // Points the page tables at the current RAM pages. Needed after changing them other than through write()
+    void remapMemory();
+
+    uint8_t read(uint16_t addr) {
+        const uint8_t *page = read_pages[addr >> 8u];
+        if (page) [[likely]] {
+            return page[addr & 0xFFu];
+        }
+        return readIo(addr);
+    }
+
+    void write(uint16_t addr, uint8_t value) {
+        uint8_t *page = write_pages[addr >> 8u];
+        if (page) [[likely]] {
+            page[addr & 0xFFu] = value;
+            return;
+        }
+        writeIo(addr, value);
+    }
+
+    // Instruction stream reads. The same as read, but lets debugging hooks tell code from data
+    uint8_t fetch(uint16_t addr) { return read(addr); }
+    uint8_t fetchOperand(uint16_t addr) { return read(addr); }
+
+    // Read without side effects, for debuggers. I/O registers read as zero
+    uint8_t peek(uint16_t addr) const {
+        const uint8_t *page = read_pages[addr >> 8u];
+        return page ? page[addr & 0xFFu] : 0;
+    }
+
+    page_type pageType(uint16_t addr) const { return page_types[addr >> 8u]; }
+
+    // Offset in to PRG ROM of a page, or -1 if the page isn't ROM
+    int32_t prgRomOffset(uint8_t page) const { return prg_rom_offsets[page]; }
+
+    // Cycles the CPU owes to OAM DMA. The console takes these after each instruction
+    unsigned takeDmaCycles() {
+        const unsigned c = dma_cycles;
+        dma_cycles = 0;
+        return c;
+    }
+
+    // Only change these through write(), or call remapMemory() after
+    CowMemory ram{0x800};
+    CowMemory prg_ram{0x2000};
+    CowMemory flat_ram;
+
+private:
+    uint8_t readIo(uint16_t addr);
+    void writeIo(uint16_t addr, uint8_t value);
+    void mapPages(uint16_t first_addr, size_t size, const uint8_t *read, uint8_t *write, page_type type);
+    void mapMemory(uint16_t first_addr, size_t size, CowMemory &memory, page_type type);
+
+    Ppu *ppu = nullptr;
+
+    std::array<const uint8_t *, 256> read_pages{};
+    std::array<uint8_t *, 256> write_pages{};
+    std::array<page_type, 256> page_types{};
+    std::array<int32_t, 256> prg_rom_offsets{};
+};
+
+
+#endif //IMNES_BUS_H
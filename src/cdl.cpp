@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "bus.h"
+#include "cdl.h"
+
+CodeDataLog::CodeDataLog(size_t prg_size, size_t chr_size) : prg(prg_size), chr(chr_size) {
+    cpu_pages.fill(scratch.data());
+}
+
+void CodeDataLog::map(const Bus &bus) {
+    for (size_t page = 0; page < cpu_pages.size(); page++) {
+        const int32_t offset = bus.prgRomOffset(static_cast<uint8_t>(page));
+        const bool mapped = offset >= 0 && static_cast<size_t>(offset) + 0x100 <= prg.size();
+        cpu_pages[page] = mapped ? prg.data() + offset : scratch.data();
+        page_bank[page] = mapped ? static_cast<uint8_t>(((page >> 5u) & 3u) << 2u) : 0;
+    }
+}
+
+void CodeDataLog::clear() {
+    std::fill(prg.begin(), prg.end(), 0);
+    std::fill(chr.begin(), chr.end(), 0);
+}
+
+void CodeDataLog::save(const std::filesystem::path &p) const {
+    std::ofstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not create " + p.string());
+    }
+    std::vector<uint8_t> out(prg.size() + chr.size());
+    std::transform(prg.begin(), prg.end(), out.begin(), [](uint8_t f) { return static_cast<uint8_t>(f & ~OPERAND); });
+    std::copy(chr.begin(), chr.end(), out.begin() + static_cast<std::ptrdiff_t>(prg.size()));
+    file.write(reinterpret_cast<const char *>(out.data()), static_cast<std::streamsize>(out.size()));
+    if (!file) {
+        throw std::runtime_error("Could not write " + p.string());
+    }
+}
+
+void CodeDataLog::load(const std::filesystem::path &p) {
+    std::ifstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    if (std::filesystem::file_size(p) != prg.size() + chr.size()) {
+        throw std::runtime_error(p.string() + " is for a different ROM");
+    }
+    file.read(reinterpret_cast<char *>(prg.data()), static_cast<std::streamsize>(prg.size()));
+    file.read(reinterpret_cast<char *>(chr.data()), static_cast<std::streamsize>(chr.size()));
+    if (!file) {
+        throw std::runtime_error("Could not read " + p.string());
+    }
+}
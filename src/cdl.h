@@ -0,0 +1,68 @@
+#ifndef IMNES_CDL_H
+#define IMNES_CDL_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+class Bus;
+
+// Code/data logger: a byte of flags for every byte of PRG and CHR ROM, saying how it has been used
+// The flags and file layout are those of FCEUX, so .cdl files can be swapped between the two
+// http://fceux.com/web/help/CodeDataLogger.html
+class CodeDataLog {
+public:
+    enum prg_flag : uint8_t
+    {
+        CODE = 1u << 0u,
+        DATA = 1u << 1u,
+        BANK_MASK = 3u << 2u, // Which 8K of $8000-$FFFF the byte was accessed through
+        INDIRECT_CODE = 1u << 4u,
+        INDIRECT_DATA = 1u << 5u,
+        PCM = 1u << 6u,
+        OPERAND = 1u << 7u, // Ours, not FCEUX's. An operand byte rather than an opcode. Left out of saved files
+    };
+
+    enum chr_flag : uint8_t
+    {
+        RENDERED = 1u << 0u,
+        READ = 1u << 1u,
+    };
+
+    CodeDataLog(size_t prg_size, size_t chr_size);
+
+    // The log is indexed through the bus's page table, so must be remapped if that changes
+    void map(const Bus &bus);
+
+    // A single OR. Accesses outside PRG ROM go to a scratch page
+    void markCpu(uint16_t addr, uint8_t flags) {
+        const size_t page = addr >> 8u;
+        cpu_pages[page][addr & 0xFFu] |= static_cast<uint8_t>(flags | page_bank[page]);
+    }
+
+    void markChr(uint16_t addr, uint8_t flags) {
+        if (addr < chr.size()) {
+            chr[addr] |= flags;
+        }
+    }
+
+    void clear();
+
+    const std::vector<uint8_t> &prgFlags() const { return prg; }
+    const std::vector<uint8_t> &chrFlags() const { return chr; }
+
+    // N.B. throw runtime_error on failure. Loading also fails if the file is for a different sized ROM
+    void save(const std::filesystem::path &p) const;
+    void load(const std::filesystem::path &p);
+
+private:
+    std::vector<uint8_t> prg;
+    std::vector<uint8_t> chr;
+    std::array<uint8_t, 0x100> scratch{};
+    std::array<uint8_t *, 256> cpu_pages{};
+    std::array<uint8_t, 256> page_bank{};
+};
+
+
+#endif //IMNES_CDL_H
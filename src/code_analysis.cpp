@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "code_analysis.h"
+#include "Cpu6502_instructions.h"
+
+std::span<const code_analysis_result::xref> code_analysis_result::xrefsTo(uint16_t addr) const {
+    auto range = std::equal_range(xrefs.begin(), xrefs.end(), xref{addr, 0, xref_kind::CALL},
+                                  [](const xref &l, const xref &r) { return l.to < r.to; });
+    return {range.first, range.second};
+}
+
+size_t code_analysis_result::formatLabel(uint16_t addr, char *buf, size_t buf_size) const {
+    int len = 0;
+    if ((flags[addr] & VECTOR) && addr == reset_vector) {
+        len = snprintf(buf, buf_size, "reset");
+    } else if ((flags[addr] & VECTOR) && addr == nmi_vector) {
+        len = snprintf(buf, buf_size, "nmi");
+    } else if ((flags[addr] & VECTOR) && addr == irq_vector) {
+        len = snprintf(buf, buf_size, "irq");
+    } else if (flags[addr] & SUBROUTINE) {
+        len = snprintf(buf, buf_size, "sub_%04X", addr);
+    } else if (flags[addr] & JUMP_TARGET) {
+        len = snprintf(buf, buf_size, "loc_%04X", addr);
+    }
+    if (len <= 0 || buf_size == 0) {
+        return 0;
+    }
+    return std::min(static_cast<size_t>(len), buf_size - 1);
+}
+
+CodeAnalyser::CodeAnalyser() : worker(&CodeAnalyser::run, this) {
+}
+
+CodeAnalyser::~CodeAnalyser() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void CodeAnalyser::loadPrgRom(std::span<const uint8_t> prg_rom) {
+    {
+        std::lock_guard lock(mutex);
+        pending_prg.assign(prg_rom.begin(), prg_rom.end());
+        pending_load = true;
+        // Any edits still in the queue were made to the old image
+        pending_edits.clear();
+    }
+    wake.notify_one();
+}
+
+void CodeAnalyser::writePrgRom(size_t offset, uint8_t value) {
+    {
+        std::lock_guard lock(mutex);
+        pending_edits.push_back({offset, value});
+    }
+    wake.notify_one();
+}
+
+const code_analysis_result &CodeAnalyser::latest() {
+    results.update();
+    return results.front();
+}
+
+void CodeAnalyser::run() {
+    std::vector<edit> edits;
+    while (true) {
+        bool load = false;
+        {
+            std::unique_lock lock(mutex);
+            wake.wait(lock, [this] { return stopping || pending_load || !pending_edits.empty(); });
+            if (stopping) {
+                return;
+            }
+            if (pending_load) {
+                prg.swap(pending_prg);
+                pending_load = false;
+                load = true;
+            }
+            edits.swap(pending_edits);
+        }
+
+        if (load) {
+            // NROM style mapping: the first 16K bank is at $8000 and the last is at $C000
+            // For a 16K image these are the same bank, i.e. it is mirrored
+            image.fill(0);
+            mapped.fill(false);
+            const size_t bank_size = std::min(prg.size(), size_t{0x4000});
+            const size_t last_bank = prg.size() - bank_size;
+            for (size_t i = 0; i < bank_size; i++) {
+                image[0x8000 + i] = prg[i];
+                image[0xC000 + i] = prg[last_bank + i];
+                mapped[0x8000 + i] = mapped[0xC000 + i] = true;
+            }
+            analyseAll();
+        }
+
+        for (const auto &e : edits) {
+            if (e.offset >= prg.size()) {
+                continue;
+            }
+            prg[e.offset] = e.value;
+            const size_t bank_size = std::min(prg.size(), size_t{0x4000});
+            if (e.offset < bank_size) {
+                applyEdit(static_cast<uint16_t>(0x8000 + e.offset), e.value);
+            }
+            if (e.offset >= prg.size() - bank_size) {
+                applyEdit(static_cast<uint16_t>(0xC000 + e.offset - (prg.size() - bank_size)), e.value);
+            }
+        }
+        edits.clear();
+
+        publish();
+    }
+}
+
+uint16_t CodeAnalyser::readVector(uint16_t addr) const {
+    return static_cast<uint16_t>(image[addr] | (image[addr + 1u] << 8u));
+}
+
+void CodeAnalyser::analyseAll() {
+    working.flags.fill(0);
+    working.xrefs.clear();
+    blocks.clear();
+
+    // https://wiki.nesdev.com/w/index.php/CPU_memory_map
+    working.nmi_vector = readVector(0xFFFA);
+    working.reset_vector = readVector(0xFFFC);
+    working.irq_vector = readVector(0xFFFE);
+
+    for (auto v : {working.reset_vector, working.nmi_vector, working.irq_vector}) {
+        working.flags[v] |= code_analysis_result::VECTOR;
+    }
+    for (auto v : {working.reset_vector, working.nmi_vector, working.irq_vector}) {
+        trace(v);
+    }
+}
+
+void CodeAnalyser::applyEdit(uint16_t addr, uint8_t value) {
+    image[addr] = value;
+
+    if (addr >= 0xFFFA) {
+        // The roots have changed, so everything might have
+        analyseAll();
+        return;
+    }
+
+    using result = code_analysis_result;
+    auto it = blocks.upper_bound(addr);
+    const auto *block = it == blocks.begin() ? nullptr : &std::prev(it)->second;
+
+    if ((working.flags[addr] & (result::CODE | result::OPERAND)) == 0) {
+        if (working.flags[addr] & (result::JUMP_TARGET | result::SUBROUTINE | result::VECTOR)) {
+            // Something jumps here, but it did not decode before
+            trace(addr);
+            return;
+        }
+
+        // Otherwise this is data, unless decoding of the previous block stopped just short of it
+        if (block == nullptr || !(working.flags[static_cast<uint16_t>(addr - 1)] & (result::CODE | result::OPERAND))) {
+            return;
+        }
+        const instruction last = instructions[image[block->last]];
+        const bool ends_flow = last.code == operation::JMP || last.code == operation::RTS || last.code == operation::RTI
+                               || last.code == operation::BRK || is_branch(last.code);
+        if (block->successor_count != 0 || ends_flow) {
+            return;
+        }
+    }
+
+    if (block == nullptr) {
+        return;
+    }
+    const uint16_t start = block->start;
+    invalidateBlock(start);
+    // N.B. Blocks which were only reachable through the old contents are kept until the next full analysis
+    trace(start);
+}
+
+void CodeAnalyser::invalidateBlock(uint16_t start) {
+    using result = code_analysis_result;
+
+    auto it = blocks.find(start);
+    if (it == blocks.end()) {
+        return;
+    }
+    const auto block = it->second;
+    blocks.erase(it);
+
+    // N.B. The image may already have been edited, so go by the flags rather than decoding the last instruction again
+    for (size_t addr = block.start; addr <= 0xFFFF && (addr <= block.last || (working.flags[addr] & result::OPERAND)); addr++) {
+        working.flags[addr] &= static_cast<uint8_t>(~(result::CODE | result::OPERAND | result::BLOCK_START));
+    }
+
+    // Drop the references made from this block, and any labels which only existed because of them
+    std::vector<uint16_t> targets;
+    std::erase_if(working.xrefs, [&](const result::xref &x) {
+        if (x.from >= block.start && x.from <= block.last) {
+            targets.push_back(x.to);
+            return true;
+        }
+        return false;
+    });
+    for (auto t : targets) {
+        bool called = false;
+        bool jumped = false;
+        for (const auto &x : working.xrefs) {
+            if (x.to == t) {
+                called |= x.kind == result::xref_kind::CALL;
+                jumped |= x.kind == result::xref_kind::JUMP || x.kind == result::xref_kind::BRANCH;
+            }
+        }
+        if (!called) {
+            working.flags[t] &= static_cast<uint8_t>(~result::SUBROUTINE);
+        }
+        if (!jumped) {
+            working.flags[t] &= static_cast<uint8_t>(~result::JUMP_TARGET);
+        }
+    }
+}
+
+void CodeAnalyser::splitBlock(uint16_t addr) {
+    auto it = blocks.upper_bound(addr);
+    if (it == blocks.begin()) {
+        return;
+    }
+    auto &block = std::prev(it)->second;
+    if (block.start == addr || block.last < addr) {
+        return;
+    }
+
+    // Find the instruction before the split point. Instructions are at most 3 bytes
+    uint16_t prev = static_cast<uint16_t>(addr - 1);
+    while (!working.isInstructionStart(prev)) {
+        prev--;
+    }
+
+    code_analysis_result::basic_block tail{addr, block.last, block.successors, block.successor_count};
+    block.last = prev;
+    block.successors = {addr, 0};
+    block.successor_count = 1;
+    working.flags[addr] |= code_analysis_result::BLOCK_START;
+    blocks.emplace(addr, tail);
+}
+
+void CodeAnalyser::trace(uint16_t entry) {
+    using result = code_analysis_result;
+    auto &flags = working.flags;
+
+    auto add_xref = [this](uint16_t to, uint16_t from, result::xref_kind kind) {
+        working.xrefs.push_back({to, from, kind});
+    };
+
+    worklist.push_back(entry);
+    while (!worklist.empty()) {
+        const uint16_t start = worklist.back();
+        worklist.pop_back();
+
+        if (!mapped[start] || (flags[start] & result::OPERAND)) {
+            // Either not ROM, or a jump in to the middle of an instruction we have already decoded
+            continue;
+        }
+        if (flags[start] & result::CODE) {
+            splitBlock(start);
+            continue;
+        }
+
+        result::basic_block block{start, start, {}, 0};
+        bool decoded_any = false;
+        uint16_t pc = start;
+        while (true) {
+            const instruction instr = instructions[image[pc]];
+            if (instr.code == operation::ILL) {
+                break;
+            }
+
+            // All the bytes must be ROM that has not already been decoded as something else
+            bool fits = true;
+            for (uint16_t i = 0; i < instr.bytes; i++) {
+                const auto addr = static_cast<uint16_t>(pc + i);
+                fits &= mapped[addr] && (flags[addr] & (result::CODE | result::OPERAND)) == 0;
+            }
+            if (!fits) {
+                break;
+            }
+
+            flags[pc] |= result::CODE;
+            for (uint16_t i = 1; i < instr.bytes; i++) {
+                flags[static_cast<uint16_t>(pc + i)] |= result::OPERAND;
+            }
+            block.last = pc;
+            decoded_any = true;
+
+            uint16_t operand = 0;
+            if (instr.bytes > 1) {
+                operand = image[static_cast<uint16_t>(pc + 1)];
+            }
+            if (instr.bytes > 2) {
+                operand |= static_cast<uint16_t>(image[static_cast<uint16_t>(pc + 2)] << 8u);
+            }
+            const auto next = static_cast<uint16_t>(pc + instr.bytes);
+
+            switch (get_memory_access(instr)) {
+                case memory_access::NONE: break;
+                case memory_access::READ: add_xref(operand, pc, result::xref_kind::READ); break;
+                case memory_access::WRITE: add_xref(operand, pc, result::xref_kind::WRITE); break;
+                case memory_access::READ_MODIFY_WRITE: add_xref(operand, pc, result::xref_kind::READ_MODIFY_WRITE); break;
+            }
+
+            bool block_ends = false;
+            if (instr.code == operation::JMP && instr.mode == addressing_mode::ABS) {
+                add_xref(operand, pc, result::xref_kind::JUMP);
+                flags[operand] |= result::JUMP_TARGET;
+                block.successors[block.successor_count++] = operand;
+                worklist.push_back(operand);
+                block_ends = true;
+            } else if (instr.code == operation::JMP) {
+                // Indirect jump, the target is not known statically
+                add_xref(operand, pc, result::xref_kind::READ);
+                block_ends = true;
+            } else if (instr.code == operation::JSR) {
+                add_xref(operand, pc, result::xref_kind::CALL);
+                flags[operand] |= result::SUBROUTINE;
+                worklist.push_back(operand);
+            } else if (is_branch(instr.code)) {
+                const auto target = static_cast<uint16_t>(next + static_cast<int8_t>(operand));
+                add_xref(target, pc, result::xref_kind::BRANCH);
+                flags[target] |= result::JUMP_TARGET;
+                block.successors[block.successor_count++] = target;
+                block.successors[block.successor_count++] = next;
+                worklist.push_back(next);
+                worklist.push_back(target);
+                block_ends = true;
+            } else if (instr.code == operation::RTS || instr.code == operation::RTI || instr.code == operation::BRK) {
+                block_ends = true;
+            }
+
+            if (block_ends) {
+                break;
+            }
+
+            pc = next;
+            if (flags[pc] & result::CODE) {
+                // Fell through in to code we already know about
+                block.successors[block.successor_count++] = pc;
+                splitBlock(pc);
+                break;
+            }
+            if (flags[pc] & (result::JUMP_TARGET | result::SUBROUTINE | result::VECTOR)) {
+                // Something else jumps here, so it starts a new block
+                block.successors[block.successor_count++] = pc;
+                worklist.push_back(pc);
+                break;
+            }
+        }
+
+        if (decoded_any) {
+            flags[start] |= result::BLOCK_START;
+            blocks.emplace(start, block);
+        }
+    }
+}
+
+void CodeAnalyser::publish() {
+    auto &out = results.back();
+    out.generation = working.generation = working.generation + 1;
+    out.reset_vector = working.reset_vector;
+    out.nmi_vector = working.nmi_vector;
+    out.irq_vector = working.irq_vector;
+    out.flags = working.flags;
+
+    out.blocks.clear();
+    for (const auto &[start, block] : blocks) {
+        out.blocks.push_back(block);
+    }
+
+    out.xrefs = working.xrefs;
+    std::sort(out.xrefs.begin(), out.xrefs.end(), [](const auto &l, const auto &r) {
+        return l.to != r.to ? l.to < r.to : l.from < r.from;
+    });
+
+    results.publish();
+}
@@ -0,0 +1,135 @@
+#ifndef IMNES_CODE_ANALYSIS_H
+#define IMNES_CODE_ANALYSIS_H
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "triple_buffer.h"
+
+// Result of a recursive descent pass over the CPU address space
+// Everything is indexed by CPU address, so it can be used directly by the debugger views
+struct code_analysis_result
+{
+    enum flag : uint8_t
+    {
+        CODE = 1u << 0u, // First byte of an instruction
+        OPERAND = 1u << 1u, // Operand byte of an instruction
+        BLOCK_START = 1u << 2u, // First instruction of a basic block
+        JUMP_TARGET = 1u << 3u, // Target of a JMP or branch
+        SUBROUTINE = 1u << 4u, // Target of a JSR
+        VECTOR = 1u << 5u, // Target of the reset, NMI or IRQ vectors
+    };
+
+    enum class xref_kind : uint8_t
+    {
+        CALL,
+        JUMP,
+        BRANCH,
+        READ,
+        WRITE,
+        READ_MODIFY_WRITE,
+    };
+
+    struct xref
+    {
+        uint16_t to;
+        uint16_t from;
+        xref_kind kind;
+    };
+
+    struct basic_block
+    {
+        uint16_t start;
+        uint16_t last; // Address of the last instruction in the block
+        std::array<uint16_t, 2> successors;
+        uint8_t successor_count;
+    };
+
+    // Incremented every time a new result is published. Zero means nothing has been analysed yet
+    uint64_t generation = 0;
+
+    uint16_t reset_vector = 0;
+    uint16_t nmi_vector = 0;
+    uint16_t irq_vector = 0;
+
+    std::array<uint8_t, 0x10000> flags{};
+    std::vector<basic_block> blocks; // Sorted by start address
+    std::vector<xref> xrefs; // Sorted by target address, then source
+
+    bool isInstructionStart(uint16_t addr) const { return (flags[addr] & CODE) != 0; }
+
+    // All references to addr, in order of source address
+    std::span<const xref> xrefsTo(uint16_t addr) const;
+
+    // Writes the auto generated label for addr into buf
+    // Returns the length, or 0 if addr has no label
+    size_t formatLabel(uint16_t addr, char *buf, size_t buf_size) const;
+};
+
+// Runs the analysis on a worker thread so that the frame loop never has to
+// The UI thread picks up finished results through latest(), which never blocks
+class CodeAnalyser {
+public:
+    CodeAnalyser();
+    ~CodeAnalyser();
+
+    CodeAnalyser(const CodeAnalyser &) = delete;
+    CodeAnalyser &operator=(const CodeAnalyser &) = delete;
+
+    // Maps PRG ROM in to $8000-$FFFF (mirrored if it is 16K, as for NROM) and queues a full analysis
+    void loadPrgRom(std::span<const uint8_t> prg_rom);
+
+    // Notify the analyser of an edit to PRG ROM. Only the blocks touching the edit are re-analysed
+    void writePrgRom(size_t offset, uint8_t value);
+
+    // UI thread only. Returns the most recent finished result
+    const code_analysis_result &latest();
+
+private:
+    struct edit
+    {
+        size_t offset;
+        uint8_t value;
+    };
+
+    void run();
+
+    // Worker thread only from here on
+    void analyseAll();
+    void applyEdit(uint16_t addr, uint8_t value);
+    void trace(uint16_t entry);
+    void splitBlock(uint16_t addr);
+    void invalidateBlock(uint16_t start);
+    void publish();
+
+    uint16_t readVector(uint16_t addr) const;
+
+    // Shared between threads, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<uint8_t> pending_prg;
+    bool pending_load = false;
+    std::vector<edit> pending_edits;
+    bool stopping = false;
+
+    // Worker state
+    std::vector<uint8_t> prg;
+    std::array<uint8_t, 0x10000> image{};
+    std::array<bool, 0x10000> mapped{};
+    code_analysis_result working;
+    std::map<uint16_t, code_analysis_result::basic_block> blocks;
+    std::vector<uint16_t> worklist;
+
+    triple_buffer<code_analysis_result> results;
+
+    std::thread worker;
+};
+
+
+#endif //IMNES_CODE_ANALYSIS_H
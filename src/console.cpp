@@ -0,0 +1,441 @@
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "console.h"
+
+namespace {
+
+// Whether a run loop counts for the performance counters
+template<unsigned Features>
+constexpr bool counting = (Features & Console::INSTRUMENTED) != 0 && perf_counters_available;
+
+}
+
+// The CPU's view of the bus. Anything a feature needs to see of memory traffic goes here
+template<unsigned Features>
+struct Console::bus_access {
+    Console &c;
+
+    uint8_t fetch(uint16_t addr) {
+        if constexpr ((Features & CDL) != 0) {
+            c.cdl->markCpu(addr, CodeDataLog::CODE);
+        }
+        if constexpr ((Features & ACCESS_HEATMAP) != 0) {
+            c.heatmap->execute(addr);
+        }
+        if constexpr (counting<Features>) {
+            if (c.counters) {
+                c.counters->reads[static_cast<size_t>(c.bus.pageType(addr))]++;
+            }
+        }
+        return c.bus.fetch(addr);
+    }
+
+    uint8_t fetchOperand(uint16_t addr) {
+        if constexpr ((Features & CDL) != 0) {
+            c.cdl->markCpu(addr, CodeDataLog::CODE | CodeDataLog::OPERAND);
+        }
+        if constexpr ((Features & ACCESS_HEATMAP) != 0) {
+            c.heatmap->execute(addr);
+        }
+        if constexpr (counting<Features>) {
+            if (c.counters) {
+                c.counters->reads[static_cast<size_t>(c.bus.pageType(addr))]++;
+            }
+        }
+        return c.bus.fetchOperand(addr);
+    }
+
+    uint8_t read(uint16_t addr) {
+        if constexpr ((Features & BREAKPOINTS) != 0) {
+            c.watch(addr, Breakpoints::READ);
+        }
+        if constexpr ((Features & CDL) != 0) {
+            c.cdl->markCpu(addr, CodeDataLog::DATA);
+            // CHR reads through PPUDATA
+            if ((addr & 0xE007u) == 0x2007u && c.bus.pageType(addr) == Bus::page_type::IO && c.ppu.dataAddress() < 0x2000) {
+                c.cdl->markChr(c.ppu.dataAddress(), CodeDataLog::READ);
+            }
+        }
+        if constexpr ((Features & ACCESS_HEATMAP) != 0) {
+            c.heatmap->read(addr);
+        }
+        if constexpr (counting<Features>) {
+            if (c.counters) {
+                c.counters->reads[static_cast<size_t>(c.bus.pageType(addr))]++;
+            }
+        }
+        return c.bus.read(addr);
+    }
+
+    void write(uint16_t addr, uint8_t value) {
+        if constexpr ((Features & BREAKPOINTS) != 0) {
+            c.watch(addr, Breakpoints::WRITE);
+        }
+        if constexpr ((Features & ACCESS_HEATMAP) != 0) {
+            c.heatmap->write(addr);
+        }
+        if constexpr (counting<Features>) {
+            if (c.counters) {
+                c.counters->writes[static_cast<size_t>(c.bus.pageType(addr))]++;
+            }
+        }
+        c.bus.write(addr, value);
+    }
+};
+
+Console::Console(std::shared_ptr<const Ines> r) : rom(std::move(r)) {
+    if (rom->getMapperNum() != 0) {
+        throw std::runtime_error("Unsupported mapper " + std::to_string(rom->getMapperNum()));
+    }
+    const auto &prg = rom->getPrgRom();
+    const auto &chr = rom->getChrRom();
+    ppu.powerOn(chr.data(), chr.size(), rom->getMirroring());
+    bus.mapNes(ppu, prg.data(), prg.size());
+    cpu.powerOn();
+    cpu.decimal_mode = false;
+    rom_hash = ::rom_hash(*rom);
+    selectRunner();
+    reset();
+}
+
+Console::Console(std::span<const uint8_t> image, uint16_t load_addr, uint16_t start) : flat(true), start_pc(start) {
+    ppu.powerOn(nullptr, 0, Ines::Mirroring::HORIZONTAL);
+    bus.mapFlat(image, load_addr);
+    cpu.powerOn();
+    cpu.decimal_mode = true;
+    selectRunner();
+    reset();
+}
+
+Console::Console(fork_tag, Console &parent)
+        : cpu(parent.cpu), ppu(parent.ppu), cycles(parent.cycles), rom(parent.rom), rom_hash(parent.rom_hash),
+          flat(parent.flat), start_pc(parent.start_pc), resuming(parent.resuming), break_pending(parent.break_pending) {
+    bus.forkFrom(parent.bus, ppu);
+    selectRunner();
+}
+
+std::unique_ptr<Console> Console::fork() {
+    return std::unique_ptr<Console>(new Console(fork_tag{}, *this));
+}
+
+void Console::reset() {
+    if (flat) {
+        cpu.pc = start_pc;
+    } else if (cdl) {
+        // So that the vector shows up as data
+        bus_access<CDL & available_features> access{*this};
+        cpu.reset(access);
+    } else {
+        cpu.reset(bus);
+    }
+    resuming = false;
+    break_pending = false;
+}
+
+void Console::saveState(machine_state &state) const {
+    if (flat) {
+        throw std::runtime_error("Save states need an iNES image");
+    }
+    std::memcpy(state.header.magic, machine_state::magic, sizeof(state.header.magic));
+    state.header.version = machine_state::version;
+    state.header.size = sizeof(machine_state);
+    state.header.rom_hash = rom_hash;
+    state.cycles = cycles;
+    state.cpu = cpu;
+    state.reserved_cpu = {};
+    state.ppu = ppu;
+    state.bus = bus;
+    state.reserved_bus = {};
+    bus.ram.copyTo(state.ram);
+    bus.prg_ram.copyTo(state.prg_ram);
+    ppu.chr_ram.copyTo(state.chr_ram);
+}
+
+void Console::loadState(const machine_state &state) {
+    if (flat) {
+        throw std::runtime_error("Save states need an iNES image");
+    }
+    if (std::memcmp(state.header.magic, machine_state::magic, sizeof(state.header.magic)) != 0 ||
+        state.header.version != machine_state::version || state.header.size != sizeof(machine_state)) {
+        throw std::runtime_error("Save state is from a different version of imnes");
+    }
+    if (state.header.rom_hash != rom_hash) {
+        throw std::runtime_error("Save state is for a different ROM");
+    }
+    cycles = state.cycles;
+    cpu = state.cpu;
+    static_cast<ppu_state &>(ppu) = state.ppu;
+    static_cast<bus_state &>(bus) = state.bus;
+    // Whatever a file has there, padding stays zero
+    ppu.reserved = {};
+    bus.reserved = {};
+    bus.ram.copyFrom(state.ram);
+    bus.prg_ram.copyFrom(state.prg_ram);
+    ppu.chr_ram.copyFrom(state.chr_ram);
+    // RAM pages may have been copied. ROM pages don't move, but with a banking mapper this is where they would be
+    // remapped from the loaded registers
+    bus.remapMemory();
+    resuming = false;
+    break_pending = false;
+}
+
+template<unsigned Features>
+Console::stop_reason Console::run(uint64_t cycle_limit, bool stop_at_frame_end) {
+    const uint64_t frame = ppu.frame;
+    bus_access<Features> access{*this};
+    ppu.resumeTimeline();
+    [[maybe_unused]] std::chrono::steady_clock::time_point timing_mark;
+    if constexpr ((Features & INSTRUMENTED) != 0) {
+        if (timer) {
+            timing_mark = std::chrono::steady_clock::now();
+        }
+    }
+
+    while (cycles < cycle_limit) {
+        if constexpr ((Features & BREAKPOINTS) != 0) {
+            if (resuming) {
+                resuming = false;
+            } else if (bps->testCpu(cpu.pc, Breakpoints::EXECUTE) && conditionMet(Breakpoints::space::CPU, cpu.pc)) {
+                last_break = {cpu.pc, Breakpoints::space::CPU, Breakpoints::EXECUTE};
+                resuming = true;
+                return stop_reason::BREAKPOINT;
+            }
+        }
+
+        if constexpr ((Features & TRACE) != 0) {
+            trace_record &r = tracer->next();
+            r.cycle = cycles;
+            r.pc = cpu.pc;
+            r.scanline = ppu.scanline;
+            r.dot = ppu.dot;
+            for (uint16_t i = 0; i < 3; i++) {
+                r.bytes[i] = bus.peek(static_cast<uint16_t>(cpu.pc + i));
+            }
+            r.a = cpu.a;
+            r.x = cpu.x;
+            r.y = cpu.y;
+            r.s = cpu.s;
+            r.p = cpu.p;
+            r.flags = cpu.interruptPending() ? trace_record::INTERRUPT : 0;
+            tracer->commit();
+        }
+
+        [[maybe_unused]] uint16_t profile_pc = 0;
+        [[maybe_unused]] uint8_t profile_opcode = 0;
+        [[maybe_unused]] auto profile_interrupt = Profiler::entry_kind::ROOT;
+        if constexpr ((Features & PROFILE) != 0) {
+            profile_pc = cpu.pc;
+            profile_opcode = bus.peek(cpu.pc);
+            if (cpu.nmi_pending) {
+                profile_interrupt = Profiler::entry_kind::NMI;
+            } else if (cpu.interruptPending()) {
+                profile_interrupt = Profiler::entry_kind::IRQ;
+            }
+        }
+
+        const unsigned step_cycles = cpu.step(access);
+        const unsigned dma_cycles = bus.takeDmaCycles();
+        const unsigned c = step_cycles + dma_cycles;
+
+        if constexpr ((Features & PROFILE) != 0) {
+            prof->record(profile_pc, profile_opcode, profile_interrupt, c, cpu.pc);
+        }
+        [[maybe_unused]] std::chrono::steady_clock::time_point timing_cpu_end;
+        if constexpr ((Features & INSTRUMENTED) != 0) {
+            if (timer) {
+                timing_cpu_end = std::chrono::steady_clock::now();
+                timer->cpu += timing_cpu_end - timing_mark;
+            }
+        }
+        if constexpr (counting<Features>) {
+            if (counters) {
+                counters->instructions++;
+                counters->cycles += c;
+                counters->oam_dmas += dma_cycles != 0;
+            }
+        }
+        cycles += c;
+        ppu.tick(c * 3);
+        if constexpr ((Features & INSTRUMENTED) != 0) {
+            if (timer) {
+                timing_mark = std::chrono::steady_clock::now();
+                timer->ppu += timing_mark - timing_cpu_end;
+                timer->samples++;
+            }
+        }
+        if (ppu.nmi_edge) {
+            if constexpr (counting<Features>) {
+                if (counters) {
+                    counters->nmis++;
+                }
+            }
+            ppu.nmi_edge = false;
+            cpu.nmi_pending = true;
+        }
+
+        if constexpr ((Features & BREAKPOINTS) != 0) {
+            if (break_pending) {
+                break_pending = false;
+                return stop_reason::BREAKPOINT;
+            }
+        }
+        if (stop_at_frame_end && ppu.frame != frame) {
+            return stop_reason::FRAME_COMPLETE;
+        }
+    }
+    return stop_reason::CYCLE_LIMIT;
+}
+
+Console::stop_reason Console::runFrame() {
+    return (this->*run_fn)(std::numeric_limits<uint64_t>::max(), true);
+}
+
+Console::stop_reason Console::runCycles(uint64_t count) {
+    return (this->*run_fn)(cycles + count, false);
+}
+
+Console::stop_reason Console::step() {
+    resuming = true;
+    const stop_reason r = (this->*run_fn)(cycles + 1, false);
+    // We are now stopped at the new PC, so continuing shouldn't break there straight away
+    resuming = true;
+    return r;
+}
+
+void Console::selectRunner() {
+    static constexpr auto runners = makeRunners(std::make_index_sequence<1u << feature_count>{});
+    unsigned features = 0;
+    if (bps && !bps->empty()) {
+        features |= BREAKPOINTS;
+    }
+    if (tracer) {
+        features |= TRACE;
+    }
+    if (cdl) {
+        features |= CDL;
+    }
+    if (prof) {
+        features |= PROFILE;
+    }
+    if (heatmap) {
+        features |= ACCESS_HEATMAP;
+    }
+    if (timer || counters) {
+        features |= INSTRUMENTED;
+    }
+    run_fn = runners[features];
+}
+
+void Console::watch(uint16_t addr, Breakpoints::kind k) {
+    if (bps->testCpu(addr, k) && conditionMet(Breakpoints::space::CPU, addr)) {
+        last_break = {addr, Breakpoints::space::CPU, k};
+        break_pending = true;
+    }
+    // PPU memory is only reached through PPUDATA
+    if ((addr & 0xE007u) == 0x2007u && bus.pageType(addr) == Bus::page_type::IO && bps->testPpu(ppu.dataAddress(), k)
+        && conditionMet(Breakpoints::space::PPU, ppu.dataAddress())) {
+        last_break = {ppu.dataAddress(), Breakpoints::space::PPU, k};
+        break_pending = true;
+    }
+}
+
+void Console::setTrace(TraceBuffer *t) {
+    tracer = t;
+    selectRunner();
+}
+
+void Console::setCodeDataLog(CodeDataLog *log) {
+    if ((available_features & CDL) == 0 && log != nullptr) {
+        throw std::runtime_error("Built without the code/data logger");
+    }
+    cdl = log;
+    if (cdl) {
+        cdl->map(bus);
+    }
+    selectRunner();
+}
+
+void Console::setProfiler(Profiler *p) {
+    prof = p;
+    selectRunner();
+}
+
+void Console::setAccessHeatmap(AccessHeatmap *h) {
+    heatmap = h;
+    selectRunner();
+}
+
+void Console::setComponentTimes(component_times *times) {
+    timer = times;
+    selectRunner();
+}
+
+void Console::setPerfCounters(perf_counters *c) {
+    if (!perf_counters_available && c != nullptr) {
+        throw std::runtime_error("Built without the performance counters");
+    }
+    counters = c;
+    selectRunner();
+}
+
+// Only called once the bitmap has matched, so the common case never gets here
+bool Console::conditionMet(Breakpoints::space s, uint16_t addr) {
+    if (conds.empty()) {
+        return true;
+    }
+    const auto it = conds.find(conditionKey(s, addr));
+    if (it == conds.end()) {
+        return true;
+    }
+    condition_entry &entry = it->second;
+    const auto start = std::chrono::steady_clock::now();
+    const bool met = entry.condition.evaluate(*this);
+    entry.eval_time += std::chrono::steady_clock::now() - start;
+    entry.hits++;
+    entry.passes += met ? 1 : 0;
+    return met;
+}
+
+void Console::setCondition(Breakpoints::space s, uint16_t addr, std::string_view expression) {
+    conds.insert_or_assign(conditionKey(s, addr), condition_entry{BreakpointCondition(expression)});
+}
+
+void Console::clearCondition(Breakpoints::space s, uint16_t addr) {
+    conds.erase(conditionKey(s, addr));
+}
+
+void Console::setBreakpoint(Breakpoints::space s, uint16_t addr, uint8_t kinds) {
+    if (!bps) {
+        bps = std::make_unique<Breakpoints>();
+    }
+    bps->set(s, addr, kinds);
+    selectRunner();
+}
+
+void Console::clearBreakpoint(Breakpoints::space s, uint16_t addr, uint8_t kinds) {
+    if (bps) {
+        bps->clear(s, addr, kinds);
+    }
+    // Otherwise it would come back, unseen, on the next breakpoint set there
+    if (breakpoints().get(s, addr) == 0) {
+        clearCondition(s, addr);
+    }
+    selectRunner();
+}
+
+void Console::toggleBreakpoint(Breakpoints::space s, uint16_t addr, uint8_t kinds) {
+    if ((breakpoints().get(s, addr) & kinds) == kinds) {
+        clearBreakpoint(s, addr, kinds);
+    } else {
+        setBreakpoint(s, addr, kinds);
+    }
+}
+
+void Console::clearAllBreakpoints() {
+    bps.reset();
+    conds.clear();
+    selectRunner();
+}
@@ -0,0 +1,215 @@
+#ifndef IMNES_CONSOLE_H
+#define IMNES_CONSOLE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "access_heatmap.h"
+#include "breakpoint_condition.h"
+#include "breakpoints.h"
+#include "bus.h"
+#include "cdl.h"
+#include "Cpu6502.h"
+#include "ines.h"
+#include "machine_state.h"
+#include "perf_counters.h"
+#include "ppu.h"
+#include "profiler.h"
+#include "trace.h"
+
+// A whole machine: CPU, PPU and the bus between them
+// The run loop is a template over the debugging features in use, so a run without breakpoints
+// (or anything else) compiles to the bare interpreter. The right instantiation is picked whenever
+// the set of active features changes, never per instruction
+class Console {
+public:
+    enum feature : unsigned
+    {
+        BREAKPOINTS = 1u << 0u,
+        TRACE = 1u << 1u,
+        CDL = 1u << 2u,
+        PROFILE = 1u << 3u,
+        ACCESS_HEATMAP = 1u << 4u,
+        // Component times and performance counters. They only measure, so they share one instantiation and check
+        // which of them are attached as they go, rather than doubling the number of run loops each
+        INSTRUMENTED = 1u << 5u,
+    };
+    static constexpr unsigned feature_count = 6;
+
+    // Features that are built in to the run loop. The others are compiled out entirely
+    // The performance counters are part of INSTRUMENTED, but only built in with IMNES_ENABLE_PERF_COUNTERS
+    static constexpr unsigned available_features = BREAKPOINTS | TRACE | PROFILE | ACCESS_HEATMAP | INSTRUMENTED
+#ifdef IMNES_ENABLE_CDL
+                                                   | CDL
+#endif
+            ;
+
+    enum class stop_reason
+    {
+        FRAME_COMPLETE,
+        CYCLE_LIMIT,
+        BREAKPOINT,
+    };
+
+    struct break_info
+    {
+        uint16_t addr = 0;
+        Breakpoints::space space = Breakpoints::space::CPU;
+        Breakpoints::kind kind = Breakpoints::EXECUTE;
+    };
+
+    // A condition attached to the breakpoints at an address, with what it has cost so far
+    struct condition_entry
+    {
+        BreakpointCondition condition;
+        uint64_t hits = 0;          // times the address was hit and the condition evaluated
+        uint64_t passes = 0;        // times the condition was true
+        std::chrono::nanoseconds eval_time{};
+    };
+
+    using component_times = ::component_times;
+
+    // N.B. constructor may throw runtime_error if the mapper isn't supported
+    explicit Console(std::shared_ptr<const Ines> rom);
+
+    // Plain 6502 image in 64K of RAM, with decimal mode. Reset starts at start_pc rather than the vector
+    Console(std::span<const uint8_t> image, uint16_t load_addr, uint16_t start_pc);
+
+    // The bus and PPU point in to each other, so a console stays where it is. Use fork() to copy one
+    Console(const Console &) = delete;
+    Console &operator=(const Console &) = delete;
+
+    // A copy of the machine that shares all of its RAM with this one. Either side copies a page the first time it
+    // writes to it, so a fork takes microseconds and only costs the memory it goes on to change
+    // Breakpoints and debugging tools stay with this console. Fork from one thread at a time, but the forks
+    // can then run on any thread
+    std::unique_ptr<Console> fork();
+
+    void reset();
+
+    // Run until the PPU starts a new frame
+    stop_reason runFrame();
+
+    // Run for at least this many CPU cycles
+    stop_reason runCycles(uint64_t count);
+
+    // Execute exactly one instruction (or interrupt entry). Doesn't stop on an execute breakpoint at the PC
+    stop_reason step();
+
+    // Copy the machine in to state. Breakpoints and debugging tools aren't part of it
+    // N.B. throws runtime_error for flat images, which have no save states
+    void saveState(machine_state &state) const;
+    // N.B. throws runtime_error if state is from a different ROM or version
+    void loadState(const machine_state &state);
+
+    void setBreakpoint(Breakpoints::space s, uint16_t addr, uint8_t kinds);
+    void clearBreakpoint(Breakpoints::space s, uint16_t addr, uint8_t kinds);
+    void toggleBreakpoint(Breakpoints::space s, uint16_t addr, uint8_t kinds);
+    void clearAllBreakpoints();
+    const Breakpoints &breakpoints() const { return bps ? *bps : no_breakpoints; }
+
+    // Only stop at the breakpoints on this address when expression is true
+    // The condition is dropped along with the last breakpoint on the address
+    // Read and write conditions are evaluated before the access, so see memory as it was
+    // N.B. throws runtime_error if the expression doesn't parse
+    void setCondition(Breakpoints::space s, uint16_t addr, std::string_view expression);
+    void clearCondition(Breakpoints::space s, uint16_t addr);
+    // Keyed by conditionKey
+    const std::unordered_map<uint32_t, condition_entry> &conditions() const { return conds; }
+    static uint32_t conditionKey(Breakpoints::space s, uint16_t addr) {
+        return (static_cast<uint32_t>(s) << 16u) | addr;
+    }
+
+    // Record every instruction executed in to trace, or stop tracing if it is nullptr
+    // The console doesn't own the trace, it must outlive its use here
+    void setTrace(TraceBuffer *t);
+    TraceBuffer *trace() const { return tracer; }
+
+    // Mark code and data use of the ROM in log, or stop if it is nullptr. The log must outlive its use here
+    // N.B. throws runtime_error if the code/data logger was compiled out
+    void setCodeDataLog(CodeDataLog *log);
+    CodeDataLog *codeDataLog() const { return cdl; }
+
+    // Count cycles per PC and per call stack in to profiler, or stop if it is nullptr. It must outlive its use here
+    void setProfiler(Profiler *p);
+    Profiler *profiler() const { return prof; }
+
+    // Count memory accesses in to heatmap, or stop if it is nullptr. It must outlive its use here
+    void setAccessHeatmap(AccessHeatmap *h);
+    AccessHeatmap *accessHeatmap() const { return heatmap; }
+
+    // Add the time spent in each component in to times, or stop if it is nullptr. It must outlive its use here
+    // Reading the clock twice an instruction slows the run down a lot, so use it for the split, not the total
+    void setComponentTimes(component_times *times);
+    component_times *componentTimes() const { return timer; }
+
+    // Add counts of instructions, cycles, bus accesses and events in to counters, or stop if it is nullptr. It must
+    // outlive its use here
+    // N.B. throws runtime_error if the counters were compiled out
+    void setPerfCounters(perf_counters *counters);
+    perf_counters *perfCounters() const { return counters; }
+
+    // What caused the last BREAKPOINT stop
+    const break_info &lastBreak() const { return last_break; }
+
+    Cpu6502 cpu{};
+    Ppu ppu;
+    Bus bus;
+    uint64_t cycles = 0;
+
+private:
+    template<unsigned Features>
+    struct bus_access;
+
+    struct fork_tag
+    {
+    };
+    Console(fork_tag, Console &parent);
+
+    using runner = stop_reason (Console::*)(uint64_t cycle_limit, bool stop_at_frame_end);
+
+    template<unsigned Features>
+    stop_reason run(uint64_t cycle_limit, bool stop_at_frame_end);
+
+    template<size_t... I>
+    static constexpr std::array<runner, sizeof...(I)> makeRunners(std::index_sequence<I...>) {
+        return {&Console::run<static_cast<unsigned>(I) & available_features>...};
+    }
+
+    void selectRunner();
+    void watch(uint16_t addr, Breakpoints::kind k);
+    bool conditionMet(Breakpoints::space s, uint16_t addr);
+
+    std::shared_ptr<const Ines> rom;
+    uint64_t rom_hash = 0; // As when the console was made, so that edits to the ROM don't invalidate save states
+    bool flat = false;
+    uint16_t start_pc = 0;
+
+    runner run_fn = nullptr;
+
+    // Made on first use. At 80K it would otherwise be most of the size of a fork
+    std::unique_ptr<Breakpoints> bps;
+    inline static const Breakpoints no_breakpoints{};
+    std::unordered_map<uint32_t, condition_entry> conds;
+    break_info last_break;
+    // Set when we stop at an execute breakpoint, so that the next run executes it rather than stopping again
+    bool resuming = false;
+    // Set by a read or write breakpoint part way through an instruction. We stop once it completes
+    bool break_pending = false;
+
+    TraceBuffer *tracer = nullptr;
+    CodeDataLog *cdl = nullptr;
+    Profiler *prof = nullptr;
+    AccessHeatmap *heatmap = nullptr;
+    component_times *timer = nullptr;
+    perf_counters *counters = nullptr;
+};
+
+
+#endif //IMNES_CONSOLE_H
@@ -0,0 +1,50 @@
+#include <algorithm>
+#include <cstring>
+
+#include "cow_memory.h"
+
+uint8_t *CowMemory::writablePage(size_t i) {
+    page_ref &p = pages[i];
+    if (!p) {
+        p = page_ref(new page_block);
+    } else if (!p.unique()) {
+        auto *copy = new page_block;
+        copy->bytes = p.get()->bytes;
+        p = page_ref(copy);
+    }
+    return p.get()->bytes.data();
+}
+
+void CowMemory::copyTo(std::span<uint8_t> out) const {
+    for (size_t i = 0; i < pages.size(); i++) {
+        std::memcpy(out.data() + i * page_size, page(i), page_size);
+    }
+}
+
+void CowMemory::copyFrom(std::span<const uint8_t> in) {
+    for (size_t i = 0; i < pages.size(); i++) {
+        const uint8_t *src = in.data() + i * page_size;
+        // Leave pages alone that already match, so that they stay shared (or unallocated)
+        if (std::memcmp(page(i), src, page_size) != 0) {
+            std::memcpy(writablePage(i), src, page_size);
+        }
+    }
+}
+
+size_t CowMemory::privateBytes() const {
+    return page_size * static_cast<size_t>(std::count_if(pages.begin(), pages.end(), [](const auto &p) {
+        return p.unique();
+    }));
+}
+
+bool CowMemory::operator==(const CowMemory &other) const {
+    if (pages.size() != other.pages.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < pages.size(); i++) {
+        if (pages[i].get() != other.pages[i].get() && std::memcmp(page(i), other.page(i), page_size) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
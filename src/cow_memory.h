@@ -0,0 +1,92 @@
+#ifndef IMNES_COW_MEMORY_H
+#define IMNES_COW_MEMORY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Memory in 256 byte pages, which copies of it share until one of them writes to a page
+// Copying costs a reference per page rather than the memory itself, which is what makes Console::fork cheap.
+// Pages that have never been written aren't allocated, and read as zero
+// A page is never changed while it is shared, so a copy can be handed to another thread
+class CowMemory {
+public:
+    static constexpr size_t page_size = 0x100;
+
+    // size is rounded down to whole pages
+    explicit CowMemory(size_t size = 0) : pages(size / page_size) {}
+
+    size_t size() const { return pages.size() * page_size; }
+    size_t pageCount() const { return pages.size(); }
+
+    uint8_t read(size_t addr) const { return page(addr / page_size)[addr % page_size]; }
+    void write(size_t addr, uint8_t value) { writablePage(addr / page_size)[addr % page_size] = value; }
+
+    const uint8_t *page(size_t i) const { return pages[i] ? pages[i].get()->bytes.data() : zero_page.data(); }
+
+    // True if the page can be written without copying it first
+    bool isWritable(size_t i) const { return pages[i].unique(); }
+
+    // Copies the page first if it is shared or unallocated, which leaves earlier page() pointers to it stale
+    uint8_t *writablePage(size_t i);
+
+    // out and in are size() bytes
+    void copyTo(std::span<uint8_t> out) const;
+    void copyFrom(std::span<const uint8_t> in);
+
+    // Bytes in pages that no other copy shares
+    size_t privateBytes() const;
+
+    bool operator==(const CowMemory &other) const;
+
+private:
+    struct page_block
+    {
+        std::atomic<uint32_t> refs{1};
+        std::array<uint8_t, page_size> bytes{};
+    };
+
+    // Counted reference to a page. Not std::shared_ptr, as unique() has to be an acquire: another thread may have been
+    // reading the page until it dropped its reference, and that has to be finished before we write to it
+    class page_ref {
+    public:
+        page_ref() = default;
+        explicit page_ref(page_block *p_) : p(p_) {}
+        page_ref(const page_ref &other) : p(other.p) { retain(); }
+        page_ref(page_ref &&other) noexcept : p(std::exchange(other.p, nullptr)) {}
+        page_ref &operator=(page_ref other) noexcept {
+            std::swap(p, other.p);
+            return *this;
+        }
+        ~page_ref() { release(); }
+
+        explicit operator bool() const { return p != nullptr; }
+        page_block *get() const { return p; }
+        bool unique() const { return p && p->refs.load(std::memory_order_acquire) == 1; }
+
+    private:
+        void retain() {
+            if (p) {
+                p->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        void release() {
+            if (p && p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete p;
+            }
+        }
+
+        page_block *p = nullptr;
+    };
+
+    static constexpr std::array<uint8_t, page_size> zero_page{};
+
+    std::vector<page_ref> pages;
+};
+
+
+#endif //IMNES_COW_MEMORY_H
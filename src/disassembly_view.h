@@ -1,22 +1,42 @@
 #ifndef DISASSEMBLY_VIEW_H
 #define DISASSEMBLY_VIEW_H
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdint>
 #include <cmath> //trunc
+#include <vector>
+
+#include "cdl.h"
+#include "code_analysis.h"
+#include "Cpu6502_instructions.h"
 
 struct disassembly_view
 {
     // Settings
     bool            Open = true;                                // set to false when DrawWindow() was closed. ignore if not using DrawWindow().
+    bool            Visible = false;                            // set by DrawWindow(): false while collapsed or hidden.
     bool            ReadOnly = false;                           // disable any editing.
     unsigned int    MaxCols = 3;                                // Max number of columns per instruction
-    unsigned int    MaxDisasmChars = 16;                         // Max number of columns per instruction
+    unsigned int    MaxDisasmChars = 32;                        // Max number of characters of disassembly per row
     bool            OptShowOptions = true;                      // display options button/context menu. when disabled, options will be locked unless you provide your own UI for them.
     bool            OptGreyOutZeroes = true;                    // display null/zero bytes using the TextDisabled color.
     bool            OptUpperCaseHex = true;                     // display hexadecimal values as "FF" instead of "ff".
     unsigned int    OptAddrDigitsCount = 0;                     // number of addr digits to display (default calculated based on maximum displayed addr).
     ImU32           HighlightColor = IM_COL32(255, 255, 255, 50); // background color of highlighted bytes. NOLINT(hicpp-signed-bitwise)
+    ImU32           LabelColor = IM_COL32(255, 200, 80, 255);   // color of auto generated labels. NOLINT(hicpp-signed-bitwise)
+    const code_analysis_result* Analysis = nullptr;             // optional result of CodeAnalyser. when set, rows follow instruction boundaries and show labels.
+    const ImU8*     CodeDataFlags = nullptr;                    // optional CodeDataLog flags, one per byte of mem_data. bytes the log has seen override the analysis.
+    uint64_t        CodeDataGeneration = 0;                     // change this to have rows rebuilt from the latest CodeDataFlags.
+    void            (*WriteFn)(ImU8* data, size_t off, ImU8 d) = nullptr; // optional handler to write bytes.
+    bool            (*BreakpointFn)(size_t addr) = nullptr;     // optional query for an execute breakpoint at a display address.
+    void            (*ToggleBreakpointFn)(size_t addr) = nullptr; // optional handler called when an address is clicked.
+    ImU32           BreakpointColor = IM_COL32(255, 60, 60, 120); // background color of addresses with a breakpoint. NOLINT(hicpp-signed-bitwise)
+    size_t          CurrentAddr = std::numeric_limits<std::size_t>::max(); // display address of the row to mark as current (e.g. the PC).
+    ImU32           CurrentColor = IM_COL32(80, 160, 255, 60);  // background color of the current row. NOLINT(hicpp-signed-bitwise)
+    const uint64_t* CycleCounts = nullptr;                      // optional cycles spent at each display address (e.g. Profiler::cyclesAt). rows are colored by heat.
+    uint64_t        CycleCountMax = 0;                          // largest of CycleCounts, for scaling.
+    ImU32           HeatColor = IM_COL32(255, 90, 0, 160);      // background color of the hottest rows, cooler rows fade out. NOLINT(hicpp-signed-bitwise)
 
     // [Internal State]
     bool            ContentsWidthChanged = false;
@@ -27,6 +47,12 @@ struct disassembly_view
     size_t          GotoAddr = std::numeric_limits<std::size_t>::max();
     size_t          HighlightMin = std::numeric_limits<std::size_t>::max();
     size_t          HighlightMax = std::numeric_limits<std::size_t>::max();
+    std::vector<size_t> LineStarts;                             // offset of the first byte of each row, rebuilt when a new analysis arrives
+    uint64_t        LinesGeneration = 0;
+    uint64_t        LinesCodeDataGeneration = 0;
+    const ImU8*     LinesCodeDataFlags = nullptr;
+    size_t          LinesMemSize = 0;
+    size_t          LinesBaseAddr = 0;
 
     void GotoAddrAndHighlight(size_t addr_min, size_t addr_max)
     {
@@ -49,6 +75,171 @@ struct disassembly_view
         float   WindowWidth= 0.0;
     };
 
+    bool HaveAnalysis() const
+    {
+        return (Analysis != nullptr && Analysis->generation != 0) || CodeDataFlags != nullptr;
+    }
+
+    // What the code/data log has seen wins, as it comes from actually running the code
+    bool IsInstructionStart(size_t addr, size_t base_display_addr) const
+    {
+        if (CodeDataFlags != nullptr)
+        {
+            const ImU8 flags = CodeDataFlags[addr];
+            if (flags & CodeDataLog::CODE)
+                return !(flags & CodeDataLog::OPERAND);
+            if (flags & CodeDataLog::DATA)
+                return false;
+        }
+        const size_t cpu_addr = base_display_addr + addr;
+        return Analysis != nullptr && Analysis->generation != 0 && cpu_addr <= 0xFFFF && Analysis->isInstructionStart(static_cast<uint16_t>(cpu_addr));
+    }
+
+    // Rows are instruction aligned when there is an analysis or code/data log to go on, otherwise they are MaxCols bytes each
+    void UpdateLines(const ImU8* mem_data, size_t mem_size, size_t base_display_addr)
+    {
+        if (!HaveAnalysis())
+        {
+            LineStarts.clear();
+            LinesGeneration = 0;
+            return;
+        }
+        const uint64_t generation = Analysis != nullptr ? Analysis->generation : 0;
+        if (!LineStarts.empty() && generation == LinesGeneration && CodeDataGeneration == LinesCodeDataGeneration && CodeDataFlags == LinesCodeDataFlags
+            && mem_size == LinesMemSize && base_display_addr == LinesBaseAddr)
+            return;
+
+        LineStarts.clear();
+        for (size_t addr = 0; addr < mem_size; )
+        {
+            LineStarts.push_back(addr);
+            size_t len = 1;
+            if (IsInstructionStart(addr, base_display_addr))
+            {
+                len = std::min<size_t>(instructions[mem_data[addr]].bytes, mem_size - addr);
+            }
+            else
+            {
+                // Group data bytes, but never swallow the start of an instruction
+                while (len < MaxCols && addr + len < mem_size && !IsInstructionStart(addr + len, base_display_addr))
+                    len++;
+            }
+            addr += len;
+        }
+        LinesGeneration = generation;
+        LinesCodeDataGeneration = CodeDataGeneration;
+        LinesCodeDataFlags = CodeDataFlags;
+        LinesMemSize = mem_size;
+        LinesBaseAddr = base_display_addr;
+    }
+
+    size_t LineCount(size_t mem_size) const
+    {
+        return LineStarts.empty() ? (mem_size + MaxCols - 1) / MaxCols : LineStarts.size();
+    }
+
+    size_t LineStart(size_t line) const
+    {
+        return LineStarts.empty() ? line * MaxCols : LineStarts[line];
+    }
+
+    size_t LineEnd(size_t line, size_t mem_size) const
+    {
+        return std::min(line + 1 < LineCount(mem_size) ? LineStart(line + 1) : mem_size, mem_size);
+    }
+
+    size_t LineOf(size_t addr) const
+    {
+        if (LineStarts.empty())
+            return addr / MaxCols;
+        return static_cast<size_t>(std::upper_bound(LineStarts.begin(), LineStarts.end(), addr) - LineStarts.begin()) - 1;
+    }
+
+    // Writes the disassembly for the row at [addr, end) in to buf. Returns the length of the label prefix (0 if none)
+    size_t FormatRow(char* buf, size_t buf_size, const ImU8* mem_data, size_t addr, size_t end, size_t base_display_addr) const
+    {
+        const size_t cpu_addr = base_display_addr + addr;
+        const bool have_analysis = Analysis != nullptr && Analysis->generation != 0 && cpu_addr <= 0xFFFF;
+
+        size_t label_len = 0;
+        if (have_analysis)
+        {
+            label_len = Analysis->formatLabel(static_cast<uint16_t>(cpu_addr), buf, buf_size);
+            if (label_len != 0 && label_len + 2 < buf_size)
+            {
+                buf[label_len++] = ':';
+                buf[label_len++] = ' ';
+                buf[label_len] = 0;
+            }
+        }
+        char* out = buf + label_len;
+        const size_t out_size = buf_size - label_len;
+
+        if (HaveAnalysis() && !IsInstructionStart(addr, base_display_addr))
+        {
+            int n = snprintf(out, out_size, ".db");
+            for (size_t i = addr; i < end && n > 0 && static_cast<size_t>(n) < out_size; i++)
+                n += snprintf(out + n, out_size - static_cast<size_t>(n), (i == addr ? " $%02X" : ",$%02X"), mem_data[i]);
+            return label_len;
+        }
+
+        const instruction instr = instructions[mem_data[addr]];
+        uint16_t operand = 0;
+        for (size_t i = instr.bytes - 1u; i > 0; i--)
+        {
+            operand = static_cast<uint16_t>(operand << 8u);
+            if (addr + i < end)
+                operand |= mem_data[addr + i];
+        }
+
+        // Show jump targets by label where we have one
+        bool has_target = false;
+        uint16_t target = operand;
+        if (is_branch(instr.code))
+        {
+            has_target = true;
+            target = static_cast<uint16_t>(cpu_addr + 2 + static_cast<size_t>(static_cast<int8_t>(operand)));
+        }
+        else if ((instr.code == operation::JMP || instr.code == operation::JSR) && instr.mode == addressing_mode::ABS)
+        {
+            has_target = true;
+        }
+
+        char target_label[32];
+        if (has_target && have_analysis && Analysis->formatLabel(target, target_label, sizeof(target_label)) != 0)
+        {
+            const auto name = magic_enum::enum_name(instr.code);
+            snprintf(out, out_size, "%.*s %s", static_cast<int>(name.size()), name.data(), target_label);
+        }
+        else if (has_target)
+        {
+            const auto name = magic_enum::enum_name(instr.code);
+            snprintf(out, out_size, "%.*s $%04X", static_cast<int>(name.size()), name.data(), target);
+        }
+        else
+        {
+            if (out_size > max_disassembly_length)
+                out[disassemble_instruction(out, instr, operand)] = 0;
+        }
+        return label_len;
+    }
+
+    // Target of the control flow instruction on the row starting at addr, if it has one
+    bool GetRowTarget(const ImU8* mem_data, size_t addr, size_t end, size_t base_display_addr, size_t& target_out) const
+    {
+        const instruction instr = instructions[mem_data[addr]];
+        if (addr + instr.bytes > end)
+            return false;
+        const size_t cpu_addr = base_display_addr + addr;
+        if (is_branch(instr.code))
+            target_out = static_cast<uint16_t>(cpu_addr + 2 + static_cast<size_t>(static_cast<int8_t>(mem_data[addr + 1])));
+        else if ((instr.code == operation::JMP || instr.code == operation::JSR) && instr.mode == addressing_mode::ABS)
+            target_out = static_cast<uint16_t>(mem_data[addr + 1] | (mem_data[addr + 2] << 8u));
+        else
+            return false;
+        return true;
+    }
+
     void CalcSizes(Sizes& s, size_t mem_size, size_t base_display_addr) const
     {
         ImGuiStyle& style = ImGui::GetStyle();
@@ -77,7 +268,8 @@ struct disassembly_view
         ImGui::SetNextWindowSizeConstraints(ImVec2(0.0f, 0.0f), ImVec2(s.WindowWidth, FLT_MAX));
 
         Open = true;
-        if (ImGui::Begin(title, &Open, ImGuiWindowFlags_NoScrollbar))
+        Visible = ImGui::Begin(title, &Open, ImGuiWindowFlags_NoScrollbar);
+        if (Visible)
         {
             if (ImGui::IsWindowHovered(ImGuiHoveredFlags_RootAndChildWindows) && ImGui::IsMouseClicked(1))
                 ImGui::OpenPopup("context");
@@ -98,6 +290,7 @@ struct disassembly_view
             MaxCols = 1;
 
         ImU8* mem_data = mem_data_void;
+        UpdateLines(mem_data, mem_size, base_display_addr);
         Sizes s;
         CalcSizes(s, mem_size, base_display_addr);
         ImGuiStyle& style = ImGui::GetStyle();
@@ -114,10 +307,10 @@ struct disassembly_view
         ImGui::PushStyleVar(ImGuiStyleVar_FramePadding, ImVec2(0, 0));
         ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
 
-        const size_t line_total_count = (mem_size + MaxCols - 1) / MaxCols;
+        const size_t line_total_count = LineCount(mem_size);
         ImGuiListClipper clipper(static_cast<int>(line_total_count), s.LineHeight);
-        const size_t visible_start_addr = static_cast<size_t>(clipper.DisplayStart) * MaxCols;
-        const size_t visible_end_addr = static_cast<size_t>( clipper.DisplayEnd) * MaxCols;
+        const size_t visible_start_line = static_cast<size_t>(clipper.DisplayStart);
+        const size_t visible_end_line = static_cast<size_t>(clipper.DisplayEnd);
 
         bool data_next = false;
 
@@ -129,27 +322,58 @@ struct disassembly_view
         if (DataEditingAddr != std::numeric_limits<std::size_t>::max())
         {
             // Move cursor but only apply on next frame so scrolling with be synchronized (because currently we can't change the scrolling while the window is being rendered)
-            if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_UpArrow)) && DataEditingAddr >= static_cast<size_t>(MaxCols))         { data_editing_addr_next = DataEditingAddr - MaxCols; DataEditingTakeFocus = true; }
-            else if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_DownArrow)) && DataEditingAddr < mem_size - MaxCols) { data_editing_addr_next = DataEditingAddr + MaxCols; DataEditingTakeFocus = true; }
+            // Up and down keep the same column where the row is long enough
+            const size_t line = LineOf(DataEditingAddr);
+            const size_t col = DataEditingAddr - LineStart(line);
+            if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_UpArrow)) && line > 0)                                { data_editing_addr_next = std::min(LineStart(line - 1) + col, LineEnd(line - 1, mem_size) - 1); DataEditingTakeFocus = true; }
+            else if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_DownArrow)) && line + 1 < line_total_count)       { data_editing_addr_next = std::min(LineStart(line + 1) + col, LineEnd(line + 1, mem_size) - 1); DataEditingTakeFocus = true; }
             else if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_LeftArrow)) && DataEditingAddr > 0)               { data_editing_addr_next = DataEditingAddr - 1; DataEditingTakeFocus = true; }
             else if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_RightArrow)) && DataEditingAddr < mem_size - 1)   { data_editing_addr_next = DataEditingAddr + 1; DataEditingTakeFocus = true; }
         }
-        if (data_editing_addr_next != std::numeric_limits<std::size_t>::max() && (data_editing_addr_next / MaxCols) != (data_editing_addr_backup / MaxCols))
+        if (data_editing_addr_next != std::numeric_limits<std::size_t>::max() && LineOf(data_editing_addr_next) != LineOf(data_editing_addr_backup))
         {
             // Track cursor movements
-            const int scroll_offset = (static_cast<int>(data_editing_addr_next / MaxCols) - static_cast<int>(data_editing_addr_backup / MaxCols));
-            const bool scroll_desired = (scroll_offset < 0 && data_editing_addr_next < visible_start_addr + MaxCols * 2) || (scroll_offset > 0 && data_editing_addr_next > visible_end_addr - MaxCols * 2);
+            const size_t next_line = LineOf(data_editing_addr_next);
+            const int scroll_offset = (static_cast<int>(next_line) - static_cast<int>(LineOf(data_editing_addr_backup)));
+            const bool scroll_desired = (scroll_offset < 0 && next_line < visible_start_line + 2) || (scroll_offset > 0 && next_line + 2 > visible_end_line);
             if (scroll_desired)
                 ImGui::SetScrollY(ImGui::GetScrollY() + static_cast<float>(scroll_offset) * s.LineHeight);
         }
 
         for (int line_i = clipper.DisplayStart; line_i < clipper.DisplayEnd; line_i++) // display only visible lines
         {
-            size_t addr = static_cast<size_t>(line_i) * MaxCols;
+            const size_t line_start = LineStart(static_cast<size_t>(line_i));
+            const size_t line_end = LineEnd(static_cast<size_t>(line_i), mem_size);
+            size_t addr = line_start;
+            if (CycleCounts != nullptr && CycleCountMax != 0)
+            {
+                uint64_t count = 0;
+                for (size_t i = line_start; i < line_end && base_display_addr + i <= 0xFFFF; i++)
+                    count += CycleCounts[base_display_addr + i];
+                if (count != 0)
+                {
+                    // Log scale, or everything but the main loop looks cold
+                    const double heat = std::log1p(static_cast<double>(count)) / std::log1p(static_cast<double>(CycleCountMax));
+                    const auto alpha = static_cast<ImU32>(static_cast<double>((HeatColor >> IM_COL32_A_SHIFT) & 0xFFu) * std::min(heat, 1.0));
+                    const ImVec2 row_pos = ImGui::GetCursorScreenPos();
+                    draw_list->AddRectFilled(row_pos, ImVec2(row_pos.x + s.PosDisasmEnd, row_pos.y + s.LineHeight), (HeatColor & ~IM_COL32_A_MASK) | (alpha << IM_COL32_A_SHIFT));
+                }
+            }
+            if (CurrentAddr >= base_display_addr + line_start && CurrentAddr < base_display_addr + line_end)
+            {
+                const ImVec2 row_pos = ImGui::GetCursorScreenPos();
+                draw_list->AddRectFilled(row_pos, ImVec2(row_pos.x + s.PosDisasmEnd, row_pos.y + s.LineHeight), CurrentColor);
+            }
             ImGui::Text((OptUpperCaseHex ? "%0*zX: " : "%0*zx: "), s.AddrDigitsCount, base_display_addr + addr);
 
+            // Clicking the address toggles a breakpoint
+            if (BreakpointFn != nullptr && BreakpointFn(base_display_addr + addr))
+                draw_list->AddRectFilled(ImGui::GetItemRectMin(), ImGui::GetItemRectMax(), BreakpointColor);
+            if (ToggleBreakpointFn != nullptr && ImGui::IsItemClicked())
+                ToggleBreakpointFn(base_display_addr + addr);
+
             // Draw Hexadecimal
-            for (size_t n = 0u; n < static_cast<size_t>(MaxCols) && addr < mem_size; n++, addr++)
+            for (size_t n = 0u; n < static_cast<size_t>(MaxCols) && addr < line_end; n++, addr++)
             {
                 float byte_pos_x = s.PosHexStart + s.HexCellWidth * static_cast<float>(n);
                 ImGui::SameLine(byte_pos_x);
@@ -160,14 +384,13 @@ struct disassembly_view
                 {
                     ImVec2 pos = ImGui::GetCursorScreenPos();
                     float highlight_width = s.GlyphWidth * 2;
-                    bool is_next_byte_highlighted =  (addr + 1 < mem_size) && ((HighlightMax != std::numeric_limits<std::size_t>::max() && addr + 1 < HighlightMax));
+                    bool is_next_byte_highlighted =  (addr + 1 < line_end) && ((HighlightMax != std::numeric_limits<std::size_t>::max() && addr + 1 < HighlightMax));
                     if (is_next_byte_highlighted || (n + 1 == MaxCols))
                     {
                         highlight_width = s.HexCellWidth;
                     }
                     draw_list->AddRectFilled(pos, ImVec2(pos.x + highlight_width, pos.y + s.LineHeight), HighlightColor);
                 }
-
                 if (DataEditingAddr == addr)
                 {
                     // Display text input on current byte
@@ -218,6 +441,9 @@ struct disassembly_view
                     unsigned int data_input_value = 0;
                     if (data_write && sscanf(DataInputBuf, "%X", &data_input_value) == 1)
                     {
+                        if (WriteFn)
+                            WriteFn(mem_data, addr, static_cast<ImU8>(data_input_value));
+                        else
                             mem_data[addr] = static_cast<ImU8>(data_input_value);
                     }
                     ImGui::PopID();
@@ -246,10 +472,20 @@ struct disassembly_view
             ImGui::SameLine(s.PosDisasmStart);
             auto pos = ImGui::GetCursorScreenPos();
             ImGui::PushID(line_i);
-            ImGui::InvisibleButton("disasm", ImVec2(s.PosDisasmEnd - s.PosDisasmStart, s.LineHeight));
+            // Clicking on a jump or branch follows it
+            size_t target = 0;
+            if (ImGui::InvisibleButton("disasm", ImVec2(s.PosDisasmEnd - s.PosDisasmStart, s.LineHeight))
+                && GetRowTarget(mem_data, line_start, line_end, base_display_addr, target)
+                && target >= base_display_addr && target < base_display_addr + mem_size)
+            {
+                GotoAddrAndHighlight(target - base_display_addr, LineEnd(LineOf(target - base_display_addr), mem_size));
+            }
             ImGui::PopID();
-            const char teststr [] = "Hello";
-            ImGui::GetWindowDrawList()->AddText(pos, ImGui::GetColorU32(ImGuiCol_Text), teststr, teststr+sizeof(teststr)-1);
+
+            char disasm_buf[64];
+            const size_t label_len = FormatRow(disasm_buf, sizeof(disasm_buf), mem_data, line_start, line_end, base_display_addr);
+            draw_list->AddText(pos, LabelColor, disasm_buf, disasm_buf + label_len);
+            draw_list->AddText(ImVec2(pos.x + ImGui::CalcTextSize(disasm_buf, disasm_buf + label_len).x, pos.y), ImGui::GetColorU32(ImGuiCol_Text), disasm_buf + label_len);
         }
         clipper.End();
         ImGui::PopStyleVar(2);
@@ -314,7 +550,7 @@ struct disassembly_view
             if (GotoAddr < mem_size)
             {
                 ImGui::BeginChild("##scrolling");
-                ImGui::SetScrollFromPosY(ImGui::GetCursorStartPos().y + static_cast<float>(GotoAddr / MaxCols) * ImGui::GetTextLineHeight()); // NOLINT(bugprone-integer-division)
+                ImGui::SetScrollFromPosY(ImGui::GetCursorStartPos().y + static_cast<float>(LineOf(GotoAddr)) * ImGui::GetTextLineHeight());
                 ImGui::EndChild();
                 DataEditingAddr = GotoAddr;
                 DataEditingTakeFocus = true;
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "allocation_guard.h"
+#include "emulation_thread.h"
+#include "timeline.h"
+
+EmulationThread::EmulationThread(std::shared_ptr<Ines> r) : rom(std::move(r)), console(rom), thread(&EmulationThread::run, this) {
+}
+
+EmulationThread::~EmulationThread() {
+    {
+        std::lock_guard lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    thread.join();
+    if (lag_worker.joinable()) {
+        lag_worker.join();
+    }
+}
+
+void EmulationThread::post(std::function<void(Console &)> f) {
+    {
+        std::lock_guard lock(mutex);
+        pending.push_back(std::move(f));
+    }
+    wake.notify_one();
+}
+
+void EmulationThread::setRunning(bool run) {
+    post([this, run](Console &) {
+        running = run;
+        at_breakpoint = false;
+    });
+}
+
+void EmulationThread::step() {
+    post([this](Console &c) {
+        running = false;
+        at_breakpoint = c.step() == Console::stop_reason::BREAKPOINT;
+    });
+}
+
+void EmulationThread::writePrgRom(size_t offset, uint8_t value) {
+    post([this, offset, value](Console &) {
+        auto &prg = rom->getPrgRom();
+        if (offset < prg.size()) {
+            prg[offset] = value;
+        }
+    });
+}
+
+void EmulationThread::enableRewind(size_t budget_bytes) {
+    post([this, budget_bytes](Console &) {
+        rewinder.reset();
+        if (budget_bytes != 0) {
+            rewinder = std::make_unique<Rewind>(budget_bytes);
+        }
+    });
+}
+
+void EmulationThread::setRewinding(bool held) {
+    post([this, held](Console &) { rewinding = held; });
+}
+
+void EmulationThread::setRunAhead(unsigned frames, RunAhead::mode m) {
+    post([this, frames, m](Console &) {
+        run_ahead.reset();
+        if (frames != 0) {
+            run_ahead = std::make_unique<RunAhead>(rom, frames, m);
+        }
+    });
+}
+
+void EmulationThread::measureInputLag() {
+    post([this](Console &c) {
+        if (measuring_lag) {
+            return;
+        }
+        // Hundreds of hidden frames, so they run on their own thread, from a copy of the machine as it is now. The
+        // ROM is copied too, as writePrgRom may change it meanwhile
+        auto state = std::make_unique<machine_state>();
+        c.saveState(*state);
+        auto rom_copy = std::make_shared<const Ines>(*rom);
+        if (lag_worker.joinable()) {
+            lag_worker.join();
+        }
+        input_lag = -1;
+        measuring_lag = true;
+        lag_worker = std::thread([this, state = std::move(state), rom_copy = std::move(rom_copy)] {
+            timeline_set_thread_name("input lag");
+            // The quickest response to any one button
+            int lag = -1;
+            for (unsigned b = 0; b < 8; b++) {
+                const int l = RunAhead::measureInputLag(rom_copy, *state, static_cast<uint8_t>(1u << b));
+                if (l > 0 && (lag < 0 || l < lag)) {
+                    lag = l;
+                }
+            }
+            post([this, lag](Console &) {
+                input_lag = lag;
+                measuring_lag = false;
+            });
+        });
+    });
+}
+
+void EmulationThread::recordMovie(const std::filesystem::path &p, bool append) {
+    post([this, p, append](Console &c) {
+        player.reset();
+        recorder.reset();
+        try {
+            recorder = append ? MovieRecorder::append(p, c) : std::make_unique<MovieRecorder>(p, c);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+        }
+    });
+}
+
+void EmulationThread::playMovie(const std::filesystem::path &p) {
+    post([this, p](Console &c) {
+        recorder.reset();
+        player.reset();
+        try {
+            player = std::make_unique<MoviePlayer>(p);
+            player->seek(c, 0);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            player.reset();
+        }
+    });
+}
+
+void EmulationThread::seekMovie(uint64_t frame) {
+    post([this, frame](Console &c) {
+        if (player) {
+            player->seek(c, std::min(frame, player->frames()));
+        }
+    });
+}
+
+void EmulationThread::stopMovie() {
+    post([this](Console &) {
+        recorder.reset();
+        player.reset();
+    });
+}
+
+const machine_snapshot &EmulationThread::latest() {
+    snapshots.update();
+    return snapshots.front();
+}
+
+void EmulationThread::run() {
+    timeline_set_thread_name("emulation");
+    std::vector<std::function<void(Console &)>> commands;
+    auto deadline = std::chrono::steady_clock::now();
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            // While paused, commands are run as soon as they arrive
+            wake.wait_until(lock, deadline, [this] { return quit || (!running && !pending.empty()); });
+            if (quit) {
+                return;
+            }
+            commands.swap(pending);
+        }
+        if (!commands.empty()) {
+            // Commands can attach tools or load state, so the frames after them have to warm up again
+            warm_frames = 0;
+            arm_allocation_guard(false);
+            IMNES_ZONE("commands");
+            for (auto &c : commands) {
+                c(console);
+            }
+            commands.clear();
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            IMNES_ZONE("frame");
+            if (rewinding && rewinder && !recorder && !player) {
+                rewinder->rewind(console);
+            } else if (running) {
+                std::array<uint8_t, 2> pad{};
+                for (size_t i = 0; i < buttons.size(); i++) {
+                    pad[i] = buttons[i].load(std::memory_order_relaxed);
+                }
+                if (recorder) {
+                    try {
+                        recorder->runFrame(pad);
+                    } catch (const std::exception &e) {
+                        std::cerr << e.what() << std::endl;
+                        recorder.reset();
+                    }
+                } else if (player && !player->finished()) {
+                    player->runFrame(console);
+                } else {
+                    IMNES_ALLOCATION_FREE("emulation frame");
+                    console.bus.buttons = pad;
+                    at_breakpoint = console.runFrame() == Console::stop_reason::BREAKPOINT;
+                    running = !at_breakpoint;
+                }
+                if (auto *h = console.accessHeatmap()) {
+                    h->decay();
+                }
+                if (rewinder) {
+                    IMNES_ALLOCATION_FREE("rewind capture");
+                    rewinder->capture(console);
+                }
+                if (run_ahead && running) {
+                    IMNES_ZONE("run ahead");
+                    IMNES_ALLOCATION_FREE("run ahead");
+                    run_ahead->update(console);
+                }
+                if (++warm_frames == warm_up_frames) {
+                    arm_allocation_guard(true);
+                }
+            }
+            frame_time = std::chrono::steady_clock::now() - now;
+            // Don't try to catch up after a stall, or after being paused
+            deadline = std::max(deadline + frame_period, now);
+        }
+
+        if (snapshots_wanted.load(std::memory_order_relaxed)) {
+            capture();
+        }
+    }
+}
+
+void EmulationThread::capture() {
+    IMNES_ZONE("snapshot");
+    machine_snapshot &s = snapshots.back();
+    s.sequence = ++sequence;
+    s.running = running;
+    s.at_breakpoint = at_breakpoint;
+    s.last_break = console.lastBreak();
+    // Sharing CHR RAM would make the console copy a page the next time it wrote to it, part way through a frame
+    s.ppu.copyUnshared(console.ppu);
+    // Paused or rewinding, the future isn't being shown, so debug the real machine
+    if (run_ahead && running && !rewinding) {
+        const machine_state &ahead = run_ahead->ahead();
+        s.cpu = ahead.cpu;
+        static_cast<ppu_state &>(s.ppu) = ahead.ppu;
+        s.ppu.chr_ram.copyFrom(ahead.chr_ram);
+        s.cycles = ahead.cycles;
+        s.ram = ahead.ram;
+        s.prg_ram = ahead.prg_ram;
+    } else {
+        s.cpu = console.cpu;
+        s.cycles = console.cycles;
+        console.bus.ram.copyTo(s.ram);
+        console.bus.prg_ram.copyTo(s.prg_ram);
+    }
+
+    // assign() and clear() keep the capacity, so once warmed up this doesn't allocate
+    if (auto *p = console.profiler()) {
+        p->updateInclusive();
+        s.cycles_at.assign(p->cyclesAt().begin(), p->cyclesAt().end());
+        s.cycles_at_max = p->maxCyclesAt();
+        s.call_tree.assign(p->callTree().begin(), p->callTree().end());
+    } else {
+        s.cycles_at.clear();
+        s.cycles_at_max = 0;
+        s.call_tree.clear();
+    }
+
+    if (auto *l = console.codeDataLog()) {
+        s.cdl_prg.assign(l->prgFlags().begin(), l->prgFlags().end());
+    } else {
+        s.cdl_prg.clear();
+    }
+
+    if (auto *h = console.accessHeatmap()) {
+        const size_t n = console.bus.ram.size();
+        s.heat_reads.assign(h->reads.begin(), h->reads.begin() + n);
+        s.heat_writes.assign(h->writes.begin(), h->writes.begin() + n);
+        s.heat_executes.assign(h->executes.begin(), h->executes.begin() + n);
+        s.write_heat.assign(h->write_heat.begin(), h->write_heat.begin() + n);
+    } else {
+        s.heat_reads.clear();
+        s.heat_writes.clear();
+        s.heat_executes.clear();
+        s.write_heat.clear();
+    }
+
+    s.rewind_enabled = rewinder != nullptr;
+    s.rewind = rewinder ? rewinder->getStats() : Rewind::stats{};
+    s.run_ahead_frames = run_ahead ? run_ahead->frames() : 0;
+    s.run_ahead_cost = run_ahead ? run_ahead->cost() : std::chrono::nanoseconds{};
+    s.input_lag = input_lag;
+    s.recording_movie = recorder != nullptr;
+    s.playing_movie = player != nullptr;
+    s.movie_position = recorder ? recorder->frames() : player ? player->position() : 0;
+    s.movie_frames = recorder ? recorder->frames() : player ? player->frames() : 0;
+    s.movie_desync = player ? player->firstDesync() : s.movie_frames;
+    s.counters = console.perfCounters() ? *console.perfCounters() : perf_counters{};
+    s.times = console.componentTimes() ? *console.componentTimes() : component_times{};
+    s.frame_time = frame_time;
+
+    s.conditions.clear();
+    for (const auto &[key, entry] : console.conditions()) {
+        s.conditions.push_back({static_cast<uint16_t>(key & 0xFFFFu), entry.condition.text(), entry.hits, entry.passes, entry.eval_time});
+    }
+
+    snapshots.publish();
+}
@@ -0,0 +1,170 @@
+#ifndef IMNES_EMULATION_THREAD_H
+#define IMNES_EMULATION_THREAD_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "console.h"
+#include "movie.h"
+#include "rewind.h"
+#include "run_ahead.h"
+#include "triple_buffer.h"
+
+// Copy of the machine taken between frames, for debugger windows to read without touching the live console
+struct machine_snapshot
+{
+    uint64_t sequence = 0; // Counts up with each snapshot. 0 means there isn't one yet
+    bool running = false;
+    bool at_breakpoint = false;
+    Console::break_info last_break;
+
+    Cpu6502 cpu{};
+    Ppu ppu;
+    uint64_t cycles = 0;
+    std::array<uint8_t, 0x800> ram{};
+    std::array<uint8_t, 0x2000> prg_ram{};
+
+    // Debugging tools. Each is empty unless the tool is attached to the console
+    std::vector<uint64_t> cycles_at; // Profiler::cyclesAt
+    uint64_t cycles_at_max = 0;
+    std::vector<Profiler::node> call_tree; // With inclusive counts filled in
+    std::vector<uint8_t> cdl_prg;
+    // Access heatmap for RAM only ($0000-$07FF)
+    std::vector<uint32_t> heat_reads;
+    std::vector<uint32_t> heat_writes;
+    std::vector<uint32_t> heat_executes;
+    std::vector<uint8_t> write_heat;
+
+    struct condition_stats
+    {
+        uint16_t addr;
+        std::string text;
+        uint64_t hits;
+        uint64_t passes;
+        std::chrono::nanoseconds eval_time;
+    };
+    std::vector<condition_stats> conditions;
+
+    bool rewind_enabled = false;
+    Rewind::stats rewind;
+
+    // When running ahead, the machine above is the one being shown, not the real one
+    unsigned run_ahead_frames = 0;
+    std::chrono::nanoseconds run_ahead_cost{};
+    int input_lag = -1; // From the last measureInputLag, -1 if unknown
+
+    bool recording_movie = false;
+    bool playing_movie = false;
+    uint64_t movie_position = 0;
+    uint64_t movie_frames = 0;
+    uint64_t movie_desync = 0; // First frame that didn't match the recording. Equal to movie_frames if none
+
+    // Zero unless attached to the console
+    perf_counters counters;
+    component_times times;
+    // Wall time the emulation thread took over the last frame, including any tools
+    std::chrono::nanoseconds frame_time{};
+};
+
+// Runs a console on its own thread at the NTSC frame rate
+// Nothing else may touch the console. Other threads queue work with post(), which runs between frames,
+// and read the machine through snapshots, which are published between frames while wanted
+class EmulationThread {
+public:
+    // NTSC runs at 60.0988 frames a second
+    static constexpr std::chrono::nanoseconds frame_period{16639267};
+
+    // N.B. constructor may throw runtime_error, as Console's does
+    explicit EmulationThread(std::shared_ptr<Ines> rom);
+    ~EmulationThread();
+    EmulationThread(const EmulationThread &) = delete;
+    EmulationThread &operator=(const EmulationThread &) = delete;
+
+    // Runs f on the emulation thread at the next frame boundary, in the order posted
+    // The console isn't running while f is, so it is free to change anything
+    void post(std::function<void(Console &)> f);
+
+    void setRunning(bool run);
+    // Pauses, then executes one instruction
+    void step();
+    void writePrgRom(size_t offset, uint8_t value);
+
+    // Keep budget_bytes of history to rewind through, or turn rewinding off if 0
+    void enableRewind(size_t budget_bytes);
+    // While held, each frame goes back one instead of forward
+    void setRewinding(bool held);
+
+    // Show the machine frames ahead of where it really is, or stop if 0
+    void setRunAhead(unsigned frames, RunAhead::mode m);
+    // Find how many frames the game takes to show a button press, from where it is now
+    // Measured on a thread of its own, so emulation carries on meanwhile. The snapshots' input_lag is -1 until it is done
+    void measureInputLag();
+
+    // Record every frame from here on in to a movie, carrying on from the end of the one in p if append
+    // While a movie records or plays, frames run through breakpoints and rewinding is ignored
+    void recordMovie(const std::filesystem::path &p, bool append);
+    // Play the movie in p from its start. Once it ends, the controllers take over again
+    void playMovie(const std::filesystem::path &p);
+    // Go to a frame of the movie being played
+    void seekMovie(uint64_t frame);
+    void stopMovie();
+
+    // Controller buttons, see Bus::buttons. Picked up at the start of each frame
+    void setButtons(size_t port, uint8_t value) { buttons[port].store(value, std::memory_order_relaxed); }
+
+    // Snapshots cost a copy of the machine each frame, so are only taken while someone is looking
+    void setSnapshotsWanted(bool wanted) { snapshots_wanted.store(wanted, std::memory_order_relaxed); }
+
+    // Reader side, one thread only. The snapshot and anything pointing in to it stays valid until the next call
+    // The PPU in the snapshot still points at the live CHR ROM, which never changes
+    const machine_snapshot &latest();
+
+private:
+    void run();
+    void capture();
+
+    std::shared_ptr<Ines> rom;
+    Console console;
+
+    // Only touched by the emulation thread
+    bool running = true;
+    bool at_breakpoint = false;
+    uint64_t sequence = 0;
+    std::unique_ptr<Rewind> rewinder;
+    bool rewinding = false;
+    std::unique_ptr<RunAhead> run_ahead;
+    int input_lag = -1;
+    bool measuring_lag = false;
+    std::thread lag_worker; // Measures input lag. Only started and joined by the emulation thread, or the destructor
+    std::unique_ptr<MovieRecorder> recorder;
+    std::unique_ptr<MoviePlayer> player;
+    std::chrono::nanoseconds frame_time{};
+    // Frames run since the last command. The allocation guard is armed once this reaches warm_up_frames
+    static constexpr unsigned warm_up_frames = 120;
+    unsigned warm_frames = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<std::function<void(Console &)>> pending;
+    bool quit = false;
+
+    std::atomic<bool> snapshots_wanted{false};
+    std::array<std::atomic<uint8_t>, 2> buttons{};
+    triple_buffer<machine_snapshot> snapshots;
+
+    // Last so that everything else exists before the thread starts
+    std::thread thread;
+};
+
+
+#endif //IMNES_EMULATION_THREAD_H
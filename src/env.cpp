@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#include "console.h"
+#include "env.h"
+#include "work_stealing_pool.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMNES_HAVE_SHARED_MEMORY
+#endif
+
+namespace imnes {
+
+Env::Env(std::shared_ptr<const Ines> rom, size_t batch, const options &o)
+        : opt(o), power_on(std::make_unique<Console>(std::move(rom))), consoles(batch) {
+    const unsigned threads = opt.threads != 0 ? opt.threads : std::max(1u, std::thread::hardware_concurrency());
+    if (threads > 1 && batch > 1) {
+        pool = std::make_unique<WorkStealingPool>(threads, opt.pin);
+    }
+    resetAll();
+}
+
+Env::~Env() = default;
+
+void Env::setObservations(std::span<uint8_t> f, std::span<uint8_t> r) {
+    if ((!f.empty() && f.size() < size() * frame_bytes) || (!r.empty() && r.size() < size() * ram_bytes)) {
+        throw std::runtime_error("Observation buffer is too small for the batch");
+    }
+    frames = f;
+    ram = r;
+    for (size_t i = 0; i < size(); i++) {
+        observe(i);
+    }
+}
+
+void Env::step(std::span<const uint8_t> actions) {
+    if (actions.size() != size()) {
+        throw std::runtime_error("Need one action per instance");
+    }
+    if (pool) {
+        pool->forEach(size(), [&](size_t i, unsigned) { run(i, actions[i]); });
+    } else {
+        for (size_t i = 0; i < size(); i++) {
+            run(i, actions[i]);
+        }
+    }
+}
+
+void Env::reset(size_t instance) {
+    // Forks share the power on console's memory, so this is cheap and the batch costs little more than one console
+    consoles[instance] = power_on->fork();
+    observe(instance);
+}
+
+void Env::resetAll() {
+    for (size_t i = 0; i < size(); i++) {
+        reset(i);
+    }
+}
+
+void Env::run(size_t instance, uint8_t buttons) {
+    Console &c = *consoles[instance];
+    c.bus.buttons[0] = buttons;
+    for (unsigned i = 0; i < opt.frame_skip; i++) {
+        const uint64_t frame = c.ppu.frame;
+        while (c.ppu.frame == frame) {
+            c.runFrame();
+        }
+    }
+    observe(instance);
+}
+
+void Env::observe(size_t instance) {
+    const Console &c = *consoles[instance];
+    if (!frames.empty() && opt.render) {
+        render_frame(c.ppu, frames.subspan(instance * frame_bytes, frame_bytes));
+    }
+    if (!ram.empty()) {
+        c.bus.ram.copyTo(ram.subspan(instance * ram_bytes, ram_bytes));
+    }
+}
+
+#ifdef IMNES_HAVE_SHARED_MEMORY
+
+SharedMemory::SharedMemory(const std::string &name_, size_t size, bool create) : name(name_), length(size), owner(create) {
+    if (create) {
+        shm_unlink(name.c_str());
+    }
+    const int fd = shm_open(name.c_str(), create ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open shared memory " + name);
+    }
+    struct stat st{};
+    const bool sized = create ? ftruncate(fd, static_cast<off_t>(size)) == 0
+                              : fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size;
+    void *p = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) {
+        if (create) {
+            shm_unlink(name.c_str());
+        }
+        throw std::runtime_error("Could not map shared memory " + name);
+    }
+    data = static_cast<uint8_t *>(p);
+}
+
+SharedMemory::~SharedMemory() {
+    munmap(data, length);
+    if (owner) {
+        shm_unlink(name.c_str());
+    }
+}
+
+#else
+
+SharedMemory::SharedMemory(const std::string &name_, size_t, bool) : name(name_) {
+    throw std::runtime_error("Shared memory isn't supported on this platform");
+}
+
+SharedMemory::~SharedMemory() = default;
+
+#endif
+
+}
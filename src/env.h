@@ -0,0 +1,97 @@
+#ifndef IMNES_ENV_H
+#define IMNES_ENV_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ines.h"
+#include "ppu_render.h"
+
+class Console;
+class WorkStealingPool;
+
+namespace imnes {
+
+// A batch of consoles running one ROM, stepped together, for reinforcement learning
+// Observations are written straight in to memory the caller provides, which can be SharedMemory so that another
+// process (a trainer, say) reads them without a copy. Consoles start from one power on console and are forks of it
+class Env {
+public:
+    static constexpr size_t frame_bytes = frame_pixels;
+    static constexpr size_t ram_bytes = 0x800;
+
+    struct options
+    {
+        unsigned frame_skip = 4;   // Frames each step() runs, with the same buttons held
+        bool render = true;        // Draw the last frame of each step in to the frame buffer
+        unsigned threads = 0;      // 0 for one per core. With one thread steps run on the caller's thread
+        bool pin = false;
+    };
+
+    // N.B. throws runtime_error if the ROM's mapper isn't supported
+    Env(std::shared_ptr<const Ines> rom, size_t batch, const options &opt);
+    ~Env();
+    Env(const Env &) = delete;
+    Env &operator=(const Env &) = delete;
+
+    // Where each instance's observation goes: the frame (colour index per pixel, see render_frame) at
+    // frames[i * frame_bytes] and CPU RAM at ram[i * ram_bytes]. Either can be empty to leave it out
+    // The memory must outlive its use here
+    // N.B. throws runtime_error if a buffer is too small for the batch
+    void setObservations(std::span<uint8_t> frames, std::span<uint8_t> ram);
+
+    // Runs every instance for frame_skip frames, holding actions[i] (controller 1 buttons, see bus_state::buttons)
+    // Frames before the last aren't drawn. Returns once all the observations are written
+    // N.B. throws runtime_error if there isn't one action per instance
+    void step(std::span<const uint8_t> actions);
+
+    // Puts an instance back to power on, and writes its observation
+    void reset(size_t instance);
+    void resetAll();
+
+    size_t size() const { return consoles.size(); }
+    const options &getOptions() const { return opt; }
+    Console &console(size_t instance) { return *consoles[instance]; }
+
+private:
+    void run(size_t instance, uint8_t buttons);
+    void observe(size_t instance);
+
+    options opt;
+    std::unique_ptr<Console> power_on;
+    std::vector<std::unique_ptr<Console>> consoles;
+    std::unique_ptr<WorkStealingPool> pool;
+    std::span<uint8_t> frames;
+    std::span<uint8_t> ram;
+};
+
+// A named block of memory that other processes on the machine can map, for observation buffers
+// Uses POSIX shared memory, so another process opens it with shm_open(name) and mmap
+// The one that creates it removes the name again when it is destroyed
+// N.B. constructor throws runtime_error on failure, or where POSIX shared memory isn't available
+class SharedMemory {
+public:
+    // name is as for shm_open, e.g. "/imnes-frames". create makes it (replacing any old one) with size bytes,
+    // otherwise an existing one is opened and size must match it
+    SharedMemory(const std::string &name, size_t size, bool create);
+    ~SharedMemory();
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    std::span<uint8_t> bytes() const { return {data, length}; }
+
+private:
+    std::string name;
+    uint8_t *data = nullptr;
+    size_t length = 0;
+    bool owner = false;
+};
+
+}
+
+
+#endif //IMNES_ENV_H
@@ -0,0 +1,103 @@
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "console.h"
+#include "frame_hash.h"
+#include "hash.h"
+#include "ppu_render.h"
+
+FrameHasher::FrameHasher(unsigned parts) : what(parts), picture((parts & VIDEO) ? frame_pixels : 0) {
+}
+
+frame_hashes FrameHasher::hash(const Console &console) {
+    frame_hashes h;
+    h.frame = console.ppu.frame;
+    if (what & VIDEO) {
+        render_frame(console.ppu, picture);
+        h.video = hash64(picture);
+    }
+    if (what & RAM) {
+        // Page by page, so shared pages needn't be copied out first
+        const CowMemory &ram = console.bus.ram;
+        Hash64 ram_hash;
+        for (size_t i = 0; i < ram.pageCount(); i++) {
+            ram_hash.update(ram.page(i), CowMemory::page_size);
+        }
+        h.ram = ram_hash.digest();
+    }
+    if (what & STATE) {
+        console.saveState(state);
+        h.state = state_hash(state);
+    }
+    return h;
+}
+
+FrameHashLog::FrameHashLog(const std::filesystem::path &p, unsigned parts) : file(p, std::ios::binary), hasher(parts) {
+    if (!file) {
+        throw std::runtime_error("Could not create " + p.string());
+    }
+}
+
+void FrameHashLog::add(const Console &console) {
+    const frame_hashes h = hasher.hash(console);
+    if (count == 0) {
+        header hdr{};
+        std::memcpy(hdr.magic, magic, sizeof(hdr.magic));
+        hdr.version = version;
+        hdr.parts = hasher.parts();
+        hdr.first_frame = first_frame = h.frame;
+        file.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+    } else if (h.frame != first_frame + count) {
+        throw std::runtime_error("Hash log needs every frame, but was given frame " + std::to_string(h.frame) + " after " +
+                                 std::to_string(first_frame + count - 1));
+    }
+    std::array<uint64_t, 3> record{};
+    size_t n = 0;
+    if (hasher.parts() & FrameHasher::VIDEO) {
+        record[n++] = h.video;
+    }
+    if (hasher.parts() & FrameHasher::RAM) {
+        record[n++] = h.ram;
+    }
+    if (hasher.parts() & FrameHasher::STATE) {
+        record[n++] = h.state;
+    }
+    file.write(reinterpret_cast<const char *>(record.data()), static_cast<std::streamsize>(n * sizeof(uint64_t)));
+    if (!file) {
+        throw std::runtime_error("Could not write hash log");
+    }
+    count++;
+}
+
+std::vector<frame_hashes> FrameHashLog::load(const std::filesystem::path &p, unsigned &parts) {
+    std::ifstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    header hdr{};
+    file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+    if (!file || std::memcmp(hdr.magic, magic, sizeof(hdr.magic)) != 0) {
+        throw std::runtime_error(p.string() + " isn't a hash log");
+    }
+    if (hdr.version != version) {
+        throw std::runtime_error(p.string() + " is from a different version of imnes");
+    }
+    parts = hdr.parts;
+    const auto per_frame = static_cast<size_t>(std::popcount(parts & (FrameHasher::VIDEO | FrameHasher::RAM | FrameHasher::STATE)));
+    std::vector<frame_hashes> frames;
+    std::vector<uint64_t> record(per_frame);
+    // A log cut short ends at its last whole record
+    while (per_frame != 0 && file.read(reinterpret_cast<char *>(record.data()), static_cast<std::streamsize>(per_frame * sizeof(uint64_t)))) {
+        frame_hashes h;
+        h.frame = hdr.first_frame + frames.size();
+        size_t i = 0;
+        h.video = (parts & FrameHasher::VIDEO) ? record[i++] : 0;
+        h.ram = (parts & FrameHasher::RAM) ? record[i++] : 0;
+        h.state = (parts & FrameHasher::STATE) ? record[i++] : 0;
+        frames.push_back(h);
+    }
+    return frames;
+}
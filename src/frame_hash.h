@@ -0,0 +1,83 @@
+#ifndef IMNES_FRAME_HASH_H
+#define IMNES_FRAME_HASH_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+#include <vector>
+
+#include "machine_state.h"
+
+class Console;
+
+struct frame_hashes
+{
+    uint64_t frame = 0;  // Ppu::frame it was taken at
+    uint64_t video = 0;  // The picture, as render_frame draws it
+    uint64_t ram = 0;    // CPU RAM
+    uint64_t state = 0;  // state_hash() of the whole machine. Save states have no padding, so this compares across runs
+};
+
+// Hashes of a console at the end of each frame, for comparing runs against each other or a golden log
+// Keeps its own frame buffer and save state to work in, so hashing doesn't allocate
+class FrameHasher {
+public:
+    enum part : unsigned
+    {
+        VIDEO = 1u << 0u,
+        RAM = 1u << 1u,
+        STATE = 1u << 2u,
+    };
+
+    explicit FrameHasher(unsigned parts = VIDEO | RAM);
+
+    // Parts that weren't asked for are 0
+    // N.B. STATE throws runtime_error for flat images, which have no save states
+    frame_hashes hash(const Console &console);
+
+    unsigned parts() const { return what; }
+
+private:
+    unsigned what;
+    std::vector<uint8_t> picture;
+    machine_state state{};
+};
+
+// Binary log of frame hashes: the header, then for each frame the hashes of the parts in it, 8 bytes each
+class FrameHashLog {
+public:
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t parts;       // FrameHasher::part
+        uint64_t first_frame; // Frame of the first record. The rest follow on one frame each
+        uint64_t reserved;
+    };
+    static_assert(sizeof(header) == 32 && std::is_trivially_copyable_v<header>);
+    static constexpr char magic[8] = {'I', 'M', 'N', 'H', 'A', 'S', 'H', 'S'};
+    // 2: state hashes no longer depend on padding, so version 1 logs with them can't be compared against new runs
+    static constexpr uint32_t version = 2;
+
+    // N.B. throws runtime_error if the file can't be created
+    FrameHashLog(const std::filesystem::path &p, unsigned parts);
+
+    // Hash the console, at the end of a frame, and append it. Call this for every frame from the first one added
+    // N.B. throws runtime_error on a write error, or if a frame was missed
+    void add(const Console &console);
+
+    uint64_t frames() const { return count; }
+
+    // N.B. throws runtime_error if the file can't be read or isn't a hash log
+    static std::vector<frame_hashes> load(const std::filesystem::path &p, unsigned &parts);
+
+private:
+    std::ofstream file;
+    FrameHasher hasher;
+    uint64_t first_frame = 0;
+    uint64_t count = 0;
+};
+
+
+#endif //IMNES_FRAME_HASH_H
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cstring>
+
+#include "hash.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md for the shape of it
+namespace {
+
+constexpr uint64_t prime32_1 = 0x9E3779B1u;
+constexpr uint64_t prime32_2 = 0x85EBCA77u;
+constexpr uint64_t prime32_3 = 0xC2B2AE3Du;
+constexpr uint64_t prime64_1 = 0x9E3779B185EBCA87u;
+constexpr uint64_t prime64_2 = 0xC2B2AE3D27D4EB4Fu;
+constexpr uint64_t prime64_3 = 0x165667B19E3779F9u;
+constexpr uint64_t prime64_4 = 0x85EBCA77C2B2AE63u;
+constexpr uint64_t prime64_5 = 0x27D4EB2F165667C5u;
+
+// Stripe n of a block is keyed with keys[n .. n + 7]. The scramble and final merge use the last eight
+constexpr size_t key_count = Hash64::stripes_per_block + 8;
+
+constexpr std::array<uint64_t, key_count> makeKeys() {
+    // splitmix64 https://prng.di.unimi.it/splitmix64.c
+    std::array<uint64_t, key_count> k{};
+    uint64_t x = prime64_5;
+    for (auto &v : k) {
+        x += 0x9E3779B97F4A7C15u;
+        uint64_t z = x;
+        z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9u;
+        z = (z ^ (z >> 27u)) * 0x94D049BB133111EBu;
+        v = z ^ (z >> 31u);
+    }
+    return k;
+}
+
+alignas(32) constexpr std::array<uint64_t, key_count> keys = makeKeys();
+
+#if !defined(__AVX2__) && !defined(__SSE2__)
+uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+#endif
+
+// acc[i] += lo32(d ^ key) * hi32(d ^ key), and acc[i ^ 1] += d, for each 64-bit lane of each stripe
+void accumulate(uint64_t *acc, const uint8_t *p, size_t stripes, size_t first_key) {
+#if defined(__AVX2__)
+    __m256i a0 = _mm256_load_si256(reinterpret_cast<const __m256i *>(acc));
+    __m256i a1 = _mm256_load_si256(reinterpret_cast<const __m256i *>(acc + 4));
+    for (size_t s = 0; s < stripes; s++, p += Hash64::stripe_size) {
+        const uint64_t *k = keys.data() + first_key + s;
+        const __m256i d0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        const __m256i d1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+        const __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k)));
+        const __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(k + 4)));
+        a0 = _mm256_add_epi64(a0, _mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1))));
+        a1 = _mm256_add_epi64(a1, _mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1))));
+        a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+    }
+    _mm256_store_si256(reinterpret_cast<__m256i *>(acc), a0);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(acc + 4), a1);
+#elif defined(__SSE2__)
+    __m128i a[4];
+    for (size_t i = 0; i < 4; i++) {
+        a[i] = _mm_load_si128(reinterpret_cast<const __m128i *>(acc + 2 * i));
+    }
+    for (size_t s = 0; s < stripes; s++, p += Hash64::stripe_size) {
+        const uint64_t *k = keys.data() + first_key + s;
+        for (size_t i = 0; i < 4; i++) {
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * i));
+            const __m128i m = _mm_xor_si128(d, _mm_loadu_si128(reinterpret_cast<const __m128i *>(k + 2 * i)));
+            a[i] = _mm_add_epi64(a[i], _mm_mul_epu32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(0, 3, 0, 1))));
+            a[i] = _mm_add_epi64(a[i], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+        }
+    }
+    for (size_t i = 0; i < 4; i++) {
+        _mm_store_si128(reinterpret_cast<__m128i *>(acc + 2 * i), a[i]);
+    }
+#else
+    for (size_t s = 0; s < stripes; s++, p += Hash64::stripe_size) {
+        for (size_t i = 0; i < 8; i++) {
+            const uint64_t d = load64(p + 8 * i);
+            const uint64_t m = d ^ keys[first_key + s + i];
+            acc[i] += (m & 0xFFFFFFFFu) * (m >> 32u);
+            acc[i ^ 1u] += d;
+        }
+    }
+#endif
+}
+
+// Stops the lanes' high bits from only ever collecting carries
+void scramble(uint64_t *acc) {
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47u;
+        a ^= keys[Hash64::stripes_per_block + i];
+        acc[i] = a * prime32_1;
+    }
+}
+
+// Low 64 bits xor high 64 bits of the 128-bit product
+uint64_t mulFold(uint64_t a, uint64_t b) {
+#ifdef __SIZEOF_INT128__
+    __extension__ using uint128 = unsigned __int128;
+    const uint128 p = static_cast<uint128>(a) * b;
+    return static_cast<uint64_t>(p) ^ static_cast<uint64_t>(p >> 64u);
+#else
+    const uint64_t lo_lo = (a & 0xFFFFFFFFu) * (b & 0xFFFFFFFFu);
+    const uint64_t hi_lo = (a >> 32u) * (b & 0xFFFFFFFFu);
+    const uint64_t lo_hi = (a & 0xFFFFFFFFu) * (b >> 32u);
+    const uint64_t hi_hi = (a >> 32u) * (b >> 32u);
+    const uint64_t cross = (lo_lo >> 32u) + (hi_lo & 0xFFFFFFFFu) + lo_hi;
+    const uint64_t upper = (hi_lo >> 32u) + (cross >> 32u) + hi_hi;
+    const uint64_t lower = (cross << 32u) | (lo_lo & 0xFFFFFFFFu);
+    return lower ^ upper;
+#endif
+}
+
+uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37u;
+    h *= 0x165667919E3779F9u;
+    return h ^ (h >> 32u);
+}
+
+}
+
+Hash64::Hash64(uint64_t seed)
+        : acc{prime32_3, prime64_1, prime64_2, prime64_3, prime64_4, prime32_2, prime64_5, prime32_1} {
+    for (size_t i = 0; i < acc.size(); i++) {
+        acc[i] += (i & 1u) ? 0 - seed : seed;
+    }
+}
+
+void Hash64::update(std::span<const uint8_t> data) {
+    length += data.size();
+    const uint8_t *p = data.data();
+    size_t left = data.size();
+    if (buffered != 0) {
+        const size_t n = std::min(left, stripe_size - buffered);
+        std::memcpy(buffer.data() + buffered, p, n);
+        buffered += n;
+        p += n;
+        left -= n;
+        if (buffered < stripe_size) {
+            return;
+        }
+        consume(buffer.data(), 1);
+        buffered = 0;
+    }
+    const size_t whole = left / stripe_size;
+    consume(p, whole);
+    p += whole * stripe_size;
+    left -= whole * stripe_size;
+    std::memcpy(buffer.data(), p, left);
+    buffered = left;
+}
+
+void Hash64::consume(const uint8_t *p, size_t count) {
+    while (count != 0) {
+        const size_t in_block = stripes % stripes_per_block;
+        const size_t n = std::min(count, stripes_per_block - in_block);
+        accumulate(acc.data(), p, n, in_block);
+        stripes += n;
+        count -= n;
+        p += n * stripe_size;
+        if (stripes % stripes_per_block == 0) {
+            scramble(acc.data());
+        }
+    }
+}
+
+uint64_t Hash64::digest() const {
+    Hash64 h = *this;
+    // The last part stripe is padded with zeroes. The length, merged in below, tells that apart from real zeroes
+    if (h.buffered != 0 || length == 0) {
+        std::fill(h.buffer.begin() + static_cast<std::ptrdiff_t>(h.buffered), h.buffer.end(), uint8_t{0});
+        h.consume(h.buffer.data(), 1);
+    }
+    uint64_t result = length * prime64_1;
+    for (size_t i = 0; i < 4; i++) {
+        result += mulFold(h.acc[2 * i] ^ keys[stripes_per_block + 2 * i], h.acc[2 * i + 1] ^ keys[stripes_per_block + 2 * i + 1]);
+    }
+    return avalanche(result);
+}
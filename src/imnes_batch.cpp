@@ -0,0 +1,466 @@
+// Headless batch runner
+// Runs many consoles at once, one job per console on a work stealing pool, and reports how fast each ran
+// ROM images are loaded once and shared read only between all the consoles running them
+// Flat 6502 images can instead be run on the experimental lockstep engine, sixteen instances to a job, to compare
+// its throughput with one console per job
+// Usage: imnes-batch [-j threads] [-n instances] [-f frames] [--pin] [--hashes dir] [--csv file] [--json file] roms...
+//        imnes-batch --flat load_addr start_pc [-c cycles] [--vary addr] [--lockstep [--verify]] [...] images...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "console.h"
+#include "frame_hash.h"
+#include "ines.h"
+#include "lockstep.h"
+#include "work_stealing_pool.h"
+
+namespace {
+
+struct options
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t instances = 0; // 0 for one per thread
+    uint64_t frames = 600;
+    bool pin = false;
+    // Flat images
+    bool flat = false;
+    uint16_t load_addr = 0;
+    uint16_t start_pc = 0;
+    uint64_t cycles = 10'000'000;
+    int vary_addr = -1;
+    bool lockstep = false;
+    bool verify = false;
+    const char *hashes = nullptr;
+    const char *csv = nullptr;
+    const char *json = nullptr;
+    std::vector<std::string> roms;
+};
+
+struct result
+{
+    size_t rom = 0;
+    unsigned worker = 0;
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+    double seconds = 0;
+    std::string error;
+};
+
+// Instances on the lockstep engine run together, so each is timed as its whole group
+using lockstep_group = LockstepCpus<16>;
+
+double fps(uint64_t frames, double seconds)
+{
+    return static_cast<double>(frames) / std::max(seconds, 1e-9);
+}
+
+double mhz(uint64_t cycles, double seconds)
+{
+    return static_cast<double>(cycles) / std::max(seconds, 1e-9) / 1e6;
+}
+
+struct totals
+{
+    double wall = 0;
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+};
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-batch [-j threads] [-n instances] [-f frames] [--pin] [--hashes dir] [--csv file] [--json file] roms...\n"
+                         "  -n      consoles to run, spread over the ROMs in turn (default one per thread)\n"
+                         "  -f      frames to run each console for (default 600)\n"
+                         "  --pin   pin each worker thread to its own core\n"
+                         "  --hashes  log each console's frame and RAM hashes to dir/<instance>.hashes, see imnes-hashdiff\n"
+                         "  --flat  the inputs are plain 6502 images, loaded at load_addr and started at start_pc (hex)\n"
+                         "  -c      cycles to run each flat image for (default 10000000)\n"
+                         "  --vary  write each instance's number to this address (hex) first, so they take different paths\n"
+                         "  --lockstep  run flat images %zu at a time on the lockstep engine\n"
+                         "  --verify    check every lockstep instance against the scalar core\n"
+                         "  The summary goes to stdout as CSV unless --csv or --json is given\n", lockstep_group::lanes);
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "-j" && has_value)
+        {
+            opt.threads = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else if(arg == "-n" && has_value)
+        {
+            opt.instances = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "-f" && has_value)
+        {
+            opt.frames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--pin")
+        {
+            opt.pin = true;
+        }
+        else if(arg == "--flat" && i + 2 < argc)
+        {
+            opt.flat = true;
+            opt.load_addr = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 16));
+            opt.start_pc = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 16));
+        }
+        else if(arg == "-c" && has_value)
+        {
+            opt.cycles = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--vary" && has_value)
+        {
+            opt.vary_addr = static_cast<int>(std::strtoul(argv[++i], nullptr, 16) & 0xFFFFu);
+        }
+        else if(arg == "--lockstep")
+        {
+            opt.lockstep = true;
+        }
+        else if(arg == "--verify")
+        {
+            opt.verify = true;
+        }
+        else if(arg == "--hashes" && has_value)
+        {
+            opt.hashes = argv[++i];
+        }
+        else if(arg == "--csv" && has_value)
+        {
+            opt.csv = argv[++i];
+        }
+        else if(arg == "--json" && has_value)
+        {
+            opt.json = argv[++i];
+        }
+        else if(!arg.empty() && arg[0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            opt.roms.emplace_back(arg);
+        }
+    }
+    if(opt.instances == 0)
+    {
+        opt.instances = opt.threads;
+    }
+    return !opt.roms.empty() && (opt.flat || !opt.lockstep);
+}
+
+// ROM paths and errors are the only free text
+std::string csvField(std::string_view s)
+{
+    std::string out = "\"";
+    for(const char c : s)
+    {
+        out += c;
+        if(c == '"')
+        {
+            out += '"';
+        }
+    }
+    return out + "\"";
+}
+
+std::string jsonString(std::string_view s)
+{
+    std::string out = "\"";
+    for(const char c : s)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+bool writeCsv(FILE *f, const options &opt, const std::vector<result> &results, const totals &t)
+{
+    std::fprintf(f, "instance,rom,worker,frames,cycles,seconds,fps,mhz,error\n");
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const result &r = results[i];
+        std::fprintf(f, "%zu,%s,%u,%llu,%llu,%.6f,%.1f,%.2f,%s\n", i, csvField(opt.roms[r.rom]).c_str(), r.worker,
+                     static_cast<unsigned long long>(r.frames), static_cast<unsigned long long>(r.cycles), r.seconds,
+                     fps(r.frames, r.seconds), mhz(r.cycles, r.seconds), r.error.empty() ? "" : csvField(r.error).c_str());
+    }
+    std::fprintf(f, "total,,%u,%llu,%llu,%.6f,%.1f,%.2f,\n", opt.threads, static_cast<unsigned long long>(t.frames),
+                 static_cast<unsigned long long>(t.cycles), t.wall, fps(t.frames, t.wall), mhz(t.cycles, t.wall));
+    return std::ferror(f) == 0;
+}
+
+bool writeJson(FILE *f, const options &opt, const std::vector<result> &results, const totals &t)
+{
+    std::fprintf(f, "{\n  \"threads\": %u,\n  \"pinned\": %s,\n  \"engine\": \"%s\",\n  \"instances\": [\n", opt.threads,
+                 opt.pin ? "true" : "false", opt.lockstep ? "lockstep" : "scalar");
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const result &r = results[i];
+        std::fprintf(f, "    {\"instance\": %zu, \"rom\": %s, \"worker\": %u, \"frames\": %llu, \"cycles\": %llu, \"seconds\": %.6f, \"fps\": %.1f, \"mhz\": %.2f",
+                     i, jsonString(opt.roms[r.rom]).c_str(), r.worker, static_cast<unsigned long long>(r.frames),
+                     static_cast<unsigned long long>(r.cycles), r.seconds, fps(r.frames, r.seconds), mhz(r.cycles, r.seconds));
+        if(!r.error.empty())
+        {
+            std::fprintf(f, ", \"error\": %s", jsonString(r.error).c_str());
+        }
+        std::fprintf(f, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ],\n  \"total\": {\"frames\": %llu, \"cycles\": %llu, \"seconds\": %.6f, \"fps\": %.1f, \"mhz\": %.2f}\n}\n",
+                 static_cast<unsigned long long>(t.frames), static_cast<unsigned long long>(t.cycles), t.wall,
+                 fps(t.frames, t.wall), mhz(t.cycles, t.wall));
+    return std::ferror(f) == 0;
+}
+
+bool writeFile(const char *path, bool (*write)(FILE *, const options &, const std::vector<result> &, const totals &),
+               const options &opt, const std::vector<result> &results, const totals &t)
+{
+    FILE *f = std::fopen(path, "w");
+    if(f == nullptr)
+    {
+        std::fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+    const bool ok = write(f, opt, results, t);
+    return std::fclose(f) == 0 && ok;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void runNes(const options &opt, const std::vector<std::shared_ptr<const Ines>> &roms, std::vector<result> &results,
+            WorkStealingPool &pool)
+{
+    pool.forEach(results.size(), [&](size_t i, unsigned worker) {
+        result &r = results[i];
+        r.rom = i % roms.size();
+        r.worker = worker;
+        const auto start = std::chrono::steady_clock::now();
+        try
+        {
+            // Made on the worker, so its memory is local to the core running it
+            auto console = std::make_unique<Console>(roms[r.rom]);
+            std::unique_ptr<FrameHashLog> log;
+            if(opt.hashes)
+            {
+                log = std::make_unique<FrameHashLog>(std::filesystem::path(opt.hashes) / (std::to_string(i) + ".hashes"),
+                                                     FrameHasher::VIDEO | FrameHasher::RAM);
+            }
+            for(; r.frames < opt.frames; r.frames++)
+            {
+                console->runFrame();
+                if(log)
+                {
+                    log->add(*console);
+                }
+            }
+            r.cycles = console->cycles;
+        }
+        catch(const std::exception &e)
+        {
+            r.error = e.what();
+        }
+        r.seconds = secondsSince(start);
+    });
+}
+
+std::unique_ptr<Console> makeFlatConsole(const options &opt, const std::vector<uint8_t> &image, size_t instance)
+{
+    auto console = std::make_unique<Console>(image, opt.load_addr, opt.start_pc);
+    if(opt.vary_addr >= 0)
+    {
+        console->bus.write(static_cast<uint16_t>(opt.vary_addr), static_cast<uint8_t>(instance));
+    }
+    return console;
+}
+
+void runFlat(const options &opt, const std::vector<std::vector<uint8_t>> &images, std::vector<result> &results,
+             WorkStealingPool &pool)
+{
+    pool.forEach(results.size(), [&](size_t i, unsigned worker) {
+        result &r = results[i];
+        r.rom = i % images.size();
+        r.worker = worker;
+        const auto start = std::chrono::steady_clock::now();
+        auto console = makeFlatConsole(opt, images[r.rom], i);
+        console->runCycles(opt.cycles);
+        r.cycles = console->cycles;
+        r.seconds = secondsSince(start);
+    });
+}
+
+// Each job runs up to a full group of instances of one image. Spare lanes run too, but aren't reported
+void runLockstep(const options &opt, const std::vector<std::vector<uint8_t>> &images, std::vector<result> &results,
+                 WorkStealingPool &pool)
+{
+    std::vector<std::vector<size_t>> groups;
+    for(size_t rom = 0; rom < images.size(); rom++)
+    {
+        for(size_t i = rom; i < results.size(); i += images.size())
+        {
+            if(groups.empty() || groups.back().size() == lockstep_group::lanes || results[groups.back()[0]].rom != rom)
+            {
+                groups.emplace_back();
+            }
+            groups.back().push_back(i);
+            results[i].rom = rom;
+        }
+    }
+
+    pool.forEach(groups.size(), [&](size_t g, unsigned worker) {
+        const std::vector<size_t> &group = groups[g];
+        const std::vector<uint8_t> &image = images[results[group[0]].rom];
+        const auto start = std::chrono::steady_clock::now();
+        auto cpus = std::make_unique<lockstep_group>(image, opt.load_addr, opt.start_pc);
+        if(opt.vary_addr >= 0)
+        {
+            for(size_t lane = 0; lane < group.size(); lane++)
+            {
+                cpus->poke(lane, static_cast<uint16_t>(opt.vary_addr), static_cast<uint8_t>(group[lane]));
+            }
+        }
+        cpus->runCycles(opt.cycles);
+        const double seconds = secondsSince(start);
+
+        for(size_t lane = 0; lane < group.size(); lane++)
+        {
+            result &r = results[group[lane]];
+            r.worker = worker;
+            r.cycles = cpus->cycles[lane];
+            r.seconds = seconds;
+            if(!opt.verify)
+            {
+                continue;
+            }
+            auto console = makeFlatConsole(opt, image, group[lane]);
+            console->runCycles(opt.cycles);
+            const Cpu6502 cpu = cpus->cpu(lane);
+            bool same = console->cycles == r.cycles && console->cpu.a == cpu.a && console->cpu.x == cpu.x &&
+                        console->cpu.y == cpu.y && console->cpu.s == cpu.s && console->cpu.p == cpu.p &&
+                        console->cpu.pc == cpu.pc;
+            for(uint32_t addr = 0; addr < 0x10000 && same; addr++)
+            {
+                same = console->bus.read(static_cast<uint16_t>(addr)) == cpus->peek(lane, static_cast<uint16_t>(addr));
+            }
+            if(!same)
+            {
+                r.error = "Differs from the scalar core";
+            }
+        }
+    });
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 1;
+    }
+
+    std::vector<std::shared_ptr<const Ines>> roms;
+    std::vector<std::vector<uint8_t>> images;
+    for(const auto &name : opt.roms)
+    {
+        try
+        {
+            if(opt.flat)
+            {
+                images.push_back(read_file(name));
+            }
+            else
+            {
+                roms.push_back(std::make_shared<const Ines>(name));
+            }
+        }
+        catch(const std::exception &e)
+        {
+            std::fprintf(stderr, "%s: %s\n", name.c_str(), e.what());
+            return 1;
+        }
+    }
+
+    std::vector<result> results(opt.instances);
+    WorkStealingPool pool(opt.threads, opt.pin);
+
+    const auto start_time = std::chrono::steady_clock::now();
+    if(!opt.flat)
+    {
+        runNes(opt, roms, results, pool);
+    }
+    else if(opt.lockstep)
+    {
+        runLockstep(opt, images, results, pool);
+    }
+    else
+    {
+        runFlat(opt, images, results, pool);
+    }
+    totals t;
+    t.wall = secondsSince(start_time);
+
+    size_t failed = 0;
+    for(const auto &r : results)
+    {
+        t.frames += r.frames;
+        t.cycles += r.cycles;
+        failed += r.error.empty() ? 0u : 1u;
+    }
+
+    bool ok = true;
+    if(opt.csv)
+    {
+        ok &= writeFile(opt.csv, writeCsv, opt, results, t);
+    }
+    if(opt.json)
+    {
+        ok &= writeFile(opt.json, writeJson, opt, results, t);
+    }
+    if(!opt.csv && !opt.json)
+    {
+        ok &= writeCsv(stdout, opt, results, t);
+    }
+
+    if(opt.flat)
+    {
+        std::fprintf(stderr, "%zu instances on %u threads, %llu cycles in %.3f s (%.1f MHz)\n", results.size(), opt.threads,
+                     static_cast<unsigned long long>(t.cycles), t.wall, mhz(t.cycles, t.wall));
+    }
+    else
+    {
+        std::fprintf(stderr, "%zu instances on %u threads, %llu frames in %.3f s (%.0f frames/s)\n", results.size(),
+                     opt.threads, static_cast<unsigned long long>(t.frames), t.wall, fps(t.frames, t.wall));
+    }
+    if(!ok)
+    {
+        std::fprintf(stderr, "Error writing summary\n");
+    }
+    if(failed != 0)
+    {
+        std::fprintf(stderr, "%zu instances failed\n", failed);
+    }
+    return ok && failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,672 @@
+// Microbenchmarks of the emulator's hot paths
+// Each benchmark is timed over many samples of at least --sample-ms each, after warming up, on a thread pinned to one
+// core, and reported as the median time per operation with its median absolute deviation (MAD)
+// With --baseline, a benchmark whose median is more than --threshold percent (and three MADs) slower than in an earlier
+// --json run counts as a regression, and the exit status is 1, so it can gate a merge
+// Usage: imnes-bench [--filter text] [--samples n] [--sample-ms ms] [--cpu n] [--no-pin] [--json file]
+//                    [--baseline file [--threshold percent]]
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bus.h"
+#include "console.h"
+#include "Cpu6502_instructions.h"
+#include "ines.h"
+#include "ppu.h"
+#include "ppu_render.h"
+#include "timeline.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+struct options
+{
+    const char *filter = nullptr;
+    const char *json = nullptr;
+    const char *baseline = nullptr;
+    double threshold = 2.0;
+    unsigned samples = 21;
+    double sample_ms = 20.0;
+    int cpu = 0;
+    bool pin = true;
+};
+
+// Runs the operation iterations times and returns how many operations that was
+struct benchmark
+{
+    std::string name;
+    std::function<uint64_t(uint64_t iterations)> run;
+};
+
+struct measurement
+{
+    std::string name;
+    double median_ns = 0; // Per operation
+    double mad_ns = 0;
+    uint64_t iterations = 0; // Per sample
+};
+
+// Results are added in to this, so the work can't be optimised away
+volatile uint64_t sink = 0;
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-bench [--filter text] [--samples n] [--sample-ms ms] [--cpu n] [--no-pin] [--json file]\n"
+                         "                   [--baseline file [--threshold percent]]\n"
+                         "  --filter     only run benchmarks whose name contains text\n"
+                         "  --samples    timed samples per benchmark (default 21)\n"
+                         "  --sample-ms  minimum length of a sample (default 20)\n"
+                         "  --cpu        core to pin to (default 0)\n"
+                         "  --baseline   fail if slower than this earlier --json output\n"
+                         "  --threshold  percent slower that counts as a regression (default 2)\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "--filter" && has_value)
+        {
+            opt.filter = argv[++i];
+        }
+        else if(arg == "--samples" && has_value)
+        {
+            opt.samples = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else if(arg == "--sample-ms" && has_value)
+        {
+            opt.sample_ms = std::strtod(argv[++i], nullptr);
+        }
+        else if(arg == "--cpu" && has_value)
+        {
+            opt.cpu = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+        }
+        else if(arg == "--no-pin")
+        {
+            opt.pin = false;
+        }
+        else if(arg == "--json" && has_value)
+        {
+            opt.json = argv[++i];
+        }
+        else if(arg == "--baseline" && has_value)
+        {
+            opt.baseline = argv[++i];
+        }
+        else if(arg == "--threshold" && has_value)
+        {
+            opt.threshold = std::strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool pinTo(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<size_t>(cpu), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+double median(std::vector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+double secondsFor(const benchmark &b, uint64_t iterations, uint64_t &ops)
+{
+    const auto start = std::chrono::steady_clock::now();
+    ops = b.run(iterations);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+measurement measure(const benchmark &b, const options &opt)
+{
+    // Double the iterations until a sample is long enough, which also warms the caches and branch predictors up
+    const double sample_seconds = opt.sample_ms / 1000.0;
+    uint64_t iterations = 1;
+    uint64_t ops = 0;
+    for(double s = secondsFor(b, iterations, ops); s < sample_seconds; s = secondsFor(b, iterations, ops))
+    {
+        iterations = s > sample_seconds / 16 ? static_cast<uint64_t>(static_cast<double>(iterations) * sample_seconds * 1.2 / s) + 1 : iterations * 2;
+    }
+    // And a couple more at full length, for the clock speed to settle
+    for(int i = 0; i < 2; i++)
+    {
+        secondsFor(b, iterations, ops);
+    }
+
+    std::vector<double> per_op(opt.samples);
+    for(double &t : per_op)
+    {
+        t = secondsFor(b, iterations, ops) * 1e9 / static_cast<double>(std::max<uint64_t>(ops, 1));
+    }
+    measurement m;
+    m.name = b.name;
+    m.iterations = iterations;
+    m.median_ns = median(per_op);
+    for(double &t : per_op)
+    {
+        t = std::abs(t - m.median_ns);
+    }
+    m.mad_ns = median(per_op);
+    return m;
+}
+
+// CPU: instructions of one class, from the instructions table, in a loop on a flat image
+
+// Operands point at $90 for zero page, $0300 for absolute, and through a pointer at $80 to $0300 for indirect modes,
+// with X and Y left at 0, so no class of instruction changes what another's operands reach
+constexpr uint16_t program_start = 0x0200;
+constexpr uint16_t subroutine = 0x0F00;
+constexpr uint8_t zero_page_operand = 0x90;
+constexpr uint8_t pointer_operand = 0x80;
+constexpr uint16_t absolute_operand = 0x0300;
+// Times each class's opcodes are repeated in the loop, so the jump back is a small part of it
+constexpr int program_repeats = 8;
+
+struct instruction_class
+{
+    const char *name;
+    std::vector<operation> operations;
+};
+
+const std::vector<instruction_class> &instructionClasses()
+{
+    using enum operation;
+    static const std::vector<instruction_class> classes = {
+            {"load", {LDA, LDX, LDY}},
+            {"store", {STA, STX, STY}},
+            {"alu", {ADC, SBC, AND, ORA, EOR, CMP, CPX, CPY, BIT}},
+            {"read_modify_write", {ASL, LSR, ROL, ROR, INC, DEC}},
+            {"register", {INX, INY, DEX, DEY, TAX, TAY, TXA, TYA, TSX, TXS, NOP}},
+            {"flags", {CLC, SEC, CLI, SEI, CLV, CLD, SED}},
+            {"stack", {PHA, PHP, PLA, PLP}},
+            {"branch", {BCC, BCS, BEQ, BMI, BNE, BPL, BVC, BVS}},
+            {"jump", {JMP, JSR}},
+    };
+    return classes;
+}
+
+std::vector<uint8_t> classProgram(const instruction_class &c)
+{
+    std::vector<uint8_t> image(0x10000);
+    image[pointer_operand] = static_cast<uint8_t>(absolute_operand);
+    image[pointer_operand + 1] = static_cast<uint8_t>(absolute_operand >> 8u);
+    image[subroutine] = 0x60; // RTS, so JSR brings RTS with it
+    size_t pc = program_start;
+    const auto emit = [&](uint8_t b) { image[pc++] = b; };
+    for(int r = 0; r < program_repeats; r++)
+    {
+        for(unsigned opcode = 0; opcode < instructions.size(); opcode++)
+        {
+            const instruction &instr = instructions[opcode];
+            if(std::find(c.operations.begin(), c.operations.end(), instr.code) == c.operations.end() ||
+               instr.mode == addressing_mode::IND)
+            {
+                continue;
+            }
+            emit(static_cast<uint8_t>(opcode));
+            switch(instr.mode)
+            {
+                case addressing_mode::IMM:
+                case addressing_mode::REL: // Taken or not, to the next instruction
+                    emit(0);
+                    break;
+                case addressing_mode::ZP:
+                case addressing_mode::ZPX:
+                case addressing_mode::ZPY:
+                    emit(zero_page_operand);
+                    break;
+                case addressing_mode::INDX:
+                case addressing_mode::INDY:
+                    emit(pointer_operand);
+                    break;
+                case addressing_mode::ABS:
+                case addressing_mode::ABSX:
+                case addressing_mode::ABSY:
+                {
+                    const uint16_t target = instr.code == operation::JMP ? static_cast<uint16_t>(pc + 2)
+                                          : instr.code == operation::JSR ? subroutine : absolute_operand;
+                    emit(static_cast<uint8_t>(target));
+                    emit(static_cast<uint8_t>(target >> 8u));
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+    emit(0x4C); // JMP program_start
+    emit(static_cast<uint8_t>(program_start));
+    emit(static_cast<uint8_t>(program_start >> 8u));
+    return image;
+}
+
+benchmark cpuBenchmark(const instruction_class &c)
+{
+    auto image = std::make_shared<std::vector<uint8_t>>(classProgram(c));
+    auto console = std::make_shared<Console>(*image, 0, program_start);
+    // Step once round the loop to count it
+    uint64_t loop_instructions = 0;
+    do
+    {
+        console->step();
+        loop_instructions++;
+    } while(console->cpu.pc != program_start);
+    const uint64_t loop_cycles = console->cycles;
+    return {std::string("cpu/") + c.name, [image, console, loop_instructions, loop_cycles](uint64_t iterations) {
+                console->runCycles(iterations * loop_cycles);
+                return iterations * loop_instructions;
+            }};
+}
+
+// Bus: reads and writes of each kind of page, NROM mapped
+
+struct nrom
+{
+    std::vector<uint8_t> prg = std::vector<uint8_t>(0x8000);
+    std::vector<uint8_t> chr = std::vector<uint8_t>(0x2000);
+    Ppu ppu;
+    Bus bus;
+
+    nrom()
+    {
+        std::mt19937 rng(1);
+        std::generate(prg.begin(), prg.end(), [&] { return static_cast<uint8_t>(rng()); });
+        std::generate(chr.begin(), chr.end(), [&] { return static_cast<uint8_t>(rng()); });
+        ppu.powerOn(chr.data(), chr.size(), Ines::Mirroring::HORIZONTAL);
+        bus.mapNes(ppu, prg.data(), prg.size());
+    }
+};
+
+// Addresses to go through in each page type: 256 of them, spread over the region
+struct bus_region
+{
+    const char *name;
+    uint16_t base;
+    uint16_t stride;
+};
+constexpr std::array<bus_region, 4> bus_regions = {{
+        {"ram", 0x0000, 0x07},
+        {"prg_ram", 0x6000, 0x1F},
+        {"prg_rom", 0x8000, 0x7F},
+        {"ppu_registers", 0x2000, 0x01}, // Through readIo/writeIo, and mirrored down to $2000-$2007
+}};
+
+void addBusBenchmarks(std::vector<benchmark> &out)
+{
+    auto machine = std::make_shared<nrom>();
+    for(const bus_region &r : bus_regions)
+    {
+        std::array<uint16_t, 256> addrs{};
+        for(size_t i = 0; i < addrs.size(); i++)
+        {
+            addrs[i] = static_cast<uint16_t>(r.base + (i * r.stride) % (r.base == 0x2000 ? 8 : 0x2000));
+        }
+        out.push_back({std::string("bus/read/") + r.name, [machine, addrs](uint64_t iterations) {
+                           uint64_t sum = 0;
+                           for(uint64_t i = 0; i < iterations; i++)
+                           {
+                               for(const uint16_t a : addrs)
+                               {
+                                   sum += machine->bus.read(a);
+                               }
+                           }
+                           sink = sink + sum;
+                           return iterations * addrs.size();
+                       }});
+        // ROM isn't writable, and writes are dropped, which is the path being timed
+        out.push_back({std::string("bus/write/") + r.name, [machine, addrs](uint64_t iterations) {
+                           for(uint64_t i = 0; i < iterations; i++)
+                           {
+                               for(const uint16_t a : addrs)
+                               {
+                                   machine->bus.write(a, static_cast<uint8_t>(i));
+                               }
+                           }
+                           return iterations * addrs.size();
+                       }});
+    }
+}
+
+// PPU: the pattern table fetch, a scanline of dots and whole frame drawing
+
+// A PPU with random memory, and rendering turned on as mask says
+std::shared_ptr<nrom> randomPpu(uint8_t mask)
+{
+    auto machine = std::make_shared<nrom>();
+    std::mt19937 rng(2);
+    const auto random_bytes = [&](auto &bytes) {
+        std::generate(bytes.begin(), bytes.end(), [&] { return static_cast<uint8_t>(rng()); });
+    };
+    random_bytes(machine->ppu.vram);
+    random_bytes(machine->ppu.palette);
+    random_bytes(machine->ppu.oam);
+    machine->ppu.mask = mask;
+    return machine;
+}
+
+void addPpuBenchmarks(std::vector<benchmark> &out)
+{
+    auto machine = randomPpu(0x1E);
+    out.push_back({"ppu/pattern_tables", [machine](uint64_t iterations) {
+                       std::array<uint8_t, 0x2000> patterns{};
+                       for(uint64_t i = 0; i < iterations; i++)
+                       {
+                           machine->ppu.copyPatternTables(patterns);
+                       }
+                       sink = sink + patterns[iterations % patterns.size()];
+                       return iterations;
+                   }});
+    out.push_back({"ppu/scanline", [machine](uint64_t iterations) {
+                       for(uint64_t i = 0; i < iterations; i++)
+                       {
+                           machine->ppu.tick(Ppu::dots_per_scanline);
+                       }
+                       return iterations;
+                   }});
+
+    constexpr std::array<std::pair<const char *, uint8_t>, 3> layers = {{
+            {"render/frame_background", 0x0A},
+            {"render/frame_sprites", 0x14},
+            {"render/frame", 0x1E},
+    }};
+    for(const auto &[name, mask] : layers)
+    {
+        auto m = randomPpu(mask);
+        auto frame = std::make_shared<std::vector<uint8_t>>(frame_pixels);
+        out.push_back({name, [m, frame](uint64_t iterations) {
+                           for(uint64_t i = 0; i < iterations; i++)
+                           {
+                               render_frame(m->ppu, *frame);
+                           }
+                           sink = sink + (*frame)[iterations % frame->size()];
+                           return iterations;
+                       }});
+    }
+}
+
+// Loading: an iNES file through Ines's ifstream reads, and through a mapping of the file
+
+std::filesystem::path writeRom(const char *name, uint8_t prg_16k, uint8_t chr_8k)
+{
+    const std::filesystem::path p = std::filesystem::temp_directory_path() / name;
+    std::ofstream file(p, std::ios::binary);
+    const std::array<char, 16> header = {'N', 'E', 'S', 0x1A, static_cast<char>(prg_16k), static_cast<char>(chr_8k)};
+    file.write(header.data(), header.size());
+    const std::vector<char> body((prg_16k * size_t{16} + chr_8k * size_t{8}) * 1024, 0x55);
+    file.write(body.data(), static_cast<std::streamsize>(body.size()));
+    if(!file)
+    {
+        throw std::runtime_error("Could not write " + p.string());
+    }
+    return p;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// What a loader working from a mapping of the file would do: map it, check the header and copy PRG and CHR out
+uint64_t loadMapped(const std::filesystem::path &p)
+{
+    const int fd = ::open(p.c_str(), O_RDONLY);
+    struct stat st{};
+    if(fd < 0 || ::fstat(fd, &st) != 0)
+    {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map " + p.string());
+    }
+    const auto *bytes = static_cast<const uint8_t *>(map);
+    if(size < 16 || std::memcmp(bytes, "NES\x1A", 4) != 0)
+    {
+        throw std::runtime_error("iNES identifier is not correct");
+    }
+    const size_t prg_size = bytes[4] * size_t{16 * 1024};
+    const size_t chr_size = bytes[5] * size_t{8 * 1024};
+    const size_t start = 16 + ((bytes[6] & 0x04u) ? 512 : 0);
+    if(size < start + prg_size + chr_size)
+    {
+        throw std::runtime_error("iNES file is truncated");
+    }
+    const std::vector<uint8_t> prg(bytes + start, bytes + start + prg_size);
+    const std::vector<uint8_t> chr(bytes + start + prg_size, bytes + start + prg_size + chr_size);
+    ::munmap(map, size);
+    return prg.size() + chr.size();
+}
+#endif
+
+void addLoadBenchmarks(std::vector<benchmark> &out)
+{
+    // NROM-256, and the largest iNES 1.0 allows
+    const std::array<std::pair<std::filesystem::path, const char *>, 2> roms = {{
+            {writeRom("imnes-bench-nrom.nes", 2, 1), "nrom"},
+            {writeRom("imnes-bench-large.nes", 255, 255), "large"},
+    }};
+    for(const auto &[path, name] : roms)
+    {
+        out.push_back({std::string("ines/ifstream_") + name, [path](uint64_t iterations) {
+                           for(uint64_t i = 0; i < iterations; i++)
+                           {
+                               const Ines rom(path);
+                               sink = sink + rom.getPrgRom().size();
+                           }
+                           return iterations;
+                       }});
+#if defined(__unix__) || defined(__APPLE__)
+        out.push_back({std::string("ines/mmap_") + name, [path](uint64_t iterations) {
+                           for(uint64_t i = 0; i < iterations; i++)
+                           {
+                               sink = sink + loadMapped(path);
+                           }
+                           return iterations;
+                       }});
+#endif
+    }
+}
+
+void addDisassemblyBenchmark(std::vector<benchmark> &out)
+{
+    out.push_back({"disasm/instruction", [](uint64_t iterations) {
+                       char text[max_disassembly_length + 1];
+                       uint64_t length = 0;
+                       for(uint64_t i = 0; i < iterations; i++)
+                       {
+                           for(unsigned opcode = 0; opcode < instructions.size(); opcode++)
+                           {
+                               length += disassemble_instruction(text, instructions[opcode], static_cast<uint16_t>(opcode * 0x0101u));
+                           }
+                       }
+                       sink = sink + length;
+                       return iterations * instructions.size();
+                   }});
+}
+
+// The cost of one timeline zone, which should stay well under 50ns
+void addTimelineBenchmark(std::vector<benchmark> &out)
+{
+    if constexpr(timeline_available)
+    {
+        out.push_back({"timeline/zone", [](uint64_t iterations) {
+                           for(uint64_t i = 0; i < iterations; i++)
+                           {
+                               IMNES_ZONE("bench");
+                           }
+                           return iterations;
+                       }});
+    }
+    else
+    {
+        static_cast<void>(out);
+    }
+}
+
+std::vector<benchmark> allBenchmarks()
+{
+    std::vector<benchmark> out;
+    for(const instruction_class &c : instructionClasses())
+    {
+        out.push_back(cpuBenchmark(c));
+    }
+    addBusBenchmarks(out);
+    addPpuBenchmarks(out);
+    addLoadBenchmarks(out);
+    addDisassemblyBenchmark(out);
+    addTimelineBenchmark(out);
+    return out;
+}
+
+// Medians from an earlier --json run, found by name. Only reads the lines this program writes
+std::map<std::string, measurement> readBaseline(const char *path)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        throw std::runtime_error(std::string("Could not open ") + path);
+    }
+    std::map<std::string, measurement> out;
+    for(std::string line; std::getline(file, line);)
+    {
+        const size_t name = line.find("\"name\": \"");
+        const size_t median = line.find("\"median_ns\": ");
+        const size_t mad = line.find("\"mad_ns\": ");
+        if(name == std::string::npos || median == std::string::npos || mad == std::string::npos)
+        {
+            continue;
+        }
+        measurement m;
+        m.name = line.substr(name + 9, line.find('"', name + 9) - (name + 9));
+        m.median_ns = std::strtod(line.c_str() + median + 13, nullptr);
+        m.mad_ns = std::strtod(line.c_str() + mad + 10, nullptr);
+        out[m.name] = m;
+    }
+    return out;
+}
+
+bool writeJson(const char *path, const options &opt, bool pinned, const std::vector<measurement> &results)
+{
+    FILE *f = std::fopen(path, "w");
+    if(f == nullptr)
+    {
+        std::fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+    std::fprintf(f, "{\n  \"samples\": %u,\n  \"sample_ms\": %.1f,\n  \"pinned_cpu\": %d,\n  \"benchmarks\": [\n", opt.samples,
+                 opt.sample_ms, pinned ? opt.cpu : -1);
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const measurement &m = results[i];
+        std::fprintf(f, "    {\"name\": \"%s\", \"median_ns\": %.4f, \"mad_ns\": %.4f, \"mad_percent\": %.2f, \"iterations\": %llu}%s\n",
+                     m.name.c_str(), m.median_ns, m.mad_ns, 100.0 * m.mad_ns / m.median_ns,
+                     static_cast<unsigned long long>(m.iterations), i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(f, "  ]\n}\n");
+    const bool ok = std::ferror(f) == 0;
+    return std::fclose(f) == 0 && ok;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 2;
+    }
+
+    try
+    {
+        const bool pinned = opt.pin && pinTo(opt.cpu);
+        if(opt.pin && !pinned)
+        {
+            std::fprintf(stderr, "Could not pin to core %d, results will be noisier\n", opt.cpu);
+        }
+        const std::map<std::string, measurement> baseline = opt.baseline ? readBaseline(opt.baseline) : std::map<std::string, measurement>{};
+
+        std::vector<measurement> results;
+        size_t regressions = 0;
+        std::printf("%-28s %12s %10s %7s\n", "benchmark", "median ns", "MAD ns", "MAD %");
+        for(const benchmark &b : allBenchmarks())
+        {
+            if(opt.filter && b.name.find(opt.filter) == std::string::npos)
+            {
+                continue;
+            }
+            const measurement m = measure(b, opt);
+            results.push_back(m);
+            std::printf("%-28s %12.3f %10.3f %7.2f", m.name.c_str(), m.median_ns, m.mad_ns, 100.0 * m.mad_ns / m.median_ns);
+            if(const auto base = baseline.find(m.name); base != baseline.end())
+            {
+                const measurement &old = base->second;
+                const double change = 100.0 * (m.median_ns - old.median_ns) / old.median_ns;
+                const bool regressed = change > opt.threshold && m.median_ns - old.median_ns > 3 * std::max(m.mad_ns, old.mad_ns);
+                regressions += regressed;
+                std::printf("  %+6.2f%%%s", change, regressed ? "  REGRESSION" : "");
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+        }
+
+        if(opt.json && !writeJson(opt.json, opt, pinned, results))
+        {
+            return 2;
+        }
+        if(regressions != 0)
+        {
+            std::printf("%zu regressions of more than %.1f%%\n", regressions, opt.threshold);
+            return 1;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,269 @@
+// Headless batch disassembler
+// Prints a linear sweep listing of each input, so listings of whole ROM sets can be diffed
+// Usage: imnes-disasm [-j threads] [-o output] [--base hex] [--start hex] files...
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Cpu6502_instructions.h"
+#include "ines.h"
+
+namespace {
+
+struct options
+{
+    size_t raw_base = 0; // Load address of raw binaries
+    size_t raw_start = 0; // First address to disassemble in raw binaries
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    const char *output = nullptr;
+    std::vector<std::string> inputs;
+};
+
+struct listing
+{
+    std::vector<char> text;
+    size_t lines = 0;
+};
+
+// Chunk size for output. Each chunk is written with a single call to fwrite on an unbuffered stream
+constexpr size_t output_chunk_size = 256 * 1024;
+
+bool isInes(const std::vector<uint8_t> &dat)
+{
+    return dat.size() >= 4 && std::memcmp(dat.data(), "NES\x1A", 4) == 0;
+}
+
+// Appends "AAAA  BB BB BB  DISASSEMBLY\n" for every instruction in data
+// Illegal opcodes are printed as data and the sweep carries on with the next byte
+void disassemble(const uint8_t *data, size_t size, size_t base, size_t start, listing &out)
+{
+    constexpr std::string_view hex_digits = "0123456789ABCDEF";
+    // Address, 3 bytes of hex, disassembly and newline
+    constexpr size_t max_line_length = 6 + 9 + 1 + max_disassembly_length + 1;
+
+    // Instructions average around two bytes
+    out.text.reserve(out.text.size() + (size / 2) * max_line_length);
+    char line[max_line_length];
+    for(size_t i = start; i < size; )
+    {
+        const size_t addr = base + i;
+        instruction instr = instructions[data[i]];
+        if(instr.code == operation::ILL || i + instr.bytes > size)
+        {
+            instr = illegal_instruction;
+        }
+
+        char *p = line;
+        for(int shift = 12; shift >= 0; shift -= 4)
+        {
+            *p++ = hex_digits[(addr >> static_cast<unsigned>(shift)) & 0xFu];
+        }
+        *p++ = ' ';
+        *p++ = ' ';
+
+        uint16_t operand = 0;
+        for(size_t j = 0; j < 3; j++)
+        {
+            if(j < instr.bytes)
+            {
+                *p++ = hex_digits[data[i + j] >> 4u];
+                *p++ = hex_digits[data[i + j] & 0xFu];
+                if(j > 0)
+                {
+                    operand |= static_cast<uint16_t>(data[i + j] << (8 * (j - 1)));
+                }
+            }
+            else
+            {
+                *p++ = ' ';
+                *p++ = ' ';
+            }
+            *p++ = ' ';
+        }
+        *p++ = ' ';
+
+        if(instr.code == operation::ILL)
+        {
+            constexpr std::string_view db = ".db $";
+            p = std::copy(db.begin(), db.end(), p);
+            *p++ = hex_digits[data[i] >> 4u];
+            *p++ = hex_digits[data[i] & 0xFu];
+        }
+        else
+        {
+            p += disassemble_instruction(p, instr, operand);
+        }
+        *p++ = '\n';
+
+        out.text.insert(out.text.end(), line, p);
+        out.lines++;
+        i += instr.bytes;
+    }
+}
+
+listing disassembleFile(const std::string &name, const options &opt)
+{
+    listing out;
+    // resize and memcpy rather than insert, which GCC 12 flags with -Wstringop-overflow in release builds
+    auto append = [&out](std::string_view s) {
+        const size_t at = out.text.size();
+        out.text.resize(at + s.size());
+        std::memcpy(out.text.data() + at, s.data(), s.size());
+    };
+    append("; ");
+    append(name);
+    append("\n");
+
+    try
+    {
+        const auto dat = read_file(name);
+        if(isInes(dat))
+        {
+            Ines ines(name);
+            const auto &prg = ines.getPrgRom();
+            // 16K images are mirrored, so list them where the vectors are
+            const size_t base = prg.size() < 0x8000 ? 0xC000 : 0x8000;
+            disassemble(prg.data(), prg.size(), base, 0, out);
+        }
+        else
+        {
+            disassemble(dat.data(), dat.size(), opt.raw_base, opt.raw_start > opt.raw_base ? opt.raw_start - opt.raw_base : 0, out);
+        }
+    }
+    catch(const std::exception &e)
+    {
+        append("; error: ");
+        append(e.what());
+        append("\n");
+    }
+    return out;
+}
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-disasm [-j threads] [-o output] [--base hex] [--start hex] files...\n"
+                         "  iNES images are detected from their header, anything else is treated as a raw binary\n"
+                         "  --base   load address of raw binaries (default 0)\n"
+                         "  --start  first address to disassemble in raw binaries (default the load address)\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "-j" && has_value)
+        {
+            opt.threads = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else if(arg == "-o" && has_value)
+        {
+            opt.output = argv[++i];
+        }
+        else if(arg == "--base" && has_value)
+        {
+            opt.raw_base = std::strtoul(argv[++i], nullptr, 16);
+        }
+        else if(arg == "--start" && has_value)
+        {
+            opt.raw_start = std::strtoul(argv[++i], nullptr, 16);
+        }
+        else if(!arg.empty() && arg[0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            opt.inputs.emplace_back(arg);
+        }
+    }
+    return !opt.inputs.empty();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 1;
+    }
+
+    FILE *out = opt.output ? std::fopen(opt.output, "wb") : stdout;
+    if(out == nullptr)
+    {
+        std::fprintf(stderr, "Could not open %s\n", opt.output);
+        return 1;
+    }
+    // We do our own buffering, so each chunk goes out in one write
+    std::setvbuf(out, nullptr, _IONBF, 0);
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // Workers take the next file in turn, results are written out in input order as soon as they are ready
+    std::vector<std::promise<listing>> promises(opt.inputs.size());
+    std::vector<std::future<listing>> futures;
+    for(auto &p : promises)
+    {
+        futures.push_back(p.get_future());
+    }
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for(unsigned t = 0; t < std::min<size_t>(opt.threads, opt.inputs.size()); t++)
+    {
+        workers.emplace_back([&] {
+            for(size_t i = next++; i < opt.inputs.size(); i = next++)
+            {
+                promises[i].set_value(disassembleFile(opt.inputs[i], opt));
+            }
+        });
+    }
+
+    size_t total_lines = 0;
+    size_t total_bytes = 0;
+    bool write_ok = true;
+    for(auto &f : futures)
+    {
+        const listing l = f.get();
+        total_lines += l.lines;
+        total_bytes += l.text.size();
+        for(size_t offset = 0; offset < l.text.size() && write_ok; offset += output_chunk_size)
+        {
+            const size_t len = std::min(output_chunk_size, l.text.size() - offset);
+            write_ok = std::fwrite(l.text.data() + offset, 1, len, out) == len;
+        }
+    }
+
+    for(auto &w : workers)
+    {
+        w.join();
+    }
+    if(out != stdout)
+    {
+        write_ok &= std::fclose(out) == 0;
+    }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    std::fprintf(stderr, "%zu files, %zu lines, %zu bytes in %.3f s (%.0f lines/s)\n", opt.inputs.size(), total_lines,
+                 total_bytes, elapsed.count(), static_cast<double>(total_lines) / std::max(elapsed.count(), 1e-9));
+
+    if(!write_ok)
+    {
+        std::fprintf(stderr, "Error writing output\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Benchmark for the batched environment API (imnes::Env)
+// Steps batches of 1, 64 and 512 consoles with random buttons for a while each, and reports steps per second
+// Observations go in to plain buffers, or POSIX shared memory with --shm
+// Usage: imnes-env-bench [-j threads] [-k frame_skip] [-t seconds] [--no-render] [--shm] [--pin] rom.nes
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "env.h"
+
+namespace {
+
+struct options
+{
+    imnes::Env::options env;
+    double seconds = 2.0;
+    bool shm = false;
+    const char *rom = nullptr;
+};
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-env-bench [-j threads] [-k frame_skip] [-t seconds] [--no-render] [--shm] [--pin] rom.nes\n"
+                         "  -j           worker threads (default one per core)\n"
+                         "  -k           frames per step (default 4)\n"
+                         "  -t           seconds to run each batch size for (default 2)\n"
+                         "  --no-render  only observe RAM\n"
+                         "  --shm        write observations to POSIX shared memory\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "-j" && has_value)
+        {
+            opt.env.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if(arg == "-k" && has_value)
+        {
+            opt.env.frame_skip = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if(arg == "-t" && has_value)
+        {
+            opt.seconds = std::strtod(argv[++i], nullptr);
+        }
+        else if(arg == "--no-render")
+        {
+            opt.env.render = false;
+        }
+        else if(arg == "--shm")
+        {
+            opt.shm = true;
+        }
+        else if(arg == "--pin")
+        {
+            opt.env.pin = true;
+        }
+        else if(!arg.empty() && arg[0] != '-' && !opt.rom)
+        {
+            opt.rom = argv[i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return opt.rom != nullptr;
+}
+
+// Observation buffers, in the process or shared
+class Buffers
+{
+public:
+    Buffers(size_t size, const char *name, bool shm)
+    {
+        if(shm)
+        {
+            shared = std::make_unique<imnes::SharedMemory>(std::string("/imnes-env-bench-") + name, size, true);
+        }
+        else
+        {
+            local.resize(size);
+        }
+    }
+
+    std::span<uint8_t> bytes() { return shared ? shared->bytes() : std::span<uint8_t>(local); }
+
+private:
+    std::unique_ptr<imnes::SharedMemory> shared;
+    std::vector<uint8_t> local;
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 1;
+    }
+
+    try
+    {
+        const auto rom = std::make_shared<const Ines>(opt.rom);
+        std::printf("batch,steps,seconds,steps_per_s,instance_steps_per_s,frames_per_s\n");
+        for(const size_t batch : {size_t{1}, size_t{64}, size_t{512}})
+        {
+            imnes::Env env(rom, batch, opt.env);
+            Buffers frames(opt.env.render ? batch * imnes::Env::frame_bytes : 0, "frames", opt.shm && opt.env.render);
+            Buffers ram(batch * imnes::Env::ram_bytes, "ram", opt.shm);
+            env.setObservations(frames.bytes(), ram.bytes());
+
+            std::vector<uint8_t> actions(batch);
+            uint32_t lcg = 1;
+            uint64_t steps = 0;
+            const auto start = std::chrono::steady_clock::now();
+            double seconds = 0;
+            while(seconds < opt.seconds)
+            {
+                for(auto &a : actions)
+                {
+                    lcg = lcg * 1664525u + 1013904223u;
+                    a = static_cast<uint8_t>(lcg >> 24u);
+                }
+                env.step(actions);
+                steps++;
+                seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+            const double per_s = static_cast<double>(steps) / seconds;
+            std::printf("%zu,%llu,%.3f,%.1f,%.1f,%.1f\n", batch, static_cast<unsigned long long>(steps), seconds, per_s,
+                        per_s * static_cast<double>(batch), per_s * static_cast<double>(batch * opt.env.frame_skip));
+            std::fflush(stdout);
+        }
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
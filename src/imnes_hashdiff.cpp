@@ -0,0 +1,146 @@
+// Compares two frame hash logs (see FrameHashLog) and reports the first frame where they differ
+// Only frames and parts that are in both logs are compared
+// Exits 0 if they match, 1 if they differ, 2 on error
+// Usage: imnes-hashdiff [-q] a.hashes b.hashes
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "frame_hash.h"
+
+namespace {
+
+struct options
+{
+    const char *a = nullptr;
+    const char *b = nullptr;
+    bool quiet = false;
+};
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-hashdiff [-q] a.hashes b.hashes\n"
+                         "  -q  only set the exit status\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        if(arg == "-q")
+        {
+            opt.quiet = true;
+        }
+        else if(!arg.empty() && arg[0] != '-' && !opt.a)
+        {
+            opt.a = argv[i];
+        }
+        else if(!arg.empty() && arg[0] != '-' && !opt.b)
+        {
+            opt.b = argv[i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return opt.b != nullptr;
+}
+
+std::string partNames(unsigned parts)
+{
+    std::string out;
+    for(const auto &[part, name] : {std::pair{FrameHasher::VIDEO, "video"}, std::pair{FrameHasher::RAM, "ram"}, std::pair{FrameHasher::STATE, "state"}})
+    {
+        if(parts & part)
+        {
+            out += out.empty() ? name : std::string(" ") + name;
+        }
+    }
+    return out.empty() ? "nothing" : out;
+}
+
+unsigned differences(const frame_hashes &a, const frame_hashes &b, unsigned parts)
+{
+    unsigned d = 0;
+    d |= (parts & FrameHasher::VIDEO) && a.video != b.video ? FrameHasher::VIDEO : 0u;
+    d |= (parts & FrameHasher::RAM) && a.ram != b.ram ? FrameHasher::RAM : 0u;
+    d |= (parts & FrameHasher::STATE) && a.state != b.state ? FrameHasher::STATE : 0u;
+    return d;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 2;
+    }
+
+    try
+    {
+        unsigned parts_a = 0;
+        unsigned parts_b = 0;
+        const std::vector<frame_hashes> a = FrameHashLog::load(opt.a, parts_a);
+        const std::vector<frame_hashes> b = FrameHashLog::load(opt.b, parts_b);
+        const unsigned parts = parts_a & parts_b;
+        if(parts == 0 || a.empty() || b.empty())
+        {
+            std::fprintf(stderr, "Nothing to compare: %s has %zu frames of %s, %s has %zu frames of %s\n", opt.a, a.size(),
+                         partNames(parts_a).c_str(), opt.b, b.size(), partNames(parts_b).c_str());
+            return 2;
+        }
+
+        // Line up on frame number, in case one log started later
+        const uint64_t first = std::max(a.front().frame, b.front().frame);
+        const uint64_t end = std::min(a.back().frame, b.back().frame) + 1;
+        if(first >= end)
+        {
+            std::fprintf(stderr, "The logs have no frames in common\n");
+            return 2;
+        }
+        const size_t ia = first - a.front().frame;
+        const size_t ib = first - b.front().frame;
+        for(uint64_t f = 0; f < end - first; f++)
+        {
+            const unsigned d = differences(a[ia + f], b[ib + f], parts);
+            if(d != 0)
+            {
+                if(!opt.quiet)
+                {
+                    std::printf("First difference at frame %llu (%s), after %llu matching frames\n",
+                                static_cast<unsigned long long>(first + f), partNames(d).c_str(), static_cast<unsigned long long>(f));
+                }
+                return 1;
+            }
+        }
+
+        const bool same_length = a.front().frame == b.front().frame && a.size() == b.size();
+        if(!opt.quiet)
+        {
+            std::printf("%llu frames match (%s), frames %llu to %llu\n", static_cast<unsigned long long>(end - first),
+                        partNames(parts).c_str(), static_cast<unsigned long long>(first), static_cast<unsigned long long>(end - 1));
+            if(!same_length)
+            {
+                std::printf("But %s covers frames %llu to %llu and %s covers %llu to %llu\n", opt.a,
+                            static_cast<unsigned long long>(a.front().frame), static_cast<unsigned long long>(a.back().frame), opt.b,
+                            static_cast<unsigned long long>(b.front().frame), static_cast<unsigned long long>(b.back().frame));
+            }
+        }
+        return same_length ? 0 : 1;
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+}
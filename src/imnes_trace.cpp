@@ -0,0 +1,243 @@
+// Converts a binary execution trace to text, one instruction per line in the style of nestest.log
+// Usage: imnes-trace [-o output] [--last count] trace
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Cpu6502_instructions.h"
+#include "trace.h"
+
+namespace {
+
+struct options
+{
+    const char *input = nullptr;
+    const char *output = nullptr;
+    uint64_t last = 0; // Only convert this many of the newest records, 0 for all
+};
+
+// Records read from the file at a time
+constexpr size_t records_per_chunk = 64 * 1024;
+
+constexpr std::string_view hex_digits = "0123456789ABCDEF";
+
+char *putHex8(char *p, uint8_t v)
+{
+    *p++ = hex_digits[v >> 4u];
+    *p++ = hex_digits[v & 0xFu];
+    return p;
+}
+
+char *putRegister(char *p, std::string_view name, uint8_t v)
+{
+    p = std::copy(name.begin(), name.end(), p);
+    *p++ = ':';
+    p = putHex8(p, v);
+    *p++ = ' ';
+    return p;
+}
+
+// Right aligned in width characters
+char *putDecimal(char *p, uint64_t v, size_t width)
+{
+    char digits[20];
+    size_t n = 0;
+    do
+    {
+        digits[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while(v != 0);
+    for(size_t i = n; i < width; i++)
+    {
+        *p++ = ' ';
+    }
+    while(n != 0)
+    {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+// "C000  4C F5 C5  JMP $C5F5                        A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7"
+char *formatRecord(char *p, const trace_record &r)
+{
+    char *const line_start = p;
+    p = putHex8(p, static_cast<uint8_t>(r.pc >> 8u));
+    p = putHex8(p, static_cast<uint8_t>(r.pc));
+    *p++ = ' ';
+    *p++ = ' ';
+
+    if(r.flags & trace_record::INTERRUPT)
+    {
+        constexpr std::string_view text = "          interrupt";
+        p = std::copy(text.begin(), text.end(), p);
+    }
+    else
+    {
+        const instruction instr = instructions[r.bytes[0]];
+        for(size_t j = 0; j < 3; j++)
+        {
+            if(j < instr.bytes)
+            {
+                p = putHex8(p, r.bytes[j]);
+            }
+            else
+            {
+                *p++ = ' ';
+                *p++ = ' ';
+            }
+            *p++ = ' ';
+        }
+        *p++ = ' ';
+        const auto operand = static_cast<uint16_t>(r.bytes[1] | (instr.bytes > 2 ? r.bytes[2] << 8u : 0u));
+        p += disassemble_instruction(p, instr, operand);
+    }
+
+    // Registers start at column 48, as in nestest.log
+    while(p < line_start + 48)
+    {
+        *p++ = ' ';
+    }
+    p = putRegister(p, "A", r.a);
+    p = putRegister(p, "X", r.x);
+    p = putRegister(p, "Y", r.y);
+    p = putRegister(p, "P", r.p);
+    p = putRegister(p, "SP", r.s);
+    constexpr std::string_view ppu = "PPU:";
+    p = std::copy(ppu.begin(), ppu.end(), p);
+    p = putDecimal(p, r.scanline, 3);
+    *p++ = ',';
+    p = putDecimal(p, r.dot, 3);
+    constexpr std::string_view cyc = " CYC:";
+    p = std::copy(cyc.begin(), cyc.end(), p);
+    p = putDecimal(p, r.cycle, 0);
+    *p++ = '\n';
+    return p;
+}
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-trace [-o output] [--last count] trace\n"
+                         "  --last  only convert the newest count instructions\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "-o" && has_value)
+        {
+            opt.output = argv[++i];
+        }
+        else if(arg == "--last" && has_value)
+        {
+            opt.last = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(!arg.empty() && arg[0] == '-')
+        {
+            return false;
+        }
+        else if(opt.input == nullptr)
+        {
+            opt.input = argv[i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return opt.input != nullptr;
+}
+
+void convert(const options &opt, FILE *out)
+{
+    std::ifstream file(opt.input, std::ios::binary);
+    if(!file)
+    {
+        throw std::runtime_error(std::string("Could not open ") + opt.input);
+    }
+    TraceBuffer::header hdr{};
+    file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+    if(!file || std::memcmp(hdr.magic, TraceBuffer::magic, sizeof(hdr.magic)) != 0)
+    {
+        throw std::runtime_error("Not a trace file");
+    }
+    if(hdr.version != TraceBuffer::version || hdr.record_size != sizeof(trace_record) || hdr.capacity == 0 || (hdr.capacity & (hdr.capacity - 1)) != 0)
+    {
+        throw std::runtime_error("Unsupported trace version");
+    }
+
+    const uint64_t held = std::min(hdr.written, hdr.capacity);
+    const uint64_t count = opt.last != 0 ? std::min(opt.last, held) : held;
+    // The ring is read in order from the oldest record we want, in chunks that don't cross the end
+    std::vector<trace_record> records(records_per_chunk);
+    std::vector<char> text(records_per_chunk * 128);
+    for(uint64_t n = hdr.written - count; n < hdr.written; )
+    {
+        const uint64_t slot = n & (hdr.capacity - 1);
+        const size_t len = std::min({uint64_t{records_per_chunk}, hdr.written - n, hdr.capacity - slot});
+        file.seekg(static_cast<std::streamoff>(sizeof(hdr) + slot * sizeof(trace_record)));
+        file.read(reinterpret_cast<char *>(records.data()), static_cast<std::streamsize>(len * sizeof(trace_record)));
+        if(!file)
+        {
+            throw std::runtime_error("Trace file is truncated");
+        }
+
+        char *p = text.data();
+        for(size_t i = 0; i < len; i++)
+        {
+            p = formatRecord(p, records[i]);
+        }
+        const auto size = static_cast<size_t>(p - text.data());
+        if(std::fwrite(text.data(), 1, size, out) != size)
+        {
+            throw std::runtime_error("Error writing output");
+        }
+        n += len;
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 1;
+    }
+
+    FILE *out = opt.output ? std::fopen(opt.output, "wb") : stdout;
+    if(out == nullptr)
+    {
+        std::fprintf(stderr, "Could not open %s\n", opt.output);
+        return 1;
+    }
+    // We do our own buffering, so each chunk goes out in one write
+    std::setvbuf(out, nullptr, _IONBF, 0);
+
+    int result = 0;
+    try
+    {
+        convert(opt, out);
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        result = 1;
+    }
+    if(out != stdout)
+    {
+        std::fclose(out);
+    }
+    return result;
+}
@@ -0,0 +1,222 @@
+// Runs a program against a reference and stops at the first instruction where they differ
+// With --trace, the reference is a trace: a nestest.log style text log, or a binary trace from imnes. The console runs
+// one instruction at a time alongside it, e.g. for nestest: imnes-verify --pc C000 --trace nestest.log nestest.nes
+// With --lockstep, the reference is a second core: the flat image runs on both the console and the lockstep engine,
+// which compare state hashes every interval cycles and bisect down to the instruction when one differs, e.g.
+// imnes-verify --flat 0 400 --lockstep -c 100000000 6502_functional_test.bin
+// Exits 0 if they match, 1 if they differ, 2 on error
+// Usage: imnes-verify [--flat load_addr start_pc] [--pc addr] --trace reference rom
+//        imnes-verify --flat load_addr start_pc --lockstep [-c cycles] [--interval cycles] image
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "console.h"
+#include "ines.h"
+#include "verify.h"
+
+namespace {
+
+struct options
+{
+    const char *rom = nullptr;
+    const char *trace = nullptr;
+    bool lockstep = false;
+    bool flat = false;
+    uint16_t load_addr = 0;
+    uint16_t start_pc = 0;
+    int pc = -1; // Start here rather than at the reset vector
+    divergence_options divergence{100000000};
+};
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-verify [--flat load_addr start_pc] [--pc addr] --trace reference rom\n"
+                         "       imnes-verify --flat load_addr start_pc --lockstep [-c cycles] [--interval cycles] image\n"
+                         "  --flat      rom is a plain 6502 image, loaded and started at these (hex) addresses\n"
+                         "  --pc        start at this (hex) address, e.g. C000 for nestest's automated mode\n"
+                         "  --trace     compare with a nestest.log style text trace, or a binary imnes trace\n"
+                         "  --lockstep  compare the console with the lockstep engine\n"
+                         "  -c          cycles to compare for (default 100000000)\n"
+                         "  --interval  cycles between state hash checks (default 1000000)\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "--flat" && i + 2 < argc)
+        {
+            opt.flat = true;
+            opt.load_addr = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 16));
+            opt.start_pc = static_cast<uint16_t>(std::strtoul(argv[++i], nullptr, 16));
+        }
+        else if(arg == "--pc" && has_value)
+        {
+            opt.pc = static_cast<int>(std::strtoul(argv[++i], nullptr, 16) & 0xFFFFu);
+        }
+        else if(arg == "--trace" && has_value)
+        {
+            opt.trace = argv[++i];
+        }
+        else if(arg == "--lockstep")
+        {
+            opt.lockstep = true;
+        }
+        else if(arg == "-c" && has_value)
+        {
+            opt.divergence.cycles = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(arg == "--interval" && has_value)
+        {
+            opt.divergence.check_interval = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if(!arg.empty() && arg[0] != '-' && !opt.rom)
+        {
+            opt.rom = argv[i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    // One reference or the other, and the lockstep engine only runs flat images
+    return opt.rom && (opt.trace != nullptr) != opt.lockstep && (!opt.lockstep || opt.flat);
+}
+
+void printRegisters(const char *name, const Cpu6502 &c, uint64_t cycles)
+{
+    std::printf("  %-9s PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n", name, c.pc, c.a, c.x, c.y, c.p, c.s,
+                static_cast<unsigned long long>(cycles));
+}
+
+int verifyTrace(const options &opt)
+{
+    std::unique_ptr<Console> console;
+    std::vector<uint8_t> image;
+    if(opt.flat)
+    {
+        image = read_file(opt.rom);
+        console = std::make_unique<Console>(image, opt.load_addr, opt.start_pc);
+    }
+    else
+    {
+        console = std::make_unique<Console>(std::make_shared<const Ines>(opt.rom));
+    }
+    if(opt.pc >= 0)
+    {
+        console->cpu.pc = static_cast<uint16_t>(opt.pc);
+    }
+
+    ReferenceTrace reference(opt.trace);
+    const trace_mismatch m = compare_with_trace(*console, reference);
+    if(!m.found)
+    {
+        std::printf("%llu instructions match %s\n", static_cast<unsigned long long>(m.steps), opt.trace);
+        return 0;
+    }
+
+    const reference_step &e = m.expected;
+    const trace_record &r = m.actual;
+    std::printf("Differs at %s %llu, after %llu matching instructions:", reference.binary() ? "record" : "line",
+                static_cast<unsigned long long>(e.line), static_cast<unsigned long long>(m.steps));
+    constexpr std::pair<reference_step::field, const char *> names[] = {
+            {reference_step::PC, "PC"}, {reference_step::A, "A"}, {reference_step::X, "X"}, {reference_step::Y, "Y"},
+            {reference_step::P, "P"}, {reference_step::S, "SP"}, {reference_step::CYCLE, "CYC"}, {reference_step::INTERRUPT, "interrupt"}};
+    for(const auto &[field, name] : names)
+    {
+        if(m.fields & field)
+        {
+            std::printf(" %s", name);
+        }
+    }
+    std::printf("\n");
+    if(!e.text.empty())
+    {
+        std::printf("  expected  %s\n", e.text.c_str());
+    }
+    else
+    {
+        std::printf("  expected  PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu%s\n", e.pc, e.a, e.x, e.y, e.p, e.s,
+                    static_cast<unsigned long long>(e.cycle), e.interrupt ? " interrupt" : "");
+    }
+    std::printf("  actual    PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu%s\n", r.pc, r.a, r.x, r.y, r.p, r.s,
+                static_cast<unsigned long long>(r.cycle + static_cast<uint64_t>(m.cycle_offset)),
+                (r.flags & trace_record::INTERRUPT) ? " interrupt" : "");
+    return 1;
+}
+
+int verifyLockstep(const options &opt)
+{
+    const std::vector<uint8_t> image = read_file(opt.rom);
+    ConsoleCore console(image, opt.load_addr, opt.start_pc);
+    LockstepCore lockstep(image, opt.load_addr, opt.start_pc);
+
+    const auto start = std::chrono::steady_clock::now();
+    const divergence d = find_divergence(console, lockstep, opt.divergence);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const LockstepCore::engine::stats s = lockstep.stats();
+    std::fprintf(stderr, "%.2fs, %llu hash checks, %llu reruns, %llu instructions stepped\n", seconds,
+                 static_cast<unsigned long long>(d.checks), static_cast<unsigned long long>(d.bisections),
+                 static_cast<unsigned long long>(d.steps));
+    std::fprintf(stderr, "Lockstep engine: %llu vector steps, %llu scalar steps\n", static_cast<unsigned long long>(s.vector_steps),
+                 static_cast<unsigned long long>(s.scalar_steps));
+    // With no vector steps, both sides ran Cpu6502::step, and a match says nothing
+    if(s.vector_steps == 0)
+    {
+        std::fprintf(stderr, "The lockstep engine never used its vector code, so it wasn't a second implementation\n");
+        return 2;
+    }
+    if(!d.found)
+    {
+        std::printf("The console and lockstep engine match for %llu cycles\n", static_cast<unsigned long long>(opt.divergence.cycles));
+        return 0;
+    }
+
+    std::printf("Differs after the instruction at cycle %llu\n", static_cast<unsigned long long>(d.cycle));
+    printRegisters("before", d.before, d.cycle);
+    printRegisters("console", d.a, d.a_cycles);
+    printRegisters("lockstep", d.b, d.b_cycles);
+    if(!d.memory.empty())
+    {
+        std::printf("  memory   ");
+        for(const uint16_t addr : d.memory)
+        {
+            std::printf(" %04X", addr);
+        }
+        std::printf(d.memory.size() == divergence::max_memory ? " ...\n" : "\n");
+    }
+    return 1;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 2;
+    }
+
+    try
+    {
+        return opt.lockstep ? verifyLockstep(opt) : verifyTrace(opt);
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+}
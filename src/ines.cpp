@@ -6,6 +6,21 @@
 #include <bitset>
 #include "ines.h"
 
+std::vector<uint8_t> read_file(const std::filesystem::path &p) {
+    std::ifstream file(p, std::ios::binary);
+    if(!file)
+    {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    std::vector<uint8_t> dat(std::filesystem::file_size(p));
+    file.read(reinterpret_cast<char *>(dat.data()), static_cast<std::streamsize>(dat.size()));
+    if(!file)
+    {
+        throw std::runtime_error("Could not read " + p.string());
+    }
+    return dat;
+}
+
 Ines::Ines(const std::filesystem::path &p) {
     if(!std::filesystem::exists(p))
     {
@@ -127,8 +142,8 @@ Ines::Ines(const std::filesystem::path &p) {
     // Next in the image is the CHR ROM
     {
         const size_t size_bytes = chr_rom_size_8k_pages * 8 * 1024;
-        prg_rom.resize(size_bytes);
-        file.read(reinterpret_cast<char *>(prg_rom.data()), static_cast<std::streamsize>(size_bytes));
+        chr_rom.resize(size_bytes);
+        file.read(reinterpret_cast<char *>(chr_rom.data()), static_cast<std::streamsize>(size_bytes));
     }
 
     // TODO: Implement support for the play choice PROMs etc.
@@ -6,9 +6,14 @@
 #define IMNES_INES_H
 
 
+#include <cstdint>
 #include <filesystem>
 #include <vector>
 
+// The whole of a file, for ROMs and images that aren't loaded as iNES
+// N.B. throws runtime_error if it can't be read
+std::vector<uint8_t> read_file(const std::filesystem::path &p);
+
 class Ines {
 public:
         // N.B. constructor may throw runtime_error
@@ -25,10 +30,26 @@ public:
         return prg_rom;
     }
 
+    const std::vector<uint8_t> &getPrgRom() const {
+        return prg_rom;
+    }
+
     std::vector<uint8_t> &getChrRom() {
         return chr_rom;
     }
 
+    const std::vector<uint8_t> &getChrRom() const {
+        return chr_rom;
+    }
+
+    Mirroring getMirroring() const {
+        return mirroring;
+    }
+
+    uint8_t getMapperNum() const {
+        return mapper_num;
+    }
+
 private:
     Mirroring mirroring;
     uint8_t mapper_num;
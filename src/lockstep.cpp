@@ -0,0 +1,438 @@
+#include <algorithm>
+#include <cstring>
+
+#include "lockstep.h"
+
+namespace {
+
+// One lane's view of the interleaved memory, for the scalar core
+template<size_t Lanes>
+struct lane_bus
+{
+    uint8_t *memory;
+    size_t lane;
+
+    uint8_t read(uint16_t addr) { return memory[addr * Lanes + lane]; }
+    void write(uint16_t addr, uint8_t v) { memory[addr * Lanes + lane] = v; }
+    uint8_t fetch(uint16_t addr) { return read(addr); }
+    uint8_t fetchOperand(uint16_t addr) { return read(addr); }
+};
+
+// Branch free, so the lane loops vectorise
+inline uint8_t select(uint8_t mask, uint8_t v, uint8_t old) {
+    return static_cast<uint8_t>((v & mask) | (old & ~mask));
+}
+
+inline uint8_t withNZ(uint8_t p, uint8_t v) {
+    return static_cast<uint8_t>((p & ~(Cpu6502::Z | Cpu6502::N)) | (v == 0 ? Cpu6502::Z : 0) | (v & Cpu6502::N));
+}
+
+}
+
+template<size_t Lanes>
+LockstepCpus<Lanes>::LockstepCpus(std::span<const uint8_t> image, uint16_t load_addr, uint16_t start)
+        : memory(0x10000 * Lanes, 0) {
+    const size_t size = std::min(image.size(), 0x10000 - size_t{load_addr});
+    for (size_t i = 0; i < size; i++) {
+        std::memset(&memory[(load_addr + i) * Lanes], image[i], Lanes);
+    }
+    // As Cpu6502::powerOn, and flat images start at start rather than the reset vector
+    s.fill(0xFD);
+    p.fill(Cpu6502::I | Cpu6502::U);
+    pc.fill(start);
+}
+
+template<size_t Lanes>
+Cpu6502 LockstepCpus<Lanes>::cpu(size_t lane) const {
+    Cpu6502 c{};
+    c.powerOn();
+    c.decimal_mode = true;
+    c.a = a[lane];
+    c.x = x[lane];
+    c.y = y[lane];
+    c.s = s[lane];
+    c.p = p[lane];
+    c.pc = pc[lane];
+    return c;
+}
+
+template<size_t Lanes>
+void LockstepCpus<Lanes>::stepScalar(size_t lane) {
+    Cpu6502 c = cpu(lane);
+    lane_bus<Lanes> bus{memory.data(), lane};
+    cycles[lane] += c.step(bus);
+    a[lane] = c.a;
+    x[lane] = c.x;
+    y[lane] = c.y;
+    s[lane] = c.s;
+    p[lane] = c.p;
+    pc[lane] = c.pc;
+    counters.scalar_steps++;
+}
+
+template<size_t Lanes>
+void LockstepCpus<Lanes>::runCycles(uint64_t count) {
+    std::array<uint64_t, Lanes> limit;
+    for (size_t l = 0; l < Lanes; l++) {
+        limit[l] = cycles[l] + count;
+    }
+    while (true) {
+        // Running the lowest PC first lets lanes that split over an if/else meet again after it
+        uint32_t lowest = 0x10000;
+        size_t leader = 0;
+        for (size_t l = 0; l < Lanes; l++) {
+            if (cycles[l] < limit[l] && pc[l] < lowest) {
+                lowest = pc[l];
+                leader = l;
+            }
+        }
+        if (lowest == 0x10000) {
+            return;
+        }
+        const auto at = static_cast<uint16_t>(lowest);
+        const uint8_t opcode = peek(leader, at);
+        const instruction instr = instructions[opcode];
+        const auto lo_addr = static_cast<uint16_t>(at + 1);
+        const auto hi_addr = static_cast<uint16_t>(at + 2);
+        const uint8_t lo = peek(leader, lo_addr);
+        const uint8_t hi = peek(leader, hi_addr);
+
+        // Lanes can have different code at the same PC, if it has been written to
+        lane_mask m;
+        size_t group = 0;
+        for (size_t l = 0; l < Lanes; l++) {
+            const bool same = cycles[l] < limit[l] && pc[l] == at && peek(l, at) == opcode &&
+                              (instr.bytes < 2 || peek(l, lo_addr) == lo) && (instr.bytes < 3 || peek(l, hi_addr) == hi);
+            m[l] = same ? 0xFF : 0;
+            group += same ? 1 : 0;
+        }
+        // A lone lane is quicker on the scalar core, except in a one lane engine, which exists to be a second
+        // implementation of the CPU (see LockstepCore) and so has to go through the vector code
+        if ((group > 1 || Lanes == 1) && stepVector(m, at, instr, lo, hi)) {
+            counters.vector_steps++;
+            counters.vector_lanes += group;
+        } else {
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    stepScalar(l);
+                }
+            }
+        }
+    }
+}
+
+// Each case mirrors Cpu6502::step. Results are worked out for every lane, and only kept for lanes in m
+template<size_t Lanes>
+bool LockstepCpus<Lanes>::stepVector(const lane_mask &m, uint16_t lead_pc, instruction instr, uint8_t lo, uint8_t hi) {
+    using lanes_u8 = std::array<uint8_t, Lanes>;
+    using lanes_u16 = std::array<uint16_t, Lanes>;
+
+    if (instr.code == operation::BRK || instr.code == operation::RTI) {
+        return false;
+    }
+    if (instr.code == operation::ADC || instr.code == operation::SBC) {
+        for (size_t l = 0; l < Lanes; l++) {
+            if (m[l] & p[l] & Cpu6502::D) {
+                return false;
+            }
+        }
+    }
+
+    uint8_t *mem = memory.data();
+    const auto next = static_cast<uint16_t>(lead_pc + instr.bytes);
+    const auto operand = static_cast<uint16_t>(lo | (hi << 8u));
+    const uint8_t cross_cost = instr.special == special_duration::ADD_ONE_IF_CROSS ? 1 : 0;
+
+    // The effective address is the same for every lane unless it is indexed or indirect
+    bool uniform = true;
+    uint16_t addr = 0;
+    alignas(64) lanes_u16 ea{};
+    alignas(64) lanes_u8 extra{}; // Cycles on top of instr.cycles
+    alignas(64) lanes_u16 next_pc;
+    next_pc.fill(next);
+
+    auto indexed = [&](uint16_t base, const lanes_u8 &index) {
+        uniform = false;
+        for (size_t l = 0; l < Lanes; l++) {
+            ea[l] = static_cast<uint16_t>(base + index[l]);
+            extra[l] = ((base ^ ea[l]) & 0xFF00u) ? cross_cost : 0;
+        }
+    };
+    auto zeroPageIndexed = [&](const lanes_u8 &index) {
+        uniform = false;
+        for (size_t l = 0; l < Lanes; l++) {
+            ea[l] = static_cast<uint8_t>(lo + index[l]);
+        }
+    };
+    auto pointer = [&](size_t l, uint16_t ptr_lo, uint16_t ptr_hi) {
+        return static_cast<uint16_t>(mem[ptr_lo * Lanes + l] | (mem[ptr_hi * Lanes + l] << 8u));
+    };
+
+    switch (instr.mode) {
+        case addressing_mode::ACCUM:
+        case addressing_mode::IMPL:
+        case addressing_mode::REL: break;
+        case addressing_mode::IMM: addr = static_cast<uint16_t>(lead_pc + 1); break;
+        case addressing_mode::ZP: addr = lo; break;
+        case addressing_mode::ABS: addr = operand; break;
+        case addressing_mode::ZPX: zeroPageIndexed(x); break;
+        case addressing_mode::ZPY: zeroPageIndexed(y); break;
+        case addressing_mode::ABSX: indexed(operand, x); break;
+        case addressing_mode::ABSY: indexed(operand, y); break;
+        case addressing_mode::INDX:
+            uniform = false;
+            for (size_t l = 0; l < Lanes; l++) {
+                const auto zp = static_cast<uint8_t>(lo + x[l]);
+                ea[l] = pointer(l, zp, static_cast<uint8_t>(zp + 1));
+            }
+            break;
+        case addressing_mode::INDY:
+            uniform = false;
+            for (size_t l = 0; l < Lanes; l++) {
+                const uint16_t base = pointer(l, lo, static_cast<uint8_t>(lo + 1));
+                ea[l] = static_cast<uint16_t>(base + y[l]);
+                extra[l] = ((base ^ ea[l]) & 0xFF00u) ? cross_cost : 0;
+            }
+            break;
+        case addressing_mode::IND: {
+            // The high byte is fetched without carrying in to the page
+            const auto ptr_hi = static_cast<uint16_t>((operand & 0xFF00u) | static_cast<uint8_t>(operand + 1));
+            uniform = false;
+            for (size_t l = 0; l < Lanes; l++) {
+                ea[l] = pointer(l, operand, ptr_hi);
+            }
+            break;
+        }
+    }
+
+    alignas(64) lanes_u8 v;
+    auto load = [&]() {
+        if (uniform) {
+            std::memcpy(v.data(), mem + addr * Lanes, Lanes);
+        } else {
+            for (size_t l = 0; l < Lanes; l++) {
+                v[l] = mem[ea[l] * Lanes + l];
+            }
+        }
+    };
+    auto store = [&](const lanes_u8 &r) {
+        if (uniform) {
+            uint8_t *row = mem + addr * Lanes;
+            for (size_t l = 0; l < Lanes; l++) {
+                row[l] = select(m[l], r[l], row[l]);
+            }
+        } else {
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    mem[ea[l] * Lanes + l] = r[l];
+                }
+            }
+        }
+    };
+    auto each = [](auto f) {
+        alignas(64) lanes_u8 r;
+        for (size_t l = 0; l < Lanes; l++) {
+            r[l] = static_cast<uint8_t>(f(l));
+        }
+        return r;
+    };
+    // reg = value, with N and Z set from it
+    auto setReg = [&](lanes_u8 &reg, const lanes_u8 &value) {
+        for (size_t l = 0; l < Lanes; l++) {
+            reg[l] = select(m[l], value[l], reg[l]);
+            p[l] = select(m[l], withNZ(p[l], value[l]), p[l]);
+        }
+    };
+    auto setFlag = [&](uint8_t flag, bool set) {
+        for (size_t l = 0; l < Lanes; l++) {
+            p[l] = select(m[l], static_cast<uint8_t>(set ? (p[l] | flag) : (p[l] & ~flag)), p[l]);
+        }
+    };
+    // Binary mode only, decimal mode lanes were sent to the scalar core
+    auto adc = [&](uint8_t invert) {
+        for (size_t l = 0; l < Lanes; l++) {
+            const auto operand_l = static_cast<uint8_t>(v[l] ^ invert);
+            const unsigned sum = a[l] + operand_l + ((p[l] & Cpu6502::C) ? 1u : 0u);
+            const auto r = static_cast<uint8_t>(sum);
+            auto np = static_cast<uint8_t>(p[l] & ~(Cpu6502::C | Cpu6502::V));
+            np = static_cast<uint8_t>(np | (sum > 0xFF ? Cpu6502::C : 0) |
+                                      ((~(a[l] ^ operand_l) & (a[l] ^ sum) & 0x80u) ? Cpu6502::V : 0));
+            p[l] = select(m[l], withNZ(np, r), p[l]);
+            a[l] = select(m[l], r, a[l]);
+        }
+    };
+    auto compare = [&](const lanes_u8 &reg) {
+        for (size_t l = 0; l < Lanes; l++) {
+            auto np = static_cast<uint8_t>((p[l] & ~Cpu6502::C) | (reg[l] >= v[l] ? Cpu6502::C : 0));
+            p[l] = select(m[l], withNZ(np, static_cast<uint8_t>(reg[l] - v[l])), p[l]);
+        }
+    };
+    // op returns the result in the low byte and the new carry in bit 8
+    auto rmw = [&](auto op, bool sets_carry) {
+        if (instr.mode == addressing_mode::ACCUM) {
+            v = a;
+        } else {
+            load();
+        }
+        alignas(64) lanes_u8 r;
+        for (size_t l = 0; l < Lanes; l++) {
+            const unsigned result = op(v[l], (p[l] & Cpu6502::C) != 0);
+            r[l] = static_cast<uint8_t>(result);
+            auto np = withNZ(p[l], r[l]);
+            if (sets_carry) {
+                np = static_cast<uint8_t>((np & ~Cpu6502::C) | ((result & 0x100u) ? Cpu6502::C : 0));
+            }
+            p[l] = select(m[l], np, p[l]);
+        }
+        if (instr.mode == addressing_mode::ACCUM) {
+            for (size_t l = 0; l < Lanes; l++) {
+                a[l] = select(m[l], r[l], a[l]);
+            }
+        } else {
+            store(r);
+        }
+    };
+    auto branch = [&](uint8_t flag, bool when_set) {
+        const auto target = static_cast<uint16_t>(next + static_cast<int8_t>(lo));
+        const uint8_t taken_cost = ((next ^ target) & 0xFF00u) ? 2 : 1;
+        for (size_t l = 0; l < Lanes; l++) {
+            const bool taken = ((p[l] & flag) != 0) == when_set;
+            next_pc[l] = taken ? target : next;
+            extra[l] = taken ? taken_cost : 0;
+        }
+    };
+    // The stack pointer differs between lanes, so pushes and pulls are one lane at a time
+    auto push = [&](size_t l, uint8_t value) {
+        mem[(0x100u | s[l]) * Lanes + l] = value;
+        s[l]--;
+    };
+    auto pull = [&](size_t l) {
+        s[l]++;
+        return mem[(0x100u | s[l]) * Lanes + l];
+    };
+
+    switch (instr.code) {
+        case operation::ADC: load(); adc(0x00); break;
+        case operation::AND: load(); setReg(a, each([&](size_t l) { return a[l] & v[l]; })); break;
+        case operation::ASL: rmw([](unsigned r, bool) { return r << 1u; }, true); break;
+        case operation::BCC: branch(Cpu6502::C, false); break;
+        case operation::BCS: branch(Cpu6502::C, true); break;
+        case operation::BEQ: branch(Cpu6502::Z, true); break;
+        case operation::BIT:
+            load();
+            for (size_t l = 0; l < Lanes; l++) {
+                auto np = static_cast<uint8_t>((p[l] & ~(Cpu6502::N | Cpu6502::V | Cpu6502::Z)) |
+                                               (v[l] & (Cpu6502::N | Cpu6502::V)) | ((a[l] & v[l]) == 0 ? Cpu6502::Z : 0));
+                p[l] = select(m[l], np, p[l]);
+            }
+            break;
+        case operation::BMI: branch(Cpu6502::N, true); break;
+        case operation::BNE: branch(Cpu6502::Z, false); break;
+        case operation::BPL: branch(Cpu6502::N, false); break;
+        case operation::BRK: return false;
+        case operation::BVC: branch(Cpu6502::V, false); break;
+        case operation::BVS: branch(Cpu6502::V, true); break;
+        case operation::CLC: setFlag(Cpu6502::C, false); break;
+        case operation::CLD: setFlag(Cpu6502::D, false); break;
+        case operation::CLI: setFlag(Cpu6502::I, false); break;
+        case operation::CLV: setFlag(Cpu6502::V, false); break;
+        case operation::CMP: load(); compare(a); break;
+        case operation::CPX: load(); compare(x); break;
+        case operation::CPY: load(); compare(y); break;
+        case operation::DEC: rmw([](unsigned r, bool) { return (r - 1) & 0xFFu; }, false); break;
+        case operation::DEX: setReg(x, each([&](size_t l) { return x[l] - 1; })); break;
+        case operation::DEY: setReg(y, each([&](size_t l) { return y[l] - 1; })); break;
+        case operation::EOR: load(); setReg(a, each([&](size_t l) { return a[l] ^ v[l]; })); break;
+        case operation::INC: rmw([](unsigned r, bool) { return (r + 1) & 0xFFu; }, false); break;
+        case operation::INX: setReg(x, each([&](size_t l) { return x[l] + 1; })); break;
+        case operation::INY: setReg(y, each([&](size_t l) { return y[l] + 1; })); break;
+        case operation::JMP:
+            if (instr.mode == addressing_mode::IND) {
+                next_pc = ea;
+            } else {
+                next_pc.fill(operand);
+            }
+            break;
+        case operation::JSR: {
+            const auto ret = static_cast<uint16_t>(next - 1);
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    push(l, static_cast<uint8_t>(ret >> 8u));
+                    push(l, static_cast<uint8_t>(ret));
+                }
+            }
+            next_pc.fill(operand);
+            break;
+        }
+        case operation::LDA: load(); setReg(a, v); break;
+        case operation::LDX: load(); setReg(x, v); break;
+        case operation::LDY: load(); setReg(y, v); break;
+        case operation::LSR: rmw([](unsigned r, bool) { return (r >> 1u) | ((r & 1u) << 8u); }, true); break;
+        case operation::NOP: break;
+        case operation::ORA: load(); setReg(a, each([&](size_t l) { return a[l] | v[l]; })); break;
+        case operation::PHA:
+        case operation::PHP:
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    push(l, instr.code == operation::PHA ? a[l] : static_cast<uint8_t>(p[l] | Cpu6502::B | Cpu6502::U));
+                }
+            }
+            break;
+        case operation::PLA:
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    a[l] = pull(l);
+                    p[l] = withNZ(p[l], a[l]);
+                }
+            }
+            break;
+        case operation::PLP:
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    p[l] = static_cast<uint8_t>((pull(l) & ~Cpu6502::B) | Cpu6502::U);
+                }
+            }
+            break;
+        case operation::ROL: rmw([](unsigned r, bool c) { return (r << 1u) | (c ? 1u : 0u); }, true); break;
+        case operation::ROR:
+            rmw([](unsigned r, bool c) { return (r >> 1u) | (c ? 0x80u : 0u) | ((r & 1u) << 8u); }, true);
+            break;
+        case operation::RTI: return false;
+        case operation::RTS:
+            for (size_t l = 0; l < Lanes; l++) {
+                if (m[l]) {
+                    const uint8_t ret_lo = pull(l);
+                    next_pc[l] = static_cast<uint16_t>((ret_lo | (pull(l) << 8u)) + 1);
+                }
+            }
+            break;
+        case operation::SBC: load(); adc(0xFF); break;
+        case operation::SEC: setFlag(Cpu6502::C, true); break;
+        case operation::SED: setFlag(Cpu6502::D, true); break;
+        case operation::SEI: setFlag(Cpu6502::I, true); break;
+        case operation::STA: store(a); break;
+        case operation::STX: store(x); break;
+        case operation::STY: store(y); break;
+        case operation::TAX: setReg(x, a); break;
+        case operation::TAY: setReg(y, a); break;
+        case operation::TSX: setReg(x, s); break;
+        case operation::TXA: setReg(a, x); break;
+        case operation::TXS:
+            for (size_t l = 0; l < Lanes; l++) {
+                s[l] = select(m[l], x[l], s[l]);
+            }
+            break;
+        case operation::TYA: setReg(a, y); break;
+        case operation::ILL: break;
+    }
+
+    for (size_t l = 0; l < Lanes; l++) {
+        pc[l] = m[l] ? next_pc[l] : pc[l];
+        cycles[l] += m[l] ? instr.cycles + extra[l] : 0u;
+    }
+    return true;
+}
+
+template class LockstepCpus<1>;
+template class LockstepCpus<8>;
+template class LockstepCpus<16>;
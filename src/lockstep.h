@@ -0,0 +1,71 @@
+#ifndef IMNES_LOCKSTEP_H
+#define IMNES_LOCKSTEP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "Cpu6502.h"
+
+// Experimental. Many 6502s running the same flat image, with their registers laid out as struct of arrays
+// Each step takes the lowest PC any lane is at, and runs that instruction once for every lane that is there.
+// The per lane work is written as fixed width loops over the lanes, which the compiler turns in to SIMD for
+// whatever the target has (SSE, AVX2, AVX-512, NEON). Lanes whose PC has diverged just aren't in that step's
+// mask, and join back in when they reach the same PC. Instructions with no lockstep version (BRK, RTI and
+// decimal mode arithmetic) are run on each lane by the scalar core
+// Memory is interleaved by lane, so the same address in every lane is one contiguous vector
+// Matches Console(image, load_addr, start) instruction for instruction and cycle for cycle, with no interrupts
+template<size_t Lanes>
+class LockstepCpus {
+public:
+    static_assert(Lanes > 0 && Lanes <= 64, "Lanes must be 1-64");
+    static constexpr size_t lanes = Lanes;
+
+    LockstepCpus(std::span<const uint8_t> image, uint16_t load_addr, uint16_t start);
+
+    // Runs every lane until it has run at least count more cycles, as Console::runCycles
+    void runCycles(uint64_t count);
+
+    uint8_t peek(size_t lane, uint16_t addr) const { return memory[addr * Lanes + lane]; }
+    void poke(size_t lane, uint16_t addr, uint8_t v) { memory[addr * Lanes + lane] = v; }
+
+    // A lane's registers as a scalar CPU
+    Cpu6502 cpu(size_t lane) const;
+
+    struct stats
+    {
+        uint64_t vector_steps = 0; // Instructions run once for a group of lanes
+        uint64_t vector_lanes = 0; // Lane instructions those stood in for
+        uint64_t scalar_steps = 0; // Lane instructions run by the scalar core
+    };
+    const stats &getStats() const { return counters; }
+
+    // Lane i of each array is one CPU
+    alignas(64) std::array<uint8_t, Lanes> a{};
+    alignas(64) std::array<uint8_t, Lanes> x{};
+    alignas(64) std::array<uint8_t, Lanes> y{};
+    alignas(64) std::array<uint8_t, Lanes> s{};
+    alignas(64) std::array<uint8_t, Lanes> p{};
+    alignas(64) std::array<uint16_t, Lanes> pc{};
+    alignas(64) std::array<uint64_t, Lanes> cycles{};
+
+private:
+    // 0xFF for lanes taking part in a step, else 0
+    using lane_mask = std::array<uint8_t, Lanes>;
+
+    // Runs the instruction at lead_pc for the lanes in m. Returns false if it has no lockstep version
+    bool stepVector(const lane_mask &m, uint16_t lead_pc, instruction instr, uint8_t lo, uint8_t hi);
+    void stepScalar(size_t lane);
+
+    std::vector<uint8_t> memory;
+    stats counters;
+};
+
+extern template class LockstepCpus<1>;
+extern template class LockstepCpus<8>;
+extern template class LockstepCpus<16>;
+
+
+#endif //IMNES_LOCKSTEP_H
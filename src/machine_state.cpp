@@ -0,0 +1,59 @@
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+
+#include "hash.h"
+#include "ines.h"
+#include "machine_state.h"
+
+namespace {
+
+// FNV-1a https://datatracker.ietf.org/doc/html/draft-eastlake-fnv
+uint64_t fnv1a(uint64_t hash, std::span<const uint8_t> data) {
+    for (const uint8_t b : data) {
+        hash = (hash ^ b) * 0x100000001B3u;
+    }
+    return hash;
+}
+
+}
+
+uint64_t rom_hash(const Ines &rom) {
+    return fnv1a(fnv1a(0xCBF29CE484222325u, rom.getPrgRom()), rom.getChrRom());
+}
+
+uint64_t state_hash(const machine_state &state) {
+    return hash64({reinterpret_cast<const uint8_t *>(&state), sizeof(state)});
+}
+
+void save_machine_state(const std::filesystem::path &p, const machine_state &state) {
+    std::ofstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not create " + p.string());
+    }
+    file.write(reinterpret_cast<const char *>(&state), sizeof(state));
+    if (!file) {
+        throw std::runtime_error("Could not write " + p.string());
+    }
+}
+
+void load_machine_state(const std::filesystem::path &p, machine_state &state) {
+    std::ifstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    machine_state::header_t h{};
+    file.read(reinterpret_cast<char *>(&h), sizeof(h));
+    if (!file || std::memcmp(h.magic, machine_state::magic, sizeof(h.magic)) != 0) {
+        throw std::runtime_error(p.string() + " isn't a save state");
+    }
+    if (h.version != machine_state::version || h.size != sizeof(machine_state)) {
+        throw std::runtime_error(p.string() + " is from a different version of imnes");
+    }
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(&state), sizeof(state));
+    if (!file) {
+        throw std::runtime_error("Could not read " + p.string());
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef IMNES_MACHINE_STATE_H
+#define IMNES_MACHINE_STATE_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <type_traits>
+
+#include "bus.h"
+#include "Cpu6502.h"
+#include "ines.h"
+#include "ppu.h"
+
+// The whole of a running machine in one block, for save states
+// Nothing in it points anywhere. ROM is only reached through the bus and PPU, which keep their own pointers, and their
+// copy on write RAM is stored here as plain arrays. So a state can be copied with memcpy, written to disk or sent elsewhere and loaded in to any console with the same ROM
+// There is no APU or mapper state yet: the APU isn't emulated and NROM has no registers. Adding either bumps the version
+struct alignas(64) machine_state
+{
+    struct header_t
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t size;      // sizeof(machine_state)
+        uint64_t rom_hash;  // Of the PRG and CHR ROM it was saved from
+    };
+    static constexpr char magic[8] = {'I', 'M', 'N', 'S', 'T', 'A', 'T', 'E'};
+    static constexpr uint32_t version = 3;
+
+    header_t header;
+    uint64_t cycles;
+    Cpu6502 cpu;
+    // Padding is spelt out, here and in the parts, and always zero. So a state's bytes depend only on the machine,
+    // not on what was in memory before, and states can be hashed and compared whole
+    std::array<uint8_t, 64 - sizeof(header_t) - sizeof(uint64_t) - sizeof(Cpu6502)> reserved_cpu;
+    alignas(64) ppu_state ppu;
+    alignas(64) bus_state bus;
+    std::array<uint8_t, 64 - sizeof(bus_state)> reserved_bus;
+    alignas(64) std::array<uint8_t, 0x800> ram;
+    std::array<uint8_t, 0x2000> prg_ram;
+    std::array<uint8_t, 0x2000> chr_ram;
+};
+static_assert(std::is_trivially_copyable_v<machine_state>);
+static_assert(std::has_unique_object_representations_v<Cpu6502>);
+static_assert(std::has_unique_object_representations_v<ppu_state>);
+static_assert(std::has_unique_object_representations_v<bus_state>);
+static_assert(std::has_unique_object_representations_v<machine_state>);
+
+// Hash used for machine_state::header_t::rom_hash
+uint64_t rom_hash(const Ines &rom);
+
+// Hash of the whole state, to check two machines are in step. A state has no padding, so equal machines hash the same
+uint64_t state_hash(const machine_state &state);
+
+// N.B. throw runtime_error on failure. Loading checks the header, but not which ROM it is for: Console::loadState does that
+void save_machine_state(const std::filesystem::path &p, const machine_state &state);
+void load_machine_state(const std::filesystem::path &p, machine_state &state);
+
+
+#endif //IMNES_MACHINE_STATE_H
@@ -1,6 +1,15 @@
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
 #include <istream>
 #include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <imgui.h>
@@ -9,6 +18,7 @@
 #include <SFML/Graphics/RenderWindow.hpp>
 #include <SFML/System/Clock.hpp>
 #include <SFML/Window/Event.hpp>
+#include <SFML/Window/Keyboard.hpp>
 #include <SFML/Graphics/CircleShape.hpp>
 
 #include <fmt/core.h>
@@ -17,67 +27,131 @@
 #include "disassembly_view.h"
 
 #include "Cpu6502_instructions.h"
+#include "access_heatmap.h"
+#include "cdl.h"
+#include "code_analysis.h"
+#include "console.h"
+#include "emulation_thread.h"
 #include "ines.h"
+#include "machine_state.h"
+#include "perf_counters.h"
+#include "profiler.h"
+#include "run_ahead.h"
+#include "timedemo.h"
+#include "timeline.h"
 
-size_t getSize(const std::string &filename)
-{
-    std::ifstream is(filename, std::ios::binary);
-    if(!is)
-        return 0;
-    is.seekg(0, std::ios::end);
-    auto size = is.tellg();
-    return size<0? 0 : static_cast<size_t>(size);
-}
+namespace {
 
-std::vector<uint8_t> readToVector(const std::string &filename)
-{
-    std::vector<uint8_t> dat;
-    size_t filesize = getSize(filename);
-    if(filesize > 0) {
-        std::ifstream is(filename, std::ios::binary);
-        dat.resize(filesize);
-        is.read(reinterpret_cast<char *>(dat.data()), static_cast<std::streamsize>(filesize));
+// imnes --timedemo rom.nes movie [--no-video] [--json file]
+// Plays the movie back headless and uncapped, and writes the timings as JSON (to stdout without --json)
+int timedemo(int argc, char **argv) {
+    const char *rom = nullptr;
+    const char *movie = nullptr;
+    const char *json = nullptr;
+    timedemo_options opt;
+    for (int i = 2; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--no-video") {
+            opt.video = false;
+        } else if (arg == "--json" && i + 1 < argc) {
+            json = argv[++i];
+        } else if (!rom) {
+            rom = argv[i];
+        } else if (!movie) {
+            movie = argv[i];
+        } else {
+            movie = nullptr;
+            break;
+        }
+    }
+    if (!rom || !movie) {
+        std::cerr << "Usage: imnes --timedemo rom.nes movie [--no-video] [--json file]" << std::endl;
+        return 1;
     }
-    return dat;
-}
-
-int main() {
-    std::cout << "Hello, World!" << std::endl;
 
-    fmt::print("Hello from fmt\n");
+    try {
+        const timedemo_report r = run_timedemo(rom, movie, opt);
+        FILE *f = json ? std::fopen(json, "w") : stdout;
+        if (!f) {
+            std::cerr << "Could not open " << json << std::endl;
+            return 1;
+        }
+        const bool wrote = write_timedemo_json(f, r);
+        if (!wrote) {
+            std::cerr << "Error writing report" << std::endl;
+        }
+        // Closed whether the write worked or not
+        const bool closed = !json || std::fclose(f) == 0;
+        if (!closed) {
+            std::cerr << "Error closing " << json << std::endl;
+        }
+        if (!wrote || !closed) {
+            return 1;
+        }
+        if (!r.matched) {
+            std::cerr << "Playback didn't match the recording" << std::endl;
+            return 1;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
-    auto prog = readToVector("6502_functional_test.bin");
+}
 
-    if(prog.size() == 0)
-    {
-        std::cerr << "Could not open file\n";
-        exit(1);
+// imnes [--perf-json file]
+// With --perf-json, the performance counters start on, and are written to file as JSON on exit
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "--timedemo") {
+        return timedemo(argc, argv);
+    }
+    const char *perf_json = nullptr;
+    if (argc > 2 && std::string(argv[1]) == "--perf-json") {
+        perf_json = argv[2];
     }
 
-    std::cout << prog.size() << std::endl;
+    std::cout << "Hello, World!" << std::endl;
 
-    /*
-    for(size_t i=0x400; i<prog.size(); )
-    {
-        auto instr = instructions[prog[i]];
+    fmt::print("Hello from fmt\n");
 
-        uint16_t data{0};
-        for(size_t j=1; j< instr.bytes; j++)
-        {
-            data <<= 8u;
-            data |= static_cast<uint16_t>(prog[i+j]);
-        }
+    auto ines = std::make_shared<Ines>("test_image.nes");
 
-        fmt::print("(0x{:02X} 0x{:04X}) {} \n", prog[i], data, disassemble_instruction(instr, data));
+    // 16K images are mirrored, so show them where the vectors are
+    const size_t prg_base = ines->getPrgRom().size() < 0x8000 ? 0xC000 : 0x8000;
 
-        if(instr.code == operation::ILL)
-            break;
+    // Static so that the editor callbacks can reach them without captures
+    static CodeAnalyser analyser;
+    analyser.loadPrgRom(ines->getPrgRom());
+    // The console runs on its own thread, and the tools are only touched there, by posted commands
+    // Destroyed after the emulation thread, as they are constructed before it
+    static CodeDataLog cdl(ines->getPrgRom().size(), ines->getChrRom().size());
+    static Profiler profiler;
+    static AccessHeatmap heatmap;
+    static perf_counters counters;
+    static component_times times;
+    static std::unique_ptr<TraceBuffer> trace;
+    // The UI's own copy of the ROM. Edits are made here and sent on to the emulation thread
+    static std::vector<uint8_t> prg_view = ines->getPrgRom();
+    static EmulationThread emu(ines);
+    // Mirrors the console's breakpoints, so drawing doesn't have to ask the emulation thread
+    static Breakpoints breakpoints;
+    // The snapshot being drawn this frame
+    static const machine_snapshot *snap = nullptr;
+    static std::array<uint8_t, 0x800> ram_view{};
+    bool snapshots_wanted = true;
+    auto write_prg = [](ImU8* data, size_t off, ImU8 d) {
+        data[off] = d;
+        analyser.writePrgRom(off, d);
+        emu.writePrgRom(off, d);
+    };
 
-        i+= instr.bytes;
+    if constexpr (perf_counters_available) {
+        if (perf_json) {
+            emu.post([](Console &c) { c.setPerfCounters(&counters); });
+        }
     }
-     */
-
-    Ines ines("test_image.nes");
 
     // imGUI SFML Example
     sf::RenderWindow window(sf::VideoMode(1900, 1100), "ImGui + SFML = <3");
@@ -87,6 +161,8 @@ int main() {
     sf::CircleShape shape(100.f);
     shape.setFillColor(sf::Color::Green);
 
+    timeline_set_thread_name("ui");
+    timeline_scanlines.store(true, std::memory_order_relaxed);
     sf::Clock deltaClock;
     while (window.isOpen()) {
         sf::Event event;
@@ -96,32 +172,439 @@ int main() {
             if (event.type == sf::Event::Closed) {
                 window.close();
             }
+            // F9 saves the last 10 seconds of the timeline
+            if constexpr (timeline_available) {
+                if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F9) {
+                    try {
+                        const size_t zones = save_timeline("imnes_timeline.json", 10.0);
+                        std::cout << "Saved " << zones << " zones to imnes_timeline.json" << std::endl;
+                    } catch (const std::exception &e) {
+                        std::cerr << e.what() << std::endl;
+                    }
+                }
+            }
         }
 
+        [[maybe_unused]] const uint64_t ui_start = timeline_available ? timeline_now() : 0;
         ImGui::SFML::Update(window, deltaClock.restart());
 
-        ImGui::Begin("Hello, world!");
-        ImGui::Button("Look at this pretty button");
+        // Snapshots are only taken while a debugger window is showing. Until the first one arrives, show power on state
+        emu.setSnapshotsWanted(snapshots_wanted);
+        snapshots_wanted = false;
+        snap = &emu.latest();
+        const bool running = snap->sequence == 0 || snap->running;
+
+        // Controller 1 on the keyboard: X and Z are A and B, right shift is select, enter is start
+        uint8_t pad = 0;
+        if (window.hasFocus() && !ImGui::GetIO().WantCaptureKeyboard) {
+            const sf::Keyboard::Key keys[8] = {sf::Keyboard::X, sf::Keyboard::Z, sf::Keyboard::RShift, sf::Keyboard::Enter,
+                                               sf::Keyboard::Up, sf::Keyboard::Down, sf::Keyboard::Left, sf::Keyboard::Right};
+            for (unsigned i = 0; i < 8; i++) {
+                if (sf::Keyboard::isKeyPressed(keys[i])) {
+                    pad = static_cast<uint8_t>(pad | (1u << i));
+                }
+            }
+        }
+        emu.setButtons(0, pad);
+
+        snapshots_wanted |= ImGui::Begin("CPU");
+        if (ImGui::Button(running ? "Pause" : "Continue")) {
+            emu.setRunning(!running);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Step")) {
+            emu.step();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Reset")) {
+            emu.post([](Console &c) { c.reset(); });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Save imnes.state")) {
+            emu.post([](Console &c) {
+                try {
+                    machine_state state;
+                    c.saveState(state);
+                    save_machine_state("imnes.state", state);
+                } catch (const std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load imnes.state")) {
+            emu.post([](Console &c) {
+                try {
+                    machine_state state;
+                    load_machine_state("imnes.state", state);
+                    c.loadState(state);
+                } catch (const std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            });
+        }
+        static bool rewind_enabled = false;
+        if (ImGui::Checkbox("Rewind", &rewind_enabled)) {
+            emu.enableRewind(rewind_enabled ? 32u << 20u : 0);
+        }
+        ImGui::SameLine();
+        ImGui::Button("Hold to rewind");
+        static bool rewinding = false;
+        if (ImGui::IsItemActive() != rewinding) {
+            rewinding = !rewinding;
+            emu.setRewinding(rewinding);
+        }
+        if (snap->rewind_enabled) {
+            const auto &r = snap->rewind;
+            ImGui::Text("Rewind %.1f s  %.1f/%.0f MB  capture %.2f us  compress %.1f us  dropped %llu", static_cast<double>(r.frames) / 60.0988,
+                        static_cast<double>(r.bytes_used) / (1 << 20), static_cast<double>(r.capacity) / (1 << 20),
+                        static_cast<double>(r.capture_time.count()) / 1e3, static_cast<double>(r.compress_time.count()) / 1e3,
+                        static_cast<unsigned long long>(r.dropped));
+        }
+        static int run_ahead = 0;
+        static bool second_instance = false;
+        bool run_ahead_changed = ImGui::SliderInt("Run ahead", &run_ahead, 0, RunAhead::max_frames);
+        ImGui::SameLine();
+        run_ahead_changed |= ImGui::Checkbox("Second instance", &second_instance);
+        if (run_ahead_changed) {
+            emu.setRunAhead(static_cast<unsigned>(run_ahead), second_instance ? RunAhead::mode::SECOND_INSTANCE : RunAhead::mode::SINGLE_INSTANCE);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Measure input lag")) {
+            emu.measureInputLag();
+        }
+        if (snap->input_lag > 0) {
+            // The frame with the input in has to be run before anything can show, so one frame is the least there can be
+            const int shown = std::max(snap->input_lag - static_cast<int>(snap->run_ahead_frames), 1);
+            const double saved_ms = (snap->input_lag - shown) * 1000.0 / 60.0988;
+            ImGui::Text("Input lag %d frames, %d shown (%.1f ms saved)  run ahead %.2f ms/frame", snap->input_lag, shown, saved_ms,
+                        static_cast<double>(snap->run_ahead_cost.count()) / 1e6);
+        }
+        if (ImGui::Button("Record imnes.movie")) {
+            emu.recordMovie("imnes.movie", false);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Append")) {
+            emu.recordMovie("imnes.movie", true);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Play")) {
+            emu.playMovie("imnes.movie");
+        }
+        if (snap->recording_movie || snap->playing_movie) {
+            ImGui::SameLine();
+            if (ImGui::Button("Stop movie")) {
+                emu.stopMovie();
+            }
+        }
+        if (snap->recording_movie) {
+            ImGui::Text("Recording frame %llu", static_cast<unsigned long long>(snap->movie_frames));
+        } else if (snap->playing_movie) {
+            int frame = static_cast<int>(snap->movie_position);
+            if (ImGui::SliderInt("Movie frame", &frame, 0, static_cast<int>(snap->movie_frames))) {
+                emu.seekMovie(static_cast<uint64_t>(frame));
+            }
+            if (snap->movie_desync < snap->movie_frames) {
+                ImGui::Text("Desynced at frame %llu", static_cast<unsigned long long>(snap->movie_desync));
+            }
+        }
+        // The trace is a mapped file, so it still has the last instructions if we crash
+        static bool tracing = false;
+        if (ImGui::Checkbox("Trace to imnes.trace", &tracing)) {
+            emu.post([enable = tracing](Console &c) {
+                c.setTrace(nullptr);
+                trace.reset();
+                if (enable) {
+                    try {
+                        trace = std::make_unique<TraceBuffer>("imnes.trace", 1u << 22u);
+                        c.setTrace(trace.get());
+                    } catch (const std::exception &e) {
+                        std::cerr << e.what() << std::endl;
+                    }
+                }
+            });
+        }
+        if constexpr ((Console::available_features & Console::CDL) != 0) {
+            static bool logging = false;
+            if (ImGui::Checkbox("Code/data log", &logging)) {
+                emu.post([enable = logging](Console &c) { c.setCodeDataLog(enable ? &cdl : nullptr); });
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Save test_image.cdl")) {
+                emu.post([](Console &) {
+                    try {
+                        cdl.save("test_image.cdl");
+                    } catch (const std::exception &e) {
+                        std::cerr << e.what() << std::endl;
+                    }
+                });
+            }
+        }
+        const Cpu6502 &cpu = snap->cpu;
+        ImGui::Text("PC %04X  A %02X  X %02X  Y %02X  S %02X  P %02X", cpu.pc, cpu.a, cpu.x, cpu.y, cpu.s, cpu.p);
+        ImGui::Text("Cycle %llu  Frame %llu", static_cast<unsigned long long>(snap->cycles), static_cast<unsigned long long>(snap->ppu.frame));
+        if (snap->at_breakpoint) {
+            const auto &b = snap->last_break;
+            ImGui::Text("Last break %s $%04X", b.space == Breakpoints::space::CPU ? "CPU" : "PPU", b.addr);
+        }
+        ImGui::End();
+
+        snapshots_wanted |= ImGui::Begin("Profiler");
+        static bool profiling = false;
+        if (ImGui::Checkbox("Profile", &profiling)) {
+            emu.post([enable = profiling](Console &c) { c.setProfiler(enable ? &profiler : nullptr); });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            emu.post([](Console &) { profiler.clear(); });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Save imnes.folded")) {
+            emu.post([](Console &) {
+                try {
+                    profiler.saveFolded("imnes.folded");
+                } catch (const std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            });
+        }
+        if (!snap->call_tree.empty()) {
+            // Hottest call stacks by inclusive cycles
+            const auto &tree = snap->call_tree;
+            std::vector<uint32_t> order(tree.size());
+            for (uint32_t i = 0; i < order.size(); i++) {
+                order[i] = i;
+            }
+            const size_t shown = std::min<size_t>(order.size(), 20);
+            std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(shown), order.end(),
+                              [&tree](uint32_t l, uint32_t r) { return tree[l].inclusive > tree[r].inclusive; });
+            const double total = static_cast<double>(std::max<uint64_t>(tree[0].inclusive, 1));
+            for (size_t i = 0; i < shown; i++) {
+                const auto &n = tree[order[i]];
+                char name[16];
+                Profiler::formatName(n, name, sizeof(name));
+                ImGui::Text("%-10s incl %5.1f%%  excl %5.1f%%  calls %llu", name, 100.0 * static_cast<double>(n.inclusive) / total,
+                            100.0 * static_cast<double>(n.exclusive) / total, static_cast<unsigned long long>(n.calls));
+            }
+        }
+        ImGui::End();
+
+        snapshots_wanted |= ImGui::Begin("Breakpoints");
+        static char bp_addr[8] = "";
+        static char bp_condition[128] = "";
+        static std::string bp_error;
+        ImGui::InputText("Address", bp_addr, sizeof(bp_addr), ImGuiInputTextFlags_CharsHexadecimal);
+        ImGui::InputText("Condition", bp_condition, sizeof(bp_condition));
+        if (ImGui::Button("Add")) {
+            try {
+                const auto addr = static_cast<uint16_t>(std::stoul(bp_addr, nullptr, 16));
+                // Parse here as well, so that errors are reported straight away
+                const std::string condition = bp_condition;
+                if (!condition.empty()) {
+                    BreakpointCondition check(condition);
+                }
+                emu.post([addr, condition](Console &c) {
+                    if (!condition.empty()) {
+                        c.setCondition(Breakpoints::space::CPU, addr, condition);
+                    } else {
+                        c.clearCondition(Breakpoints::space::CPU, addr);
+                    }
+                    c.setBreakpoint(Breakpoints::space::CPU, addr, Breakpoints::EXECUTE);
+                });
+                breakpoints.set(Breakpoints::space::CPU, addr, Breakpoints::EXECUTE);
+                bp_error.clear();
+            } catch (const std::exception &e) {
+                bp_error = e.what();
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear all")) {
+            emu.post([](Console &c) { c.clearAllBreakpoints(); });
+            breakpoints.clearAll();
+        }
+        if (!bp_error.empty()) {
+            ImGui::TextUnformatted(bp_error.c_str());
+        }
+        for (const auto &entry : snap->conditions) {
+            const double avg_ns = entry.hits ? static_cast<double>(entry.eval_time.count()) / static_cast<double>(entry.hits) : 0.0;
+            ImGui::Text("$%04X  %s  hits %llu  true %llu  %.0f ns/eval", entry.addr, entry.text.c_str(),
+                        static_cast<unsigned long long>(entry.hits), static_cast<unsigned long long>(entry.passes), avg_ns);
+        }
         ImGui::End();
 
-        //ImGui::Begin("Test");
-        ImGui::ShowDemoWindow();
-        //ImGui::End();
+        // What the core is doing, per frame, over the last few seconds
+        snapshots_wanted |= ImGui::Begin("Performance");
+        if constexpr (perf_counters_available) {
+            static bool counting = perf_json != nullptr;
+            if (ImGui::Checkbox("Count", &counting)) {
+                emu.post([enable = counting](Console &c) { c.setPerfCounters(enable ? &counters : nullptr); });
+            }
+            ImGui::SameLine();
+        }
+        // Reading the clock twice an instruction slows the run down, so this is off unless asked for
+        static bool timing = false;
+        if (ImGui::Checkbox("Time components", &timing)) {
+            emu.post([enable = timing](Console &c) { c.setComponentTimes(enable ? &times : nullptr); });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            emu.post([](Console &) {
+                counters = {};
+                times = {};
+            });
+        }
+        // The history is made from the change between snapshots, which may be more than a frame apart
+        static constexpr size_t history = 240;
+        static std::array<float, history> frame_ms{};
+        static std::array<float, history> instructions_per_frame{};
+        static std::array<float, history> accesses_per_frame{};
+        static size_t history_pos = 0;
+        static uint64_t last_sequence = 0;
+        static uint64_t last_frame = 0;
+        static perf_counters last_counters;
+        if (snap->sequence != last_sequence) {
+            const auto since_last = [](uint64_t now, uint64_t before) { return static_cast<float>(now >= before ? now - before : 0); };
+            const auto accesses = [](const perf_counters &c) {
+                uint64_t n = 0;
+                for (size_t i = 0; i < c.reads.size(); i++) {
+                    n += c.reads[i] + c.writes[i];
+                }
+                return n;
+            };
+            if (last_sequence != 0 && snap->ppu.frame > last_frame) {
+                const auto frames = static_cast<float>(snap->ppu.frame - last_frame);
+                frame_ms[history_pos] = static_cast<float>(snap->frame_time.count()) / 1e6f;
+                instructions_per_frame[history_pos] = since_last(snap->counters.instructions, last_counters.instructions) / frames;
+                accesses_per_frame[history_pos] = since_last(accesses(snap->counters), accesses(last_counters)) / frames;
+                history_pos = (history_pos + 1) % history;
+            }
+            last_sequence = snap->sequence;
+            last_frame = snap->ppu.frame;
+            last_counters = snap->counters;
+        }
+        const size_t newest = (history_pos + history - 1) % history;
+        const int n = static_cast<int>(history);
+        const int offset = static_cast<int>(history_pos);
+        char overlay[32];
+        std::snprintf(overlay, sizeof(overlay), "%.2f ms", static_cast<double>(frame_ms[newest]));
+        ImGui::PlotLines("Frame time", frame_ms.data(), n, offset, overlay, 0.0f, 16.64f, ImVec2(0, 60));
+        std::snprintf(overlay, sizeof(overlay), "%.0f", static_cast<double>(instructions_per_frame[newest]));
+        ImGui::PlotLines("Instructions/frame", instructions_per_frame.data(), n, offset, overlay, 0.0f, FLT_MAX, ImVec2(0, 60));
+        std::snprintf(overlay, sizeof(overlay), "%.0f", static_cast<double>(accesses_per_frame[newest]));
+        ImGui::PlotLines("Bus accesses/frame", accesses_per_frame.data(), n, offset, overlay, 0.0f, FLT_MAX, ImVec2(0, 60));
+        const perf_counters &pc = snap->counters;
+        ImGui::Text("Instructions %llu  cycles %llu  (%.2f cycles each)", static_cast<unsigned long long>(pc.instructions),
+                    static_cast<unsigned long long>(pc.cycles),
+                    pc.instructions ? static_cast<double>(pc.cycles) / static_cast<double>(pc.instructions) : 0.0);
+        ImGui::Text("NMIs %llu  OAM DMAs %llu", static_cast<unsigned long long>(pc.nmis), static_cast<unsigned long long>(pc.oam_dmas));
+        for (size_t i = 0; i < pc.reads.size(); i++) {
+            ImGui::Text("%-9s reads %12llu  writes %12llu", page_type_name(static_cast<Bus::page_type>(i)),
+                        static_cast<unsigned long long>(pc.reads[i]), static_cast<unsigned long long>(pc.writes[i]));
+        }
+        if (snap->times.samples != 0) {
+            const double total = static_cast<double>((snap->times.cpu + snap->times.ppu).count());
+            ImGui::Text("CPU %.1f%%  PPU %.1f%% of emulation time", 100.0 * static_cast<double>(snap->times.cpu.count()) / total,
+                        100.0 * static_cast<double>(snap->times.ppu.count()) / total);
+        }
+        ImGui::End();
 
         static MemoryEditor mem_edit_1;
-        mem_edit_1.DrawWindow("Memory Editor", ines.getPrgRom().data(), ines.getPrgRom().size(), 0x0000);
+        mem_edit_1.WriteFn = write_prg;
+        mem_edit_1.DrawWindow("Memory Editor", prg_view.data(), prg_view.size(), prg_base);
+
+        // CPU RAM, colored by how busy each byte is. Recent writes are red, reads blue and execution green
+        snapshots_wanted |= ImGui::Begin("RAM");
+        static bool show_heat = false;
+        if (ImGui::Checkbox("Access heatmap", &show_heat)) {
+            emu.post([enable = show_heat](Console &c) {
+                heatmap.clear();
+                c.setAccessHeatmap(enable ? &heatmap : nullptr);
+            });
+        }
+        static MemoryEditor ram_edit;
+        ram_edit.BgColorFn = [](const ImU8 *, size_t off) -> ImU32 {
+            if (snap->write_heat.empty()) {
+                return 0;
+            }
+            // Counts decay by an eighth a frame, so they settle at about 8x the per frame rate
+            auto scale = [](uint32_t count) { return static_cast<ImU32>(std::min(255.0, 40.0 * std::log2(1.0 + count))); };
+            const ImU32 r = snap->write_heat[off];
+            const ImU32 g = scale(snap->heat_executes[off]);
+            const ImU32 b = scale(snap->heat_reads[off]);
+            const ImU32 a = std::max({r, g, b}) / 2;
+            return a == 0 ? 0 : IM_COL32(r, g, b, a);
+        };
+        ram_edit.WriteFn = [](ImU8 *data, size_t off, ImU8 d) {
+            data[off] = d;
+            emu.post([off, d](Console &c) { c.bus.write(static_cast<uint16_t>(off), d); });
+        };
+        ram_view = snap->ram;
+        ram_edit.DrawContents(ram_view.data(), ram_view.size());
+        ImGui::End();
 
         static disassembly_view disasm_view;
-        disasm_view.DrawWindow("Disassembly view", ines.getPrgRom().data(), ines.getPrgRom().size(), 0x0000);
+        disasm_view.WriteFn = write_prg;
+        disasm_view.Analysis = &analyser.latest();
+        // Rebuilding the rows means a pass over the ROM, so only pick up new log results twice a second
+        disasm_view.CodeDataFlags = snap->cdl_prg.empty() ? nullptr : snap->cdl_prg.data();
+        disasm_view.CodeDataGeneration = snap->ppu.frame / 30;
+        disasm_view.CycleCounts = snap->cycles_at.empty() ? nullptr : snap->cycles_at.data();
+        disasm_view.CycleCountMax = snap->cycles_at_max;
+        disasm_view.BreakpointFn = [](size_t addr) {
+            return breakpoints.testCpu(static_cast<uint16_t>(addr), Breakpoints::EXECUTE);
+        };
+        disasm_view.ToggleBreakpointFn = [](size_t addr) {
+            const auto a = static_cast<uint16_t>(addr);
+            if (breakpoints.testCpu(a, Breakpoints::EXECUTE)) {
+                breakpoints.clear(Breakpoints::space::CPU, a, Breakpoints::EXECUTE);
+                emu.post([a](Console &c) { c.clearBreakpoint(Breakpoints::space::CPU, a, Breakpoints::EXECUTE); });
+            } else {
+                breakpoints.set(Breakpoints::space::CPU, a, Breakpoints::EXECUTE);
+                emu.post([a](Console &c) { c.setBreakpoint(Breakpoints::space::CPU, a, Breakpoints::EXECUTE); });
+            }
+        };
+        disasm_view.CurrentAddr = running ? std::numeric_limits<std::size_t>::max() : snap->cpu.pc;
+        disasm_view.DrawWindow("Disassembly view", prg_view.data(), prg_view.size(), prg_base);
+        snapshots_wanted |= disasm_view.Visible;
+
 
+        if constexpr (timeline_available) {
+            timeline_record("ui", ui_start, timeline_now());
+        }
 
-        window.clear();
-        window.draw(shape);
-        ImGui::SFML::Render(window);
-        window.display();
+        {
+            IMNES_ZONE("imgui draw");
+            window.clear();
+            window.draw(shape);
+            ImGui::SFML::Render(window);
+        }
+        {
+            IMNES_ZONE("present");
+            window.display();
+        }
     }
 
     ImGui::SFML::Shutdown();
 
+    // Written on the emulation thread, as that is where the counters are updated
+    if (perf_json) {
+        std::promise<void> written;
+        emu.post([&written, perf_json](Console &c) {
+            if (FILE *f = std::fopen(perf_json, "w")) {
+                if (!write_perf_counters_json(f, counters, c.componentTimes())) {
+                    std::cerr << "Error writing " << perf_json << std::endl;
+                }
+                // Closed whether the write worked or not
+                if (std::fclose(f) != 0) {
+                    std::cerr << "Error closing " << perf_json << std::endl;
+                }
+            } else {
+                std::cerr << "Could not open " << perf_json << std::endl;
+            }
+            written.set_value();
+        });
+        written.get_future().wait();
+    }
+
     return 0;
 }
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include "console.h"
+#include "movie.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMNES_HAVE_MMAP 1
+#endif
+
+namespace {
+
+// Runs on through any breakpoints to the start of the next frame
+void runWholeFrame(Console &console) {
+    const uint64_t frame = console.ppu.frame;
+    while (console.ppu.frame == frame) {
+        console.runFrame();
+    }
+}
+
+// Length of a movie up to the end of this many frames, leaving out the keyframe after them if they fill their block
+uint64_t movieLength(uint64_t frames, uint32_t interval) {
+    const uint64_t block = sizeof(machine_state) + uint64_t{interval} * sizeof(movie_frame);
+    const uint64_t rem = frames % interval;
+    return sizeof(movie_header) + (frames / interval) * block + (rem != 0 ? sizeof(machine_state) + rem * sizeof(movie_frame) : 0);
+}
+
+}
+
+MovieRecorder::MovieRecorder(const std::filesystem::path &p, Console &c, uint32_t keyframe_interval)
+        : console(c), interval(std::max(keyframe_interval, 1u)) {
+    console.saveState(state);
+    file.open(p, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Could not create " + p.string());
+    }
+    movie_header h{};
+    std::memcpy(h.magic, magic, sizeof(h.magic));
+    h.version = version;
+    h.keyframe_interval = interval;
+    h.state_size = sizeof(machine_state);
+    h.frame_size = sizeof(movie_frame);
+    h.rom_hash = state.header.rom_hash;
+    write(&h, sizeof(h));
+    write(&state, sizeof(state));
+    flush();
+}
+
+MovieRecorder::MovieRecorder(append_tag, const std::filesystem::path &p, Console &c, uint32_t keyframe_interval, uint64_t frames)
+        : console(c), interval(keyframe_interval), frame_count(frames) {
+    // Drop any partly written frame or keyframe, so that appending carries straight on from the last whole frame
+    std::error_code ec;
+    std::filesystem::resize_file(p, movieLength(frames, interval), ec);
+    if (ec) {
+        throw std::runtime_error("Could not truncate " + p.string());
+    }
+    file.open(p, std::ios::binary | std::ios::app);
+    if (!file) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    if (frames % interval == 0) {
+        console.saveState(state);
+        write(&state, sizeof(state));
+        flush();
+    }
+}
+
+std::unique_ptr<MovieRecorder> MovieRecorder::append(const std::filesystem::path &p, Console &c) {
+    uint32_t keyframe_interval = 0;
+    uint64_t frames = 0;
+    {
+        MoviePlayer player(p);
+        player.seek(c, player.frames());
+        keyframe_interval = player.keyframeInterval();
+        frames = player.frames();
+    }
+    return std::unique_ptr<MovieRecorder>(new MovieRecorder(append_tag{}, p, c, keyframe_interval, frames));
+}
+
+void MovieRecorder::runFrame(const std::array<uint8_t, 2> &buttons) {
+    console.bus.buttons = buttons;
+    runWholeFrame(console);
+    console.saveState(state);
+    const movie_frame f{buttons, {}, state_hash(state)};
+    write(&f, sizeof(f));
+    frame_count++;
+    // The state at the end of this frame is the one the next block starts from
+    if (frame_count % interval == 0) {
+        write(&state, sizeof(state));
+        flush();
+    }
+}
+
+void MovieRecorder::flush() {
+    file.flush();
+    if (!file) {
+        throw std::runtime_error("Could not write movie");
+    }
+}
+
+void MovieRecorder::write(const void *data, size_t size) {
+    file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+    if (!file) {
+        throw std::runtime_error("Could not write movie");
+    }
+}
+
+MoviePlayer::MoviePlayer(const std::filesystem::path &p) {
+#ifdef IMNES_HAVE_MMAP
+    const int fd = ::open(p.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error(p.string() + " isn't a movie");
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    void *m = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        throw std::runtime_error("Could not map " + p.string());
+    }
+    bytes = {static_cast<const uint8_t *>(m), size};
+    // The destructor doesn't run if the constructor throws, so only keep the mapping once it's known to be a movie
+    try {
+        readHeader(p);
+    } catch (...) {
+        ::munmap(m, size);
+        throw;
+    }
+    mapping = m;
+#else
+    std::ifstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    memory.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    bytes = memory;
+    readHeader(p);
+#endif
+}
+
+void MoviePlayer::readHeader(const std::filesystem::path &p) {
+    if (bytes.size() < sizeof(hdr) + sizeof(machine_state)) {
+        throw std::runtime_error(p.string() + " isn't a movie");
+    }
+    std::memcpy(&hdr, bytes.data(), sizeof(hdr));
+    if (std::memcmp(hdr.magic, MovieRecorder::magic, sizeof(hdr.magic)) != 0) {
+        throw std::runtime_error(p.string() + " isn't a movie");
+    }
+    if (hdr.version != MovieRecorder::version || hdr.state_size != sizeof(machine_state) || hdr.frame_size != sizeof(movie_frame) ||
+        hdr.keyframe_interval == 0) {
+        throw std::runtime_error(p.string() + " is from a different version of imnes");
+    }
+    // The recorder may have been stopped part way through writing a frame or keyframe
+    const size_t body = bytes.size() - sizeof(hdr);
+    const size_t rem = body % blockSize();
+    keyframes = body / blockSize() + (rem >= sizeof(machine_state) ? 1 : 0);
+    frame_count = (body / blockSize()) * hdr.keyframe_interval + (rem >= sizeof(machine_state) ? (rem - sizeof(machine_state)) / sizeof(movie_frame) : 0);
+    first_desync = frame_count;
+}
+
+MoviePlayer::~MoviePlayer() {
+#ifdef IMNES_HAVE_MMAP
+    if (mapping) {
+        ::munmap(mapping, bytes.size());
+    }
+#endif
+}
+
+const movie_frame &MoviePlayer::frame(uint64_t i) const {
+    const uint64_t interval = hdr.keyframe_interval;
+    const size_t offset = sizeof(hdr) + (i / interval) * blockSize() + sizeof(machine_state) + (i % interval) * sizeof(movie_frame);
+    return *reinterpret_cast<const movie_frame *>(bytes.data() + offset);
+}
+
+bool MoviePlayer::seek(Console &console, uint64_t i) {
+    if (i > frame_count) {
+        throw std::runtime_error("Seek past the end of the movie");
+    }
+    const uint64_t k = std::min<uint64_t>(i / hdr.keyframe_interval, keyframes - 1);
+    std::memcpy(&state, bytes.data() + sizeof(hdr) + k * blockSize(), sizeof(state));
+    console.loadState(state);
+    pos = k * hdr.keyframe_interval;
+    first_desync = frame_count;
+    bool matched = true;
+    while (pos < i) {
+        matched &= runFrame(console);
+    }
+    return matched;
+}
+
+bool MoviePlayer::runFrame(Console &console) {
+    if (finished()) {
+        throw std::runtime_error("The movie has ended");
+    }
+    const movie_frame &f = frame(pos);
+    console.bus.buttons = f.buttons;
+    runWholeFrame(console);
+    console.saveState(state);
+    const bool matched = state_hash(state) == f.state_hash;
+    if (!matched) {
+        first_desync = std::min(first_desync, pos);
+    }
+    pos++;
+    return matched;
+}
@@ -0,0 +1,138 @@
+#ifndef IMNES_MOVIE_H
+#define IMNES_MOVIE_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "machine_state.h"
+
+class Console;
+
+// Input movies: the buttons for every frame, so a run can be played back exactly
+// Like an .fm2 the movie is a header and a list of frames, but binary so that it can be mapped rather than parsed.
+// A save state is stored every keyframe_interval frames, and the frames after it follow it, so the file is a run of
+// equal sized blocks:
+//   movie_header
+//   machine_state at frame 0,  movie_frame 0 .. interval - 1
+//   machine_state at frame interval,  movie_frame interval .. 2 * interval - 1
+//   ...
+// Where any frame is can be worked out from its number, so seeking needs no index beyond the layout itself, and the
+// recorder only ever appends. A file cut short (by a crash, say) is good up to its last whole frame
+// Each frame also has the hash of the machine after it, so playback notices the moment it stops matching
+struct movie_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t keyframe_interval;
+    uint32_t state_size;    // sizeof(machine_state)
+    uint32_t frame_size;    // sizeof(movie_frame)
+    uint64_t rom_hash;
+    uint8_t reserved[32];
+};
+static_assert(sizeof(movie_header) == 64 && std::is_trivially_copyable_v<movie_header>);
+
+struct movie_frame
+{
+    std::array<uint8_t, 2> buttons;  // Controllers 1 and 2, see bus_state::buttons
+    std::array<uint8_t, 6> reserved;
+    uint64_t state_hash;             // state_hash() of the machine at the end of the frame
+};
+static_assert(sizeof(movie_frame) == 16 && std::is_trivially_copyable_v<movie_frame>);
+
+// Runs a console a frame at a time, writing a movie of it
+// Frames run to the end whatever breakpoints are set, so that what is recorded is always a whole frame
+class MovieRecorder {
+public:
+    static constexpr char magic[8] = {'I', 'M', 'N', 'M', 'O', 'V', 'I', 'E'};
+    static constexpr uint32_t version = 3;
+
+    // Starts a new movie from where the console is now (power on, or anywhere else)
+    // N.B. throws runtime_error if the file can't be written, or for flat images, which have no save states
+    MovieRecorder(const std::filesystem::path &p, Console &console, uint32_t keyframe_interval = 600);
+
+    // Carries on recording the movie in p: puts console at its last frame, and drops anything after that
+    // N.B. throws runtime_error as MoviePlayer's constructor and seek() do, or if the file can't be written
+    static std::unique_ptr<MovieRecorder> append(const std::filesystem::path &p, Console &console);
+
+    MovieRecorder(const MovieRecorder &) = delete;
+    MovieRecorder &operator=(const MovieRecorder &) = delete;
+
+    // Runs one frame holding buttons, and records it
+    // N.B. throws runtime_error if the file can't be written
+    void runFrame(const std::array<uint8_t, 2> &buttons);
+
+    // Makes sure everything recorded so far is in the file, for something else to read. Done at every keyframe anyway
+    void flush();
+
+    uint64_t frames() const { return frame_count; }
+
+private:
+    struct append_tag
+    {
+    };
+    MovieRecorder(append_tag, const std::filesystem::path &p, Console &console, uint32_t keyframe_interval, uint64_t frames);
+
+    void write(const void *data, size_t size);
+
+    Console &console;
+    std::ofstream file;
+    uint32_t interval;
+    uint64_t frame_count = 0;
+    machine_state state{};
+};
+
+// Plays a movie back on a console, and moves about in it
+// The file is memory mapped where that's supported, so opening even a long movie is quick
+class MoviePlayer {
+public:
+    // N.B. throws runtime_error if the file can't be read or isn't a movie from this version of imnes
+    explicit MoviePlayer(const std::filesystem::path &p);
+    ~MoviePlayer();
+    MoviePlayer(const MoviePlayer &) = delete;
+    MoviePlayer &operator=(const MoviePlayer &) = delete;
+
+    uint64_t frames() const { return frame_count; }
+    uint32_t keyframeInterval() const { return hdr.keyframe_interval; }
+    uint64_t romHash() const { return hdr.rom_hash; }
+    const movie_frame &frame(uint64_t i) const;
+
+    // Puts the console at the start of frame i (or at the end with i == frames()) by loading the keyframe before it
+    // and replaying at most keyframe_interval frames. Returns false if a replayed frame didn't match its hash
+    // N.B. throws runtime_error if i is past the end, or the movie is for a different ROM
+    bool seek(Console &console, uint64_t i);
+
+    // Runs the next frame with its recorded buttons. Returns false if the machine then doesn't match the recording
+    // N.B. throws runtime_error past the end
+    bool runFrame(Console &console);
+
+    uint64_t position() const { return pos; }
+    bool finished() const { return pos >= frame_count; }
+
+    // The first frame that didn't match, or frames() if they all have so far
+    uint64_t firstDesync() const { return first_desync; }
+
+private:
+    // Checks the header of bytes and works out the frame and keyframe counts
+    // N.B. throws runtime_error if it isn't a movie from this version of imnes
+    void readHeader(const std::filesystem::path &p);
+    size_t blockSize() const { return sizeof(machine_state) + size_t{hdr.keyframe_interval} * sizeof(movie_frame); }
+
+    std::span<const uint8_t> bytes;
+    void *mapping = nullptr;
+    std::vector<uint8_t> memory; // Where there's no mmap
+    movie_header hdr{};
+    uint64_t frame_count = 0;
+    uint64_t keyframes = 0;
+    uint64_t pos = 0;
+    uint64_t first_desync = 0;
+    machine_state state{};
+};
+
+
+#endif //IMNES_MOVIE_H
@@ -0,0 +1,41 @@
+#include "perf_counters.h"
+
+const char *page_type_name(Bus::page_type t) {
+    switch (t) {
+        case Bus::page_type::RAM:
+            return "ram";
+        case Bus::page_type::PRG_RAM:
+            return "prg_ram";
+        case Bus::page_type::PRG_ROM:
+            return "prg_rom";
+        case Bus::page_type::IO:
+            return "io";
+        case Bus::page_type::OPEN_BUS:
+            return "open_bus";
+    }
+    return "unknown";
+}
+
+bool write_perf_counters_json(FILE *f, const perf_counters &c, const component_times *times) {
+    std::fprintf(f, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"nmis\": %llu,\n  \"oam_dmas\": %llu,\n",
+                 static_cast<unsigned long long>(c.instructions), static_cast<unsigned long long>(c.cycles),
+                 static_cast<unsigned long long>(c.nmis), static_cast<unsigned long long>(c.oam_dmas));
+    const auto by_page_type = [f](const char *name, const auto &counts) {
+        std::fprintf(f, "  \"%s\": {", name);
+        for (size_t i = 0; i < counts.size(); i++) {
+            std::fprintf(f, "%s\"%s\": %llu", i ? ", " : "", page_type_name(static_cast<Bus::page_type>(i)),
+                         static_cast<unsigned long long>(counts[i]));
+        }
+        std::fprintf(f, "},\n");
+    };
+    by_page_type("reads", c.reads);
+    by_page_type("writes", c.writes);
+    if (times) {
+        std::fprintf(f, "  \"component_ns\": {\"cpu\": %lld, \"ppu\": %lld, \"samples\": %llu}\n}\n",
+                     static_cast<long long>(times->cpu.count()), static_cast<long long>(times->ppu.count()),
+                     static_cast<unsigned long long>(times->samples));
+    } else {
+        std::fprintf(f, "  \"component_ns\": null\n}\n");
+    }
+    return std::ferror(f) == 0;
+}
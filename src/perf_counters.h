@@ -0,0 +1,49 @@
+#ifndef IMNES_PERF_COUNTERS_H
+#define IMNES_PERF_COUNTERS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "bus.h"
+
+// Wall time the run loop spends in each part of the machine
+// There is no APU yet, and NROM's mapping is just the bus page tables, so the CPU's time includes the bus
+struct component_times
+{
+    std::chrono::nanoseconds cpu{};  // Instructions, and the bus accesses they make
+    std::chrono::nanoseconds ppu{};
+    uint64_t samples = 0;            // Instructions timed. cpu and ppu each include one clock read per sample
+};
+
+#ifdef IMNES_ENABLE_PERF_COUNTERS
+static constexpr bool perf_counters_available = true;
+#else
+static constexpr bool perf_counters_available = false;
+#endif
+
+// Counts of the work the core does, kept by the run loop while attached to a console
+// Only built in with IMNES_ENABLE_PERF_COUNTERS. Without it there is no trace of them in the run loop
+struct perf_counters
+{
+    uint64_t instructions = 0;  // Including interrupt entries
+    uint64_t cycles = 0;        // CPU cycles, including those taken by OAM DMA
+    // Events the run loop handles between instructions
+    uint64_t nmis = 0;
+    uint64_t oam_dmas = 0;
+    // CPU bus accesses by Bus::page_type. Instruction fetches count as reads
+    // There are no banking mappers yet, but writes to PRG_ROM are where their bank switches would land
+    std::array<uint64_t, Bus::page_type_count> reads{};
+    std::array<uint64_t, Bus::page_type_count> writes{};
+};
+
+// Name of a Bus::page_type, as used in the JSON
+const char *page_type_name(Bus::page_type t);
+
+// The counters as a JSON object, with the component times if there are any
+// N.B. returns false on a write error
+bool write_perf_counters_json(FILE *f, const perf_counters &c, const component_times *times);
+
+
+#endif //IMNES_PERF_COUNTERS_H
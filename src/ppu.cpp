@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cstring>
+
+#include "ppu.h"
+#include "timeline.h"
+
+void Ppu::powerOn(const uint8_t *chr, size_t chr_size, Ines::Mirroring m) {
+    *this = Ppu{};
+    chr_rom = chr_size ? chr : nullptr;
+    chr_rom_size = chr_size;
+    mirroring = m;
+}
+
+uint16_t Ppu::nametableIndex(uint16_t addr) const {
+    // https://wiki.nesdev.com/w/index.php/Mirroring#Nametable_Mirroring
+    // We only have 2K of VRAM, so four screen is treated as vertical until a mapper provides the extra RAM
+    const uint16_t offset = addr & 0x3FFu;
+    const uint16_t table = (addr >> 10u) & 0x3u;
+    switch (mirroring) {
+        case Ines::Mirroring::HORIZONTAL: return static_cast<uint16_t>(((table >> 1u) << 10u) | offset);
+        case Ines::Mirroring::VERTICAL:
+        case Ines::Mirroring::FOUR_SCREEN: break;
+    }
+    return static_cast<uint16_t>(((table & 1u) << 10u) | offset);
+}
+
+uint8_t Ppu::read(uint16_t addr) const {
+    addr &= 0x3FFFu;
+    if (addr < 0x2000) {
+        return chr_rom ? chr_rom[addr % chr_rom_size] : chr_ram.read(addr);
+    }
+    if (addr < 0x3F00) {
+        return vram[nametableIndex(addr)];
+    }
+    // $3F10/$3F14/$3F18/$3F1C mirror $3F00/$3F04/$3F08/$3F0C
+    uint16_t index = addr & 0x1Fu;
+    if ((index & 0x13u) == 0x10u) {
+        index &= 0x0Fu;
+    }
+    return palette[index];
+}
+
+void Ppu::copyPatternTables(std::span<uint8_t> out) const {
+    if (!chr_rom) {
+        chr_ram.copyTo(out);
+        return;
+    }
+    // Smaller CHR ROMs repeat, as read() has them
+    for (size_t i = 0; i < 0x2000; i += chr_rom_size) {
+        std::memcpy(out.data() + i, chr_rom, std::min<size_t>(chr_rom_size, 0x2000 - i));
+    }
+}
+
+void Ppu::write(uint16_t addr, uint8_t value) {
+    addr &= 0x3FFFu;
+    if (addr < 0x2000) {
+        if (!chr_rom) {
+            chr_ram.write(addr, value);
+        }
+        return;
+    }
+    if (addr < 0x3F00) {
+        vram[nametableIndex(addr)] = value;
+        return;
+    }
+    uint16_t index = addr & 0x1Fu;
+    if ((index & 0x13u) == 0x10u) {
+        index &= 0x0Fu;
+    }
+    palette[index] = value;
+}
+
+uint8_t Ppu::readRegister(uint16_t addr) {
+    switch (addr & 0x7u) {
+        case 2: {
+            // Reading status clears vblank and the write toggle
+            open_bus = static_cast<uint8_t>((status & 0xE0u) | (open_bus & 0x1Fu));
+            status &= 0x7Fu;
+            w = false;
+            break;
+        }
+        case 4:
+            open_bus = oam[oam_addr];
+            break;
+        case 7: {
+            // Reads are buffered, except for the palette
+            const uint16_t a = dataAddress();
+            if (a >= 0x3F00) {
+                open_bus = read(a);
+                read_buffer = read(static_cast<uint16_t>(a - 0x1000));
+            } else {
+                open_bus = read_buffer;
+                read_buffer = read(a);
+            }
+            v = static_cast<uint16_t>(v + ((ctrl & 0x04u) ? 32 : 1));
+            break;
+        }
+        default:
+            // Write only registers return whatever was last on the bus
+            break;
+    }
+    return open_bus;
+}
+
+void Ppu::writeRegister(uint16_t addr, uint8_t value) {
+    open_bus = value;
+    switch (addr & 0x7u) {
+        case 0:
+            // Enabling NMI during vblank raises one straight away
+            if (!(ctrl & 0x80u) && (value & 0x80u) && (status & 0x80u)) {
+                nmi_edge = true;
+            }
+            ctrl = value;
+            t = static_cast<uint16_t>((t & 0xF3FFu) | ((value & 0x3u) << 10u));
+            break;
+        case 1:
+            mask = value;
+            break;
+        case 3:
+            oam_addr = value;
+            break;
+        case 4:
+            oam[oam_addr++] = value;
+            break;
+        case 5:
+            if (!w) {
+                t = static_cast<uint16_t>((t & 0xFFE0u) | (value >> 3u));
+                fine_x = value & 0x7u;
+            } else {
+                t = static_cast<uint16_t>((t & 0x8C1Fu) | ((value & 0x7u) << 12u) | ((value & 0xF8u) << 2u));
+            }
+            w = !w;
+            break;
+        case 6:
+            if (!w) {
+                t = static_cast<uint16_t>((t & 0x00FFu) | ((value & 0x3Fu) << 8u));
+            } else {
+                t = static_cast<uint16_t>((t & 0xFF00u) | value);
+                v = t;
+            }
+            w = !w;
+            break;
+        case 7:
+            write(dataAddress(), value);
+            v = static_cast<uint16_t>(v + ((ctrl & 0x04u) ? 32 : 1));
+            break;
+        default:
+            break;
+    }
+}
+
+void Ppu::tick(unsigned dots) {
+    dot = static_cast<uint16_t>(dot + dots);
+    while (dot >= dots_per_scanline) {
+#ifdef IMNES_ENABLE_TIMELINE
+        if (timeline_scanlines.load(std::memory_order_relaxed)) {
+            const uint64_t now = timeline_now();
+            timeline_record("scanline", scanline_start, now);
+            scanline_start = now;
+        }
+#endif
+        dot = static_cast<uint16_t>(dot - dots_per_scanline);
+        scanline++;
+        if (scanline == vblank_scanline) {
+            // Strictly this happens on dot 1, scanline granularity is good enough for now
+            status |= 0x80u;
+            nmi_edge |= (ctrl & 0x80u) != 0;
+        } else if (scanline == prerender_scanline) {
+            status &= 0x1Fu;
+        } else if (scanline == scanlines_per_frame) {
+            scanline = 0;
+            frame++;
+        }
+    }
+}
+
+void Ppu::copyUnshared(const Ppu &other) {
+    static_cast<ppu_state &>(*this) = other;
+    chr_rom = other.chr_rom;
+    chr_rom_size = other.chr_rom_size;
+    mirroring = other.mirroring;
+    std::array<uint8_t, 0x2000> chr{};
+    other.chr_ram.copyTo(chr);
+    chr_ram.copyFrom(chr);
+}
+
+void Ppu::resumeTimeline() {
+#ifdef IMNES_ENABLE_TIMELINE
+    if (timeline_scanlines.load(std::memory_order_relaxed)) {
+        scanline_start = timeline_now();
+    }
+#endif
+}
@@ -0,0 +1,94 @@
+#ifndef IMNES_PPU_H
+#define IMNES_PPU_H
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include "cow_memory.h"
+#include "ines.h"
+
+// Everything about the PPU that changes as it runs, apart from CHR RAM. There are no pointers, so it can be copied as is
+// in to a save state
+struct ppu_state
+{
+    // Largest first, so that the only padding is at the end, where it is spelt out (see machine_state)
+    uint64_t frame = 0;
+    uint16_t scanline = 0;
+    uint16_t dot = 0;
+
+    // Internal registers https://wiki.nesdev.com/w/index.php/PPU_scrolling#PPU_internal_registers
+    uint16_t v = 0;
+    uint16_t t = 0;
+    uint8_t fine_x = 0;
+    bool w = false;
+    uint8_t read_buffer = 0;
+    uint8_t open_bus = 0;
+
+    // Registers https://wiki.nesdev.com/w/index.php/PPU_registers
+    uint8_t ctrl = 0;
+    uint8_t mask = 0;
+    uint8_t status = 0;
+    uint8_t oam_addr = 0;
+
+    // Set when the NMI output goes active. The console passes it on to the CPU and clears it
+    bool nmi_edge = false;
+
+    std::array<uint8_t, 0x800> vram{};
+    std::array<uint8_t, 0x20> palette{};
+    std::array<uint8_t, 0x100> oam{};
+
+    std::array<uint8_t, 7> reserved{};
+};
+
+// Register interface, memory and timing of the 2C02
+// https://wiki.nesdev.com/w/index.php/PPU
+class Ppu : public ppu_state {
+public:
+    static constexpr unsigned dots_per_scanline = 341;
+    static constexpr unsigned scanlines_per_frame = 262;
+    static constexpr unsigned vblank_scanline = 241;
+    static constexpr unsigned prerender_scanline = 261;
+
+    void powerOn(const uint8_t *chr_rom, size_t chr_rom_size, Ines::Mirroring mirroring);
+
+    // CPU side register access, addr is $2000-$2007 (already mirrored down)
+    uint8_t readRegister(uint16_t addr);
+    void writeRegister(uint16_t addr, uint8_t value);
+
+    // PPU address space, $0000-$3FFF
+    uint8_t read(uint16_t addr) const;
+    void write(uint16_t addr, uint8_t value);
+
+    // The pattern tables, $0000-$1FFF, in one go. out must hold 0x2000 bytes
+    void copyPatternTables(std::span<uint8_t> out) const;
+
+    // Advance by a number of dots
+    void tick(unsigned dots);
+
+    // Become a copy of other that doesn't share CHR RAM pages with it, so that other can go on writing them without
+    // having to copy them first
+    void copyUnshared(const Ppu &other);
+
+    // Time the current scanline for the timeline from now, so that time the PPU wasn't running isn't counted
+    void resumeTimeline();
+
+    // Address the next $2007 access will go to
+    uint16_t dataAddress() const { return v & 0x3FFFu; }
+
+    // Copy on write, so that forks of a console share it
+    CowMemory chr_ram{0x2000};
+
+private:
+    uint16_t nametableIndex(uint16_t addr) const;
+
+    const uint8_t *chr_rom = nullptr;
+    size_t chr_rom_size = 0;
+    Ines::Mirroring mirroring = Ines::Mirroring::HORIZONTAL;
+#ifdef IMNES_ENABLE_TIMELINE
+    uint64_t scanline_start = 0;
+#endif
+};
+
+
+#endif //IMNES_PPU_H
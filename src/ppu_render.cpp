@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#include "ppu.h"
+#include "ppu_render.h"
+
+// https://wiki.nesdev.com/w/index.php/PPU_rendering
+namespace {
+
+// Colour indices only use six bits, so the top two mark pixels while the frame is drawn
+constexpr uint8_t background_opaque = 0x80;
+constexpr uint8_t sprite_drawn = 0x40;
+
+using pattern_tables = std::array<uint8_t, 0x2000>;
+
+uint8_t colour(const Ppu &ppu, unsigned index) {
+    return ppu.read(static_cast<uint16_t>(0x3F00u + index)) & 0x3Fu;
+}
+
+// Each bit of a pattern byte moved to the bottom of its own byte, leftmost pixel in the lowest byte, so that a plane
+// pair gives eight 2 bit pixels with spread[lo] | spread[hi] << 1
+constexpr std::array<uint64_t, 256> makeSpread() {
+    std::array<uint64_t, 256> t{};
+    for (unsigned v = 0; v < t.size(); v++) {
+        for (unsigned b = 0; b < 8; b++) {
+            t[v] |= static_cast<uint64_t>((v >> (7 - b)) & 1u) << (8 * b);
+        }
+    }
+    return t;
+}
+
+constexpr std::array<uint64_t, 256> spread = makeSpread();
+
+void renderBackground(const Ppu &ppu, const pattern_tables &patterns, uint8_t *out) {
+    const uint8_t backdrop = colour(ppu, 0);
+    if (!(ppu.mask & 0x08u)) {
+        std::fill_n(out, frame_pixels, backdrop);
+        return;
+    }
+    // Pixel value 0 of every palette is the backdrop
+    std::array<uint8_t, 16> colours{};
+    for (unsigned i = 0; i < colours.size(); i++) {
+        colours[i] = (i % 4) ? static_cast<uint8_t>(colour(ppu, i) | background_opaque) : backdrop;
+    }
+    // Four pixels at a time: the colours of each palette for a nibble of each plane, low plane in the low nibble
+    std::array<std::array<uint32_t, 256>, 4> quads{};
+    for (unsigned palette = 0; palette < quads.size(); palette++) {
+        for (unsigned planes = 0; planes < 256; planes++) {
+            uint32_t q = 0;
+            for (unsigned b = 0; b < 4; b++) {
+                const unsigned pixel = ((planes >> (3 - b)) & 1u) | (((planes >> (7 - b)) & 1u) << 1u);
+                // Leftmost pixel first in memory
+                const unsigned shift = std::endian::native == std::endian::little ? 8 * b : 8 * (3 - b);
+                q |= static_cast<uint32_t>(colours[palette * 4 + pixel]) << shift;
+            }
+            quads[palette][planes] = q;
+        }
+    }
+
+    // Scroll is taken from t, which the next frame starts from
+    // https://wiki.nesdev.com/w/index.php/PPU_scrolling
+    const unsigned scroll_x = ((ppu.t & 0x400u) ? 256u : 0u) + (ppu.t & 0x1Fu) * 8u + ppu.fine_x;
+    const unsigned scroll_y = ((ppu.t & 0x800u) ? 240u : 0u) + ((ppu.t >> 5u) & 0x1Fu) * 8u + ((ppu.t >> 12u) & 0x7u);
+    const unsigned pattern_base = (ppu.ctrl & 0x10u) ? 0x1000u : 0u;
+    const unsigned fine_x = scroll_x % 8;
+
+    // 33 tiles cover the line when it doesn't start on a tile boundary. Their tiles and palettes only change
+    // every eight lines
+    struct tile
+    {
+        uint16_t pattern;
+        uint8_t palette;
+    };
+    std::array<tile, 33> tiles{};
+    std::array<uint8_t, tiles.size() * 8> line{};
+    unsigned tiles_row = ~0u;
+
+    for (unsigned y = 0; y < frame_height; y++) {
+        const unsigned wy = (y + scroll_y) % 480;
+        if (wy / 8 != tiles_row) {
+            tiles_row = wy / 8;
+            const unsigned tile_y = (wy % 240) / 8;
+            for (unsigned column = 0; column < tiles.size(); column++) {
+                const unsigned wx = (scroll_x - fine_x + column * 8) % 512;
+                const unsigned tile_x = (wx % 256) / 8;
+                const unsigned nametable = 0x2000u + ((wx / 256) + 2 * (wy / 240)) * 0x400u;
+                const uint8_t t = ppu.read(static_cast<uint16_t>(nametable + tile_y * 32 + tile_x));
+                const uint8_t attr = ppu.read(static_cast<uint16_t>(nametable + 0x3C0u + (tile_y / 4) * 8 + tile_x / 4));
+                tiles[column].pattern = static_cast<uint16_t>(pattern_base + t * 16u);
+                tiles[column].palette = static_cast<uint8_t>((attr >> (((tile_y & 2u) << 1u) | (tile_x & 2u))) & 3u);
+            }
+        }
+        for (unsigned column = 0; column < tiles.size(); column++) {
+            const tile &t = tiles[column];
+            const unsigned row = t.pattern + wy % 8;
+            const unsigned lo = patterns[row];
+            const unsigned hi = patterns[row + 8];
+            const std::array<uint32_t, 2> pixels = {quads[t.palette][(lo >> 4u) | (hi & 0xF0u)],
+                                                    quads[t.palette][(lo & 0x0Fu) | ((hi & 0x0Fu) << 4u)]};
+            std::memcpy(line.data() + column * 8, pixels.data(), sizeof(pixels));
+        }
+        uint8_t *row = out + y * frame_width;
+        std::copy_n(line.begin() + fine_x, frame_width, row);
+        if (!(ppu.mask & 0x02u)) {
+            std::fill_n(row, 8, backdrop);
+        }
+    }
+}
+
+void renderSprites(const Ppu &ppu, const pattern_tables &patterns, uint8_t *out) {
+    if (!(ppu.mask & 0x10u)) {
+        return;
+    }
+    std::array<uint8_t, 16> colours{};
+    for (unsigned i = 0; i < colours.size(); i++) {
+        colours[i] = colour(ppu, 16 + i);
+    }
+    const bool tall = ppu.ctrl & 0x20u;
+    const unsigned height = tall ? 16 : 8;
+    // Lower numbered sprites are in front, so draw those first and don't draw over them
+    for (unsigned i = 0; i < 64; i++) {
+        const unsigned top = ppu.oam[i * 4] + 1u;
+        const uint8_t tile = ppu.oam[i * 4 + 1];
+        const uint8_t attr = ppu.oam[i * 4 + 2];
+        const unsigned left = ppu.oam[i * 4 + 3];
+        for (unsigned r = 0; r < height && top + r < frame_height; r++) {
+            unsigned line = (attr & 0x80u) ? height - 1 - r : r;
+            unsigned pattern;
+            if (tall) {
+                pattern = (tile & 1u) * 0x1000u + (tile & 0xFEu) * 16u + (line >= 8 ? 16u : 0u);
+                line %= 8;
+            } else {
+                pattern = ((ppu.ctrl & 0x08u) ? 0x1000u : 0u) + tile * 16u;
+            }
+            const uint64_t pixels = spread[patterns[pattern + line]] | (spread[patterns[pattern + line + 8]] << 1u);
+            uint8_t *row = out + (top + r) * frame_width;
+            for (unsigned b = 0; b < 8 && left + b < frame_width; b++) {
+                const unsigned x = left + b;
+                const auto pixel = static_cast<uint8_t>((pixels >> (8 * ((attr & 0x40u) ? 7 - b : b))) & 3u);
+                if (pixel == 0 || (row[x] & sprite_drawn) || (x < 8 && !(ppu.mask & 0x04u))) {
+                    continue;
+                }
+                // A sprite behind the background still hides the sprites behind it
+                if ((attr & 0x20u) && (row[x] & background_opaque)) {
+                    row[x] |= sprite_drawn;
+                } else {
+                    row[x] = static_cast<uint8_t>(colours[(attr & 3u) * 4 + pixel] | (row[x] & background_opaque) | sprite_drawn);
+                }
+            }
+        }
+    }
+}
+
+}
+
+void render_frame(const Ppu &ppu, std::span<uint8_t> out) {
+    if (out.size() < frame_pixels) {
+        throw std::runtime_error("Frame buffer is too small");
+    }
+    pattern_tables patterns;
+    ppu.copyPatternTables(patterns);
+    renderBackground(ppu, patterns, out.data());
+    renderSprites(ppu, patterns, out.data());
+    const uint8_t keep = (ppu.mask & 0x01u) ? 0x30 : 0x3F; // Greyscale
+    for (size_t i = 0; i < frame_pixels; i++) {
+        out[i] &= keep;
+    }
+}
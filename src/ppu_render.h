@@ -0,0 +1,21 @@
+#ifndef IMNES_PPU_RENDER_H
+#define IMNES_PPU_RENDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+class Ppu;
+
+static constexpr size_t frame_width = 256;
+static constexpr size_t frame_height = 240;
+static constexpr size_t frame_pixels = frame_width * frame_height;
+
+// Draws the picture the PPU's memory and registers describe, as one NES colour index (0-63) per pixel, row by row
+// The PPU doesn't render as it runs yet, so this is the whole frame from the state at one point in time. Scroll
+// changes part way down the screen, sprite 0 hit and the eight sprites per line limit aren't seen
+// N.B. throws runtime_error if out is smaller than frame_pixels
+void render_frame(const Ppu &ppu, std::span<uint8_t> out);
+
+
+#endif //IMNES_PPU_RENDER_H
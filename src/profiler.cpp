@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "allocation_guard.h"
+#include "profiler.h"
+
+Profiler::Profiler() {
+    clear();
+}
+
+void Profiler::clear() {
+    cycles_at.fill(0);
+    nodes.assign(1, node{0, entry_kind::ROOT, none, none, none, 0, 0, 0});
+    stack.reserve(max_depth);
+    stack.assign(1, 0);
+    overflow = 0;
+}
+
+uint64_t Profiler::maxCyclesAt() const {
+    return *std::max_element(cycles_at.begin(), cycles_at.end());
+}
+
+void Profiler::enter(uint16_t addr, entry_kind kind) {
+    if (stack.size() >= max_depth) {
+        overflow++;
+        return;
+    }
+    const uint32_t parent = stack.back();
+    uint32_t child = nodes[parent].first_child;
+    while (child != none && (nodes[child].addr != addr || nodes[child].kind != kind)) {
+        child = nodes[child].next_sibling;
+    }
+    if (child == none) {
+        // A call path we haven't seen before, which is rare once the game has been running a while
+        IMNES_ALLOW_ALLOCATIONS();
+        child = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(node{addr, kind, parent, none, nodes[parent].first_child, 0, 0, 0});
+        nodes[parent].first_child = child;
+    }
+    nodes[child].calls++;
+    stack.push_back(child);
+}
+
+void Profiler::updateInclusive() {
+    for (auto &n : nodes) {
+        n.inclusive = n.exclusive;
+    }
+    // Children always come after their parents
+    for (size_t i = nodes.size() - 1; i > 0; i--) {
+        nodes[nodes[i].parent].inclusive += nodes[i].inclusive;
+    }
+}
+
+void Profiler::formatName(const node &n, char *buf, size_t size) {
+    switch (n.kind) {
+        case entry_kind::ROOT: std::snprintf(buf, size, "root"); break;
+        case entry_kind::CALL: std::snprintf(buf, size, "sub_%04X", n.addr); break;
+        case entry_kind::NMI: std::snprintf(buf, size, "nmi_%04X", n.addr); break;
+        case entry_kind::IRQ: std::snprintf(buf, size, "irq_%04X", n.addr); break;
+    }
+}
+
+void Profiler::saveFolded(const std::filesystem::path &p) const {
+    std::ofstream file(p);
+    if (!file) {
+        throw std::runtime_error("Could not create " + p.string());
+    }
+    std::vector<uint32_t> path;
+    std::string line;
+    char name[16];
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].exclusive == 0) {
+            continue;
+        }
+        path.clear();
+        for (uint32_t n = i; n != none; n = nodes[n].parent) {
+            path.push_back(n);
+        }
+        line.clear();
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            formatName(nodes[*it], name, sizeof(name));
+            if (it != path.rbegin()) {
+                line += ';';
+            }
+            line += name;
+        }
+        file << line << ' ' << nodes[i].exclusive << '\n';
+    }
+    if (!file) {
+        throw std::runtime_error("Could not write " + p.string());
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef IMNES_PROFILER_H
+#define IMNES_PROFILER_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Counts the cycles spent at every PC, and builds a call tree by following JSR/RTS and interrupt entry (or BRK)/RTI
+// Every instruction is counted, there is no sampling
+// Code that plays games with the stack (e.g. pushing an address and using RTS to jump) will confuse the tree,
+// but not the per address counts
+class Profiler {
+public:
+    enum class entry_kind : uint8_t
+    {
+        ROOT,
+        CALL,
+        NMI,
+        IRQ,
+    };
+
+    struct node
+    {
+        uint16_t addr; // Entry point of the subroutine or interrupt handler
+        entry_kind kind;
+        uint32_t parent;
+        uint32_t first_child;
+        uint32_t next_sibling;
+        uint64_t calls;
+        uint64_t exclusive; // Cycles spent in this node itself
+        uint64_t inclusive; // Including children. Only valid after updateInclusive()
+    };
+
+    static constexpr uint32_t none = UINT32_MAX;
+    // Deeper than this and calls are counted against the deepest node. Guards against stacks that never unwind
+    static constexpr size_t max_depth = 256;
+
+    Profiler();
+
+    // Called after each instruction with the PC and opcode it executed, or on interrupt entry with kind NMI/IRQ
+    // The interrupt sequence isn't an instruction at pc, so it only counts towards the interrupted node
+    void record(uint16_t pc, uint8_t opcode, entry_kind interrupt, unsigned cycles, uint16_t new_pc) {
+        nodes[stack.back()].exclusive += cycles;
+        if (interrupt != entry_kind::ROOT) {
+            enter(new_pc, interrupt);
+            return;
+        }
+        cycles_at[pc] += cycles;
+        if (opcode == jsr_opcode) {
+            enter(new_pc, entry_kind::CALL);
+        } else if (opcode == brk_opcode) {
+            // BRK goes through the IRQ vector, and its handler's RTI pops it like any other interrupt
+            enter(new_pc, entry_kind::IRQ);
+        } else if (opcode == rts_opcode || opcode == rti_opcode) {
+            if (overflow != 0) {
+                overflow--;
+            } else if (stack.size() > 1) {
+                stack.pop_back();
+            }
+        }
+    }
+
+    void clear();
+
+    // Cycles spent executing the instruction at each address
+    const std::array<uint64_t, 0x10000> &cyclesAt() const { return cycles_at; }
+    uint64_t maxCyclesAt() const;
+
+    // Node 0 is the root
+    const std::vector<node> &callTree() const { return nodes; }
+    void updateInclusive();
+
+    // "name" for a node, e.g. sub_C123, nmi_C080
+    static void formatName(const node &n, char *buf, size_t size);
+
+    // One line per call stack: "root;sub_C000;sub_C123 cycles", as read by flamegraph.pl and speedscope
+    // N.B. throws runtime_error on failure
+    void saveFolded(const std::filesystem::path &p) const;
+
+private:
+    static constexpr uint8_t brk_opcode = 0x00;
+    static constexpr uint8_t jsr_opcode = 0x20;
+    static constexpr uint8_t rts_opcode = 0x60;
+    static constexpr uint8_t rti_opcode = 0x40;
+
+    void enter(uint16_t addr, entry_kind kind);
+
+    std::array<uint64_t, 0x10000> cycles_at{};
+    std::vector<node> nodes;
+    std::vector<uint32_t> stack;
+    size_t overflow = 0; // Calls made past max_depth, that haven't returned yet
+};
+
+
+#endif //IMNES_PROFILER_H
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "console.h"
+#include "rewind.h"
+#include "timeline.h"
+
+namespace {
+
+// Coded states are a list of (zero count, literal count, literals), counts being 16 bit little endian
+// Zero runs shorter than this are cheaper left in the literals
+constexpr size_t min_zero_run = 4;
+constexpr size_t max_run = 0xFFFF;
+
+size_t worst_coded_size(size_t n) {
+    return n + 4 * (n / max_run + 2);
+}
+
+void put16(uint8_t *out, size_t v) {
+    out[0] = static_cast<uint8_t>(v);
+    out[1] = static_cast<uint8_t>(v >> 8u);
+}
+
+size_t get16(const uint8_t *in) {
+    return static_cast<size_t>(in[0] | (in[1] << 8u));
+}
+
+// Code a ^ b, or just a if b is nullptr
+size_t encode(const uint8_t *a, const uint8_t *b, size_t n, uint8_t *out) {
+    auto x = [a, b](size_t i) { return static_cast<uint8_t>(b ? a[i] ^ b[i] : a[i]); };
+    auto zero_word = [a, b](size_t i) {
+        uint64_t wa;
+        uint64_t wb = 0;
+        std::memcpy(&wa, a + i, sizeof(wa));
+        if (b) {
+            std::memcpy(&wb, b + i, sizeof(wb));
+        }
+        return wa == wb;
+    };
+    auto zeros_at = [&x, n](size_t i) {
+        size_t z = 0;
+        while (i + z < n && z < min_zero_run && x(i + z) == 0) {
+            z++;
+        }
+        return z == min_zero_run;
+    };
+
+    size_t i = 0;
+    size_t o = 0;
+    while (i < n) {
+        size_t zeros = 0;
+        while (i + 8 <= n && zeros + 8 <= max_run && zero_word(i)) {
+            i += 8;
+            zeros += 8;
+        }
+        while (i < n && zeros < max_run && x(i) == 0) {
+            i++;
+            zeros++;
+        }
+        const size_t start = i;
+        while (i < n && i - start < max_run && !zeros_at(i)) {
+            i++;
+        }
+        put16(out + o, zeros);
+        put16(out + o + 2, i - start);
+        o += 4;
+        for (size_t j = start; j < i; j++) {
+            out[o++] = x(j);
+        }
+    }
+    return o;
+}
+
+// XOR the coded bytes in to out
+void apply(const uint8_t *in, size_t size, uint8_t *out) {
+    const uint8_t *end = in + size;
+    while (in < end) {
+        out += get16(in);
+        const size_t literals = get16(in + 2);
+        in += 4;
+        for (size_t j = 0; j < literals; j++) {
+            out[j] ^= in[j];
+        }
+        in += literals;
+        out += literals;
+    }
+}
+
+}
+
+Rewind::Rewind(size_t budget_bytes, unsigned interval)
+        : keyframe_interval(std::max(interval, 1u)), data(budget_bytes), entries(std::max<size_t>(budget_bytes / 1024, 64)),
+          scratch(worst_coded_size(sizeof(machine_state))), worker(&Rewind::work, this) {
+    if (budget_bytes < 4 * scratch.size()) {
+        // The worker is already running, so it must be stopped before we throw
+        {
+            std::lock_guard lock(mutex);
+            quit = true;
+        }
+        wake.notify_one();
+        worker.join();
+        throw std::runtime_error("Rewind needs at least " + std::to_string(4 * scratch.size()) + " bytes");
+    }
+}
+
+Rewind::~Rewind() {
+    {
+        std::lock_guard lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void Rewind::capture(const Console &console) {
+    IMNES_ZONE("rewind capture");
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t tail = queue_tail.load(std::memory_order_relaxed);
+    if (tail - queue_head.load(std::memory_order_acquire) == queue_size) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    console.saveState(queue[tail % queue_size]);
+    queue_tail.store(tail + 1, std::memory_order_release);
+    {
+        // So the worker can't miss the wake up between checking the queue and waiting
+        std::lock_guard lock(mutex);
+    }
+    wake.notify_one();
+    capture_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(),
+                     std::memory_order_relaxed);
+}
+
+bool Rewind::rewind(Console &console) {
+    std::unique_lock lock(mutex);
+    flush(lock);
+    // The newest entry is where the console is now, so go back to the one before
+    if (entries_count < 2) {
+        return false;
+    }
+    const entry &newest = entries[(entries_head + entries_count - 1) % entries.size()];
+    data_end = newest.offset;
+    bytes_used -= newest.size;
+    entries_count--;
+    const entry &back = entries[(entries_head + entries_count - 1) % entries.size()];
+    decode(back, restored);
+    next_seq = back.seq + 1;
+    // The worker's keyframe may have just gone
+    need_keyframe = true;
+    console.loadState(restored);
+    return true;
+}
+
+void Rewind::clear() {
+    std::unique_lock lock(mutex);
+    flush(lock);
+    entries_count = 0;
+    data_end = 0;
+    bytes_used = 0;
+    need_keyframe = true;
+}
+
+Rewind::stats Rewind::getStats() {
+    std::lock_guard lock(mutex);
+    stats s;
+    s.frames = entries_count;
+    s.bytes_used = bytes_used;
+    s.capacity = data.size();
+    s.dropped = dropped.load(std::memory_order_relaxed);
+    s.capture_time = std::chrono::nanoseconds(capture_ns.load(std::memory_order_relaxed));
+    s.compress_time = std::chrono::nanoseconds(compress_ns);
+    return s;
+}
+
+void Rewind::work() {
+    timeline_set_thread_name("rewind");
+    std::unique_lock lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return quit || queue_head.load(std::memory_order_acquire) != queue_tail.load(std::memory_order_acquire); });
+        if (quit) {
+            return;
+        }
+        IMNES_ZONE("rewind compress");
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t head = queue_head.load(std::memory_order_relaxed);
+        const machine_state &state = queue[head % queue_size];
+        // Coding is the slow part, so it is done unlocked, so that capture() and getStats() aren't held up by it
+        const bool delta = !need_keyframe && next_seq - keyframe_seq < keyframe_interval;
+        if (delta) {
+            lock.unlock();
+            const size_t n = code(state, &keyframe);
+            lock.lock();
+            if (!store(n, keyframe_seq)) {
+                need_keyframe = true;
+            }
+        }
+        if (!delta || need_keyframe) {
+            lock.unlock();
+            // Byte for byte, so that deltas against it are all zero where nothing changed
+            std::memcpy(&keyframe, &state, sizeof(state));
+            const size_t n = code(state, nullptr);
+            lock.lock();
+            keyframe_seq = next_seq;
+            need_keyframe = false;
+            store(n, keyframe_seq);
+        }
+        next_seq++;
+        queue_head.store(head + 1, std::memory_order_release);
+        compress_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        idle.notify_all();
+    }
+}
+
+size_t Rewind::code(const machine_state &state, const machine_state *base) {
+    return encode(reinterpret_cast<const uint8_t *>(&state), reinterpret_cast<const uint8_t *>(base), sizeof(state),
+                  scratch.data());
+}
+
+bool Rewind::store(size_t n, uint64_t key_seq) {
+    if (data_end + n > data.size()) {
+        // Whatever is past the end is the oldest history
+        while (entries_count != 0 && oldest().offset >= data_end) {
+            dropOldest();
+        }
+        data_end = 0;
+    }
+    while (entries_count != 0 && oldest().offset < data_end + n && oldest().offset + oldest().size > data_end) {
+        dropOldest();
+    }
+    if (entries_count == entries.size()) {
+        dropOldest();
+    }
+    // Deltas are no use without their keyframe
+    while (entries_count != 0 && oldest().seq != oldest().keyframe_seq) {
+        dropOldest();
+    }
+    if (key_seq != next_seq && (entries_count == 0 || oldest().seq > key_seq)) {
+        return false;
+    }
+    std::memcpy(data.data() + data_end, scratch.data(), n);
+    entries[(entries_head + entries_count) % entries.size()] = {next_seq, key_seq, data_end, n};
+    entries_count++;
+    data_end += n;
+    bytes_used += n;
+    return true;
+}
+
+void Rewind::decode(const entry &e, machine_state &out) const {
+    if (e.seq == e.keyframe_seq) {
+        std::memset(reinterpret_cast<uint8_t *>(&out), 0, sizeof(out));
+    } else {
+        // seqs in the ring are consecutive
+        decode(entries[(entries_head + (e.keyframe_seq - oldest().seq)) % entries.size()], out);
+    }
+    apply(data.data() + e.offset, e.size, reinterpret_cast<uint8_t *>(&out));
+}
+
+void Rewind::dropOldest() {
+    bytes_used -= oldest().size;
+    entries_head = (entries_head + 1) % entries.size();
+    entries_count--;
+}
+
+void Rewind::flush(std::unique_lock<std::mutex> &lock) {
+    idle.wait(lock, [this] { return queue_head.load(std::memory_order_acquire) == queue_tail.load(std::memory_order_acquire); });
+}
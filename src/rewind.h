@@ -0,0 +1,110 @@
+#ifndef IMNES_REWIND_H
+#define IMNES_REWIND_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "machine_state.h"
+
+class Console;
+
+// Save state history for rewinding, in a fixed amount of memory
+// A state is captured every frame. Every keyframe_interval'th is kept whole, the rest as the XOR against their keyframe.
+// Both are run length coded, so the (mostly zero) deltas are small. The oldest history is dropped to make room
+// The emulation thread only copies the machine out; coding happens on a worker thread. Nothing allocates after construction
+class Rewind {
+public:
+    struct stats
+    {
+        uint64_t frames = 0;       // Frames that can be rewound
+        size_t bytes_used = 0;
+        size_t capacity = 0;
+        uint64_t dropped = 0;      // Captures thrown away because the worker was behind
+        std::chrono::nanoseconds capture_time{};  // Last capture, on the emulation thread
+        std::chrono::nanoseconds compress_time{}; // Last compression, on the worker
+    };
+
+    // N.B. throws runtime_error if budget can't hold a couple of keyframes
+    explicit Rewind(size_t budget_bytes, unsigned keyframe_interval = 60);
+    ~Rewind();
+    Rewind(const Rewind &) = delete;
+    Rewind &operator=(const Rewind &) = delete;
+
+    // Emulation thread: record the console's state at the end of a frame
+    void capture(const Console &console);
+
+    // Emulation thread: go back one frame. Returns false, leaving the console alone, when there is no more history
+    bool rewind(Console &console);
+
+    void clear();
+
+    stats getStats();
+
+private:
+    // Decoded states waiting for the worker
+    static constexpr size_t queue_size = 4;
+
+    struct entry
+    {
+        uint64_t seq;
+        uint64_t keyframe_seq; // seq of the keyframe this is a delta against. Equal to seq for keyframes
+        size_t offset;
+        size_t size;
+    };
+
+    void work();
+    // Code state ^ base (or just state for a keyframe) in to scratch, returning the size. Worker only, without mutex
+    size_t code(const machine_state &state, const machine_state *base);
+    // Add the n bytes coded in scratch to the data ring. Caller holds mutex
+    // Returns false if making room dropped the keyframe of a delta
+    bool store(size_t n, uint64_t key_seq);
+    void decode(const entry &e, machine_state &out) const;
+    const entry &oldest() const { return entries[entries_head]; }
+    void dropOldest();
+    // Wait until the worker has stored everything captured. Returns holding lock
+    void flush(std::unique_lock<std::mutex> &lock);
+
+    const unsigned keyframe_interval;
+
+    // Emulation thread to worker queue
+    std::array<machine_state, queue_size> queue{};
+    std::atomic<uint64_t> queue_head{0}; // Next for the worker to take
+    std::atomic<uint64_t> queue_tail{0}; // Next for capture to fill
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    bool quit = false;
+
+    // History, guarded by mutex. Those the worker codes with only change while it has a state queued, and rewind() and
+    // clear() wait for the queue to empty first, so the worker reads them without the lock
+    std::vector<uint8_t> data;
+    std::vector<entry> entries; // Ring, oldest at entries_head
+    size_t entries_head = 0;
+    size_t entries_count = 0;
+    size_t data_end = 0; // Where the next entry goes
+    size_t bytes_used = 0;
+    uint64_t next_seq = 0;
+    machine_state keyframe{}; // The latest keyframe, whole, for coding deltas against
+    uint64_t keyframe_seq = 0;
+    bool need_keyframe = true;
+    std::vector<uint8_t> scratch; // Worst case coded state
+    machine_state restored{};
+
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<int64_t> capture_ns{0};
+    int64_t compress_ns = 0;
+
+    // Last so that everything else exists before the thread starts
+    std::thread worker;
+};
+
+
+#endif //IMNES_REWIND_H
@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include "console.h"
+#include "run_ahead.h"
+
+namespace {
+
+bool looksSame(const Ppu &l, const Ppu &r) {
+    return l.vram == r.vram && l.palette == r.palette && l.oam == r.oam && l.chr_ram == r.chr_ram && l.ctrl == r.ctrl &&
+           l.mask == r.mask && l.t == r.t && l.fine_x == r.fine_x;
+}
+
+}
+
+RunAhead::RunAhead(std::shared_ptr<const Ines> rom, unsigned frames, mode mode_)
+        : count(std::clamp(frames, 1u, max_frames)), m(mode_) {
+    if (m == mode::SECOND_INSTANCE) {
+        second = std::make_unique<Console>(std::move(rom));
+    }
+}
+
+RunAhead::~RunAhead() = default;
+
+void RunAhead::update(Console &console) {
+    const auto start = std::chrono::steady_clock::now();
+    console.saveState(saved);
+    Console &c = second ? *second : console;
+    if (second) {
+        second->loadState(saved);
+    }
+    for (unsigned i = 0; i < count; i++) {
+        runHiddenFrame(c);
+    }
+    c.saveState(shown);
+    if (!second) {
+        console.loadState(saved);
+    }
+    last_cost = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+}
+
+void RunAhead::runHiddenFrame(Console &c) {
+    const uint64_t frame = c.ppu.frame;
+    while (c.ppu.frame == frame) {
+        c.runFrame();
+    }
+}
+
+int RunAhead::measureInputLag(const std::shared_ptr<const Ines> &rom, const machine_state &state, uint8_t buttons,
+                              unsigned max_frames) {
+    Console held(rom);
+    Console released(rom);
+    held.loadState(state);
+    released.loadState(state);
+    held.bus.buttons[0] = buttons;
+    released.bus.buttons[0] = 0;
+    for (unsigned i = 1; i <= max_frames; i++) {
+        runHiddenFrame(held);
+        runHiddenFrame(released);
+        if (!looksSame(held.ppu, released.ppu)) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
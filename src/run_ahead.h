@@ -0,0 +1,61 @@
+#ifndef IMNES_RUN_AHEAD_H
+#define IMNES_RUN_AHEAD_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include "machine_state.h"
+
+class Console;
+
+// Hides a game's own input lag by showing the machine some frames in the future
+// After each real frame, the machine is run on with the same input and that result is shown instead.
+// Games usually take a frame or two to respond to input, so the shown frame already has the response
+// Single instance mode runs ahead on the console itself and then loads the saved state back, so attached debugging
+// tools see the hidden frames too. Second instance mode runs ahead on a copy, and leaves the real console alone
+class RunAhead {
+public:
+    enum class mode : uint8_t
+    {
+        SINGLE_INSTANCE,
+        SECOND_INSTANCE,
+    };
+
+    static constexpr unsigned max_frames = 4;
+
+    // frames is clamped to 1-max_frames
+    RunAhead(std::shared_ptr<const Ines> rom, unsigned frames, mode m);
+    ~RunAhead();
+    RunAhead(const RunAhead &) = delete;
+    RunAhead &operator=(const RunAhead &) = delete;
+
+    // Call after console has run a real frame. Leaves the machine to show in ahead()
+    void update(Console &console);
+
+    const machine_state &ahead() const { return shown; }
+    unsigned frames() const { return count; }
+    mode getMode() const { return m; }
+    // Time update() last took
+    std::chrono::nanoseconds cost() const { return last_cost; }
+
+    // Frames from the input changing to the first frame that looks different, or -1 if it doesn't within max_frames
+    // Only what the PPU shows is compared (nametables, palette, sprites, scroll and control). Plays from state on two
+    // scratch consoles, one with buttons on port 0 and one without
+    static int measureInputLag(const std::shared_ptr<const Ines> &rom, const machine_state &state, uint8_t buttons,
+                               unsigned max_frames = 30);
+
+private:
+    // Run a whole frame, carrying on through any breakpoints
+    static void runHiddenFrame(Console &c);
+
+    unsigned count;
+    mode m;
+    std::unique_ptr<Console> second;
+    machine_state saved{};
+    machine_state shown{};
+    std::chrono::nanoseconds last_cost{};
+};
+
+
+#endif //IMNES_RUN_AHEAD_H
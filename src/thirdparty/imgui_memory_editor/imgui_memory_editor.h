@@ -41,6 +41,7 @@
 // - v0.34: binary preview now applies endianness setting [@nicolasnoble]
 // - v0.35: using ImGuiDataType available since Dear ImGui 1.69.
 // - v0.36: minor tweaks, minor refactor.
+// - imnes: added BgColorFn handler for per-byte background colors (same idea as upstream's later BgColorFn).
 //
 // Todo/Bugs:
 // - Arrows are being sent to the InputText() about to disappear which for LeftArrow makes the text cursor appear at position 1 for one frame.
@@ -88,6 +89,7 @@ struct MemoryEditor
     ImU8            (*ReadFn)(const ImU8* data, size_t off);    // = 0      // optional handler to read bytes.
     void            (*WriteFn)(ImU8* data, size_t off, ImU8 d); // = 0      // optional handler to write bytes.
     bool            (*HighlightFn)(const ImU8* data, size_t off);//= 0      // optional handler to return Highlight property (to support non-contiguous highlighting).
+    ImU32           (*BgColorFn)(const ImU8* data, size_t off);  //= 0      // optional handler to return a background color for a byte (0 for none). drawn under any highlight.
 
     // [Internal State]
     bool            ContentsWidthChanged;
@@ -119,6 +121,7 @@ struct MemoryEditor
         ReadFn = NULL;
         WriteFn = NULL;
         HighlightFn = NULL;
+        BgColorFn = NULL;
 
         // State/Internals
         ContentsWidthChanged = false;
@@ -285,6 +288,17 @@ struct MemoryEditor
                     byte_pos_x += (float)(n / OptMidColsCount) * s.SpacingBetweenMidCols;
                 ImGui::SameLine(byte_pos_x);
 
+                // Draw background color
+                if (BgColorFn)
+                {
+                    ImU32 bg_color = BgColorFn(mem_data, addr);
+                    if (bg_color != 0)
+                    {
+                        ImVec2 pos = ImGui::GetCursorScreenPos();
+                        draw_list->AddRectFilled(pos, ImVec2(pos.x + s.HexCellWidth, pos.y + s.LineHeight), bg_color);
+                    }
+                }
+
                 // Draw highlight
                 bool is_highlight_from_user_range = (addr >= HighlightMin && addr < HighlightMax);
                 bool is_highlight_from_user_func = (HighlightFn && HighlightFn(mem_data, addr));
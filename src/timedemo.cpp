@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <string_view>
+#include <vector>
+
+#include "console.h"
+#include "movie.h"
+#include "ppu_render.h"
+#include "timedemo.h"
+
+namespace {
+
+using steady = std::chrono::steady_clock;
+
+double ms(steady::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Nearest rank, of sorted times
+double percentile(const std::vector<double> &sorted, double p) {
+    const auto rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// What one steady_clock::now() costs, the least of a few tries
+std::chrono::nanoseconds clockCost() {
+    constexpr int reads = 100000;
+    auto best = steady::duration::max();
+    for (int attempt = 0; attempt < 5; attempt++) {
+        const auto start = steady::now();
+        for (int i = 0; i < reads; i++) {
+            [[maybe_unused]] volatile auto t = steady::now();
+        }
+        best = std::min(best, steady::now() - start);
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(best / reads);
+}
+
+// Checked once at the end, as hashing every frame would be timed too
+bool endsAsRecorded(const Console &console, const MoviePlayer &movie) {
+    machine_state state{};
+    console.saveState(state);
+    return movie.frames() == 0 || state_hash(state) == movie.frame(movie.frames() - 1).state_hash;
+}
+
+std::string jsonString(std::string_view s) {
+    std::string out = "\"";
+    for (const char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+}
+
+timedemo_report run_timedemo(const std::filesystem::path &rom_path, const std::filesystem::path &movie_path, const timedemo_options &opt) {
+    const auto rom = std::make_shared<const Ines>(rom_path);
+    MoviePlayer movie(movie_path);
+    timedemo_report r;
+    r.rom = rom_path.string();
+    r.movie = movie_path.string();
+    r.video = opt.video;
+    r.frames = movie.frames();
+
+    // Frame times, with the machine running as it normally would
+    std::vector<double> frame_ms;
+    frame_ms.reserve(movie.frames());
+    std::vector<uint8_t> frame(frame_pixels);
+    steady::duration emulation{};
+    steady::duration video{};
+    {
+        Console console(rom);
+        movie.seek(console, 0);
+        const uint64_t start_cycles = console.cycles;
+        const auto start = steady::now();
+        auto mark = start;
+        for (uint64_t i = 0; i < movie.frames(); i++) {
+            console.bus.buttons = movie.frame(i).buttons;
+            console.runFrame();
+            const auto emulated = steady::now();
+            emulation += emulated - mark;
+            if (opt.video) {
+                render_frame(console.ppu, frame);
+            }
+            const auto end = steady::now();
+            video += end - emulated;
+            frame_ms.push_back(ms(end - mark));
+            mark = end;
+        }
+        r.seconds = std::chrono::duration<double>(mark - start).count();
+        r.cycles = console.cycles - start_cycles;
+        r.matched = endsAsRecorded(console, movie);
+    }
+
+    // The split
+    Console::component_times times;
+    r.timer_overhead = clockCost();
+    {
+        Console console(rom);
+        console.setComponentTimes(&times);
+        movie.seek(console, 0);
+        for (uint64_t i = 0; i < movie.frames(); i++) {
+            console.bus.buttons = movie.frame(i).buttons;
+            console.runFrame();
+        }
+        r.matched &= endsAsRecorded(console, movie);
+    }
+    const auto overhead = r.timer_overhead * static_cast<int64_t>(times.samples);
+    const double cpu = static_cast<double>(std::max(times.cpu - overhead, std::chrono::nanoseconds{}).count());
+    const double ppu = static_cast<double>(std::max(times.ppu - overhead, std::chrono::nanoseconds{}).count());
+
+    if (!frame_ms.empty()) {
+        const auto n = static_cast<double>(frame_ms.size());
+        const double emulation_ms = ms(emulation) / n;
+        r.cpu_ms = cpu + ppu > 0 ? emulation_ms * cpu / (cpu + ppu) : emulation_ms;
+        r.ppu_ms = emulation_ms - r.cpu_ms;
+        r.video_ms = ms(video) / n;
+        r.mean_ms = r.seconds * 1000.0 / n;
+        std::sort(frame_ms.begin(), frame_ms.end());
+        r.p50_ms = percentile(frame_ms, 0.50);
+        r.p99_ms = percentile(frame_ms, 0.99);
+        r.max_ms = frame_ms.back();
+    }
+    return r;
+}
+
+bool write_timedemo_json(FILE *f, const timedemo_report &r) {
+    const double fps = r.seconds > 0 ? static_cast<double>(r.frames) / r.seconds : 0.0;
+    const double mhz = r.seconds > 0 ? static_cast<double>(r.cycles) / r.seconds / 1e6 : 0.0;
+    std::fprintf(f, "{\n  \"rom\": %s,\n  \"movie\": %s,\n  \"video\": %s,\n  \"frames\": %llu,\n  \"cycles\": %llu,\n"
+                    "  \"seconds\": %.6f,\n  \"fps\": %.1f,\n  \"mhz\": %.2f,\n",
+                 jsonString(r.rom).c_str(), jsonString(r.movie).c_str(), r.video ? "true" : "false",
+                 static_cast<unsigned long long>(r.frames), static_cast<unsigned long long>(r.cycles), r.seconds, fps, mhz);
+    std::fprintf(f, "  \"frame_ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n", r.mean_ms, r.p50_ms,
+                 r.p99_ms, r.max_ms);
+    // There is no APU, and NROM has no mapper logic to time, so those two are null rather than a misleading 0
+    std::fprintf(f, "  \"component_ms\": {\"cpu\": %.4f, \"ppu\": %.4f, \"apu\": null, \"mapper\": null, \"video\": %.4f},\n",
+                 r.cpu_ms, r.ppu_ms, r.video_ms);
+    std::fprintf(f, "  \"timer_overhead_ns\": %lld,\n  \"matched\": %s\n}\n", static_cast<long long>(r.timer_overhead.count()),
+                 r.matched ? "true" : "false");
+    return std::ferror(f) == 0;
+}
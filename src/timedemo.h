@@ -0,0 +1,45 @@
+#ifndef IMNES_TIMEDEMO_H
+#define IMNES_TIMEDEMO_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+// Plays a movie back as fast as the machine will go, with no window, and times every frame, for tracking performance
+// The first pass gives the frame times. The component split comes from a second pass with component times attached,
+// which is scaled to the first, as reading the clock per instruction would otherwise swamp what it measures
+struct timedemo_options
+{
+    bool video = true; // Draw each frame with render_frame, as presenting it would need
+};
+
+struct timedemo_report
+{
+    std::string rom;
+    std::string movie;
+    bool video = true;
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+    double seconds = 0;
+    double mean_ms = 0;
+    double p50_ms = 0;
+    double p99_ms = 0;
+    double max_ms = 0;
+    // Mean per frame. CPU and PPU share the emulation time in the ratio the timed pass measured
+    double cpu_ms = 0;
+    double ppu_ms = 0;
+    double video_ms = 0;
+    std::chrono::nanoseconds timer_overhead{}; // Per clock read, taken off the timed pass
+    bool matched = true; // The machine ended up as it was recorded
+};
+
+// N.B. throws runtime_error if the ROM or movie can't be opened, or the movie is for a different ROM
+timedemo_report run_timedemo(const std::filesystem::path &rom, const std::filesystem::path &movie, const timedemo_options &opt);
+
+// N.B. returns false on a write error
+bool write_timedemo_json(FILE *f, const timedemo_report &r);
+
+
+#endif //IMNES_TIMEDEMO_H
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "timeline.h"
+
+namespace {
+
+// Zones each thread keeps. At 60 frames a second and a zone a scanline, that is about 16 seconds of emulation
+constexpr size_t ring_capacity = timeline_ring::capacity;
+
+struct thread_ring
+{
+    std::unique_ptr<timeline_ring::zone[]> zones = std::make_unique<timeline_ring::zone[]>(ring_capacity);
+    timeline_ring ring{zones.get()};
+    // Under registry::mutex
+    bool in_use = true;
+    std::string thread_name;
+    // Zones before this were recorded by a thread that has since exited, and aren't saved
+    uint64_t first_zone = 0;
+};
+
+struct registry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<thread_ring>> rings;
+    // For converting ticks to time
+    uint64_t start_ticks = timeline_now();
+    std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+};
+
+// Never destroyed, as threads may still be recording while static destructors run
+registry &theRegistry() {
+    static registry *r = new registry;
+    return *r;
+}
+
+// Where timeline_this_thread_ring points in to
+thread_local thread_ring *this_thread_ring = nullptr;
+
+// Gives the thread's ring back to the registry when the thread exits, for the next new thread to carry on with
+struct ring_release
+{
+    ~ring_release() {
+        std::lock_guard lock(theRegistry().mutex);
+        this_thread_ring->in_use = false;
+    }
+};
+
+struct saved_zone
+{
+    const char *name;
+    uint64_t begin;
+    uint64_t end;
+    size_t thread;
+};
+
+}
+
+timeline_ring &timeline_new_thread_ring() {
+    thread_local ring_release release;
+    registry &reg = theRegistry();
+    std::lock_guard lock(reg.mutex);
+    this_thread_ring = nullptr;
+    for (size_t i = 0; i < reg.rings.size() && !this_thread_ring; i++) {
+        thread_ring &r = *reg.rings[i];
+        if (!r.in_use) {
+            // Start afresh, so that the last thread's zones and name don't show up as this one's
+            r.in_use = true;
+            r.thread_name = "thread " + std::to_string(i + 1);
+            r.first_zone = r.ring.written.load(std::memory_order_relaxed);
+            this_thread_ring = &r;
+        }
+    }
+    if (!this_thread_ring) {
+        reg.rings.push_back(std::make_unique<thread_ring>());
+        reg.rings.back()->thread_name = "thread " + std::to_string(reg.rings.size());
+        this_thread_ring = reg.rings.back().get();
+    }
+    timeline_this_thread_ring = &this_thread_ring->ring;
+    return this_thread_ring->ring;
+}
+
+void timeline_set_thread_name(const char *name) {
+    if constexpr (timeline_available) {
+        timeline_thread_ring();
+        std::lock_guard lock(theRegistry().mutex);
+        this_thread_ring->thread_name = name;
+    } else {
+        static_cast<void>(name);
+    }
+}
+
+size_t save_timeline(const std::filesystem::path &p, double seconds) {
+    if constexpr (!timeline_available) {
+        throw std::runtime_error("Built without the timeline");
+    }
+    registry &reg = theRegistry();
+    const uint64_t now_ticks = timeline_now();
+    const auto now_time = std::chrono::steady_clock::now();
+    const double elapsed_us = std::max(std::chrono::duration<double, std::micro>(now_time - reg.start_time).count(), 1.0);
+    const double ticks_per_us = static_cast<double>(now_ticks - reg.start_ticks) / elapsed_us;
+    const auto window = static_cast<uint64_t>(seconds * 1e6 * ticks_per_us);
+    const uint64_t from = now_ticks - std::min(now_ticks - reg.start_ticks, window);
+
+    std::vector<saved_zone> zones;
+    std::vector<std::string> names;
+    {
+        // Only so that rings aren't added or renamed. Their threads carry on recording
+        std::lock_guard lock(reg.mutex);
+        for (const auto &r : reg.rings) {
+            const size_t thread = names.size();
+            names.push_back(r->thread_name);
+            const uint64_t written = r->ring.written.load(std::memory_order_acquire);
+            const uint64_t first = std::max(written - std::min<uint64_t>(written, ring_capacity), r->first_zone);
+            std::vector<saved_zone> read;
+            read.reserve(written - first);
+            for (uint64_t i = first; i < written; i++) {
+                const timeline_ring::zone &z = r->zones[i & (ring_capacity - 1)];
+                read.push_back({z.name.load(std::memory_order_relaxed), z.begin.load(std::memory_order_relaxed),
+                                z.end.load(std::memory_order_relaxed), thread});
+            }
+            // Zones whose slots have been claimed again since may be half written over
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t claimed = r->ring.claimed.load(std::memory_order_relaxed);
+            const uint64_t overwritten = std::min(claimed - std::min<uint64_t>(claimed, ring_capacity), written);
+            for (size_t i = overwritten > first ? overwritten - first : 0; i < read.size(); i++) {
+                if (read[i].name && read[i].end >= from) {
+                    zones.push_back(read[i]);
+                }
+            }
+        }
+    }
+
+    FILE *f = std::fopen(p.string().c_str(), "w");
+    if (!f) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    std::fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    const char *separator = "\n";
+    for (size_t i = 0; i < names.size(); i++) {
+        std::fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": \"%s\"}}",
+                     separator, i + 1, names[i].c_str());
+        separator = ",\n";
+    }
+    for (const saved_zone &z : zones) {
+        // Zones that started before the window are cut to it
+        const uint64_t begin = std::max(z.begin, from);
+        std::fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f}", separator,
+                     z.name, z.thread + 1, static_cast<double>(begin - from) / ticks_per_us,
+                     static_cast<double>(z.end - begin) / ticks_per_us);
+        separator = ",\n";
+    }
+    std::fprintf(f, "\n]}\n");
+    const bool ok = std::ferror(f) == 0;
+    if (std::fclose(f) != 0 || !ok) {
+        throw std::runtime_error("Could not write " + p.string());
+    }
+    return zones.size();
+}
@@ -0,0 +1,128 @@
+#ifndef IMNES_TIMELINE_H
+#define IMNES_TIMELINE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// A timeline of what each thread has been doing, for finding what makes a frame slow
+// Zones are written to a ring per thread, which only that thread writes, so recording one takes no locks: two reads of
+// the time stamp counter and a few stores. The rings hold the last few seconds, which save_timeline writes out in the
+// Chrome trace format, for chrome://tracing or https://ui.perfetto.dev
+// Built in with IMNES_ENABLE_TIMELINE. Without it IMNES_ZONE compiles to nothing and nothing is recorded
+
+#ifdef IMNES_ENABLE_TIMELINE
+static constexpr bool timeline_available = true;
+#define IMNES_ZONE_CONCAT(a, b) a##b
+#define IMNES_ZONE_VAR(line) IMNES_ZONE_CONCAT(imnes_zone_, line)
+// Time from here to the end of the scope. name must be a string literal, or otherwise live for the whole run
+#define IMNES_ZONE(name) const TimelineZone IMNES_ZONE_VAR(__LINE__)(name)
+#else
+static constexpr bool timeline_available = false;
+#define IMNES_ZONE(name) static_cast<void>(0)
+#endif
+
+// The time stamp counter where there is one, otherwise the steady clock, in ticks
+// The counter has to run at a constant rate and agree between cores, which it does on x86 CPUs from the last 15 years
+inline uint64_t timeline_now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+// Whether PPUs record a zone per scanline. That is a read of the time stamp counter every scanline of every console,
+// which adds up over a headless run of thousands of frames, so it is off until turned on
+inline std::atomic<bool> timeline_scanlines{false};
+
+// A thread's zones. Only that thread writes to it, save_timeline reads it from another
+// Defined here so that recording a zone is inlined in to the scope it times
+struct timeline_ring
+{
+    // The last this many zones are kept
+    static constexpr size_t capacity = 1u << 18u;
+
+    // Atomic only so that save_timeline can read a ring while its thread writes to it. Relaxed loads and stores of
+    // these are plain loads and stores
+    struct zone
+    {
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> begin{0};
+        std::atomic<uint64_t> end{0};
+    };
+
+    zone *zones = nullptr;
+    // Zones started and finished. Each zone is claimed before its slot is written, so that a reader can tell which
+    // of the zones it read may have been written over while it read them
+    std::atomic<uint64_t> claimed{0};
+    std::atomic<uint64_t> written{0};
+
+    void record(const char *name, uint64_t begin, uint64_t end) {
+        const uint64_t n = written.load(std::memory_order_relaxed);
+        claimed.store(n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        zone &z = zones[n & (capacity - 1)];
+        z.name.store(name, std::memory_order_relaxed);
+        z.begin.store(begin, std::memory_order_relaxed);
+        z.end.store(end, std::memory_order_relaxed);
+        written.store(n + 1, std::memory_order_release);
+    }
+};
+
+// Set the first time a thread records. constinit, so that reaching it needs no thread local initialisation check
+inline constinit thread_local timeline_ring *timeline_this_thread_ring = nullptr;
+
+// Give this thread a ring. Use timeline_thread_ring
+timeline_ring &timeline_new_thread_ring();
+
+// This thread's ring
+inline timeline_ring &timeline_thread_ring() {
+    if (timeline_this_thread_ring) [[likely]] {
+        return *timeline_this_thread_ring;
+    }
+    return timeline_new_thread_ring();
+}
+
+// Add a zone that ran from begin to end (timeline_now ticks) to this thread's ring, for zones that aren't a scope
+// name must live for the whole run
+inline void timeline_record(const char *name, uint64_t begin, uint64_t end) {
+    if constexpr (timeline_available) {
+        timeline_thread_ring().record(name, begin, end);
+    } else {
+        static_cast<void>(name);
+        static_cast<void>(begin);
+        static_cast<void>(end);
+    }
+}
+
+// Name this thread in saved timelines
+void timeline_set_thread_name(const char *name);
+
+// Write the zones that ended in the last seconds as a Chrome trace, and return how many there were
+// N.B. throws runtime_error if the file can't be written
+size_t save_timeline(const std::filesystem::path &p, double seconds);
+
+class TimelineZone {
+public:
+    // The ring is found before the clock is read, so that finding it isn't timed
+    explicit TimelineZone(const char *zone_name) : ring(timeline_thread_ring()), name(zone_name), begin(timeline_now()) {}
+    ~TimelineZone() { ring.record(name, begin, timeline_now()); }
+    TimelineZone(const TimelineZone &) = delete;
+    TimelineZone &operator=(const TimelineZone &) = delete;
+
+private:
+    timeline_ring &ring;
+    const char *name;
+    uint64_t begin;
+};
+
+
+#endif //IMNES_TIMELINE_H
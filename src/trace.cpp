@@ -0,0 +1,79 @@
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "trace.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define IMNES_HAVE_MMAP 1
+#endif
+
+size_t trace_storage_size(size_t capacity) {
+    return sizeof(TraceBuffer::header) + std::bit_ceil(capacity) * sizeof(trace_record);
+}
+
+TraceBuffer::TraceBuffer(size_t capacity) {
+    memory = std::make_unique<uint8_t[]>(trace_storage_size(capacity));
+    init(memory.get(), capacity);
+}
+
+TraceBuffer::TraceBuffer(const std::filesystem::path &p, size_t capacity) {
+#ifdef IMNES_HAVE_MMAP
+    const size_t size = trace_storage_size(capacity);
+    const int fd = ::open(p.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not create trace file " + p.string());
+    }
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not size trace file " + p.string());
+    }
+    // Shared, so the kernel writes the pages back even if we die
+    void *m = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m == MAP_FAILED) {
+        throw std::runtime_error("Could not map trace file " + p.string());
+    }
+    mapping = m;
+    mapping_size = size;
+    init(static_cast<uint8_t *>(m), capacity);
+#else
+    (void)p;
+    (void)capacity;
+    throw std::runtime_error("Memory mapped traces aren't supported on this platform, use an in memory trace and save it");
+#endif
+}
+
+TraceBuffer::~TraceBuffer() {
+#ifdef IMNES_HAVE_MMAP
+    if (mapping) {
+        ::munmap(mapping, mapping_size);
+    }
+#endif
+}
+
+void TraceBuffer::init(uint8_t *storage, size_t capacity) {
+    hdr = reinterpret_cast<header *>(storage);
+    records = reinterpret_cast<trace_record *>(storage + sizeof(header));
+    mask = std::bit_ceil(capacity) - 1;
+    std::memcpy(hdr->magic, magic, sizeof(magic));
+    hdr->version = version;
+    hdr->record_size = sizeof(trace_record);
+    hdr->capacity = mask + 1;
+    hdr->written = 0;
+}
+
+void TraceBuffer::save(const std::filesystem::path &p) const {
+    std::ofstream file(p, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Could not create trace file " + p.string());
+    }
+    file.write(reinterpret_cast<const char *>(hdr), static_cast<std::streamsize>(sizeof(header) + capacity() * sizeof(trace_record)));
+    if (!file) {
+        throw std::runtime_error("Could not write trace file " + p.string());
+    }
+}
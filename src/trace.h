@@ -0,0 +1,94 @@
+#ifndef IMNES_TRACE_H
+#define IMNES_TRACE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <type_traits>
+
+// One executed instruction, taken before it runs
+struct trace_record
+{
+    enum flag : uint8_t
+    {
+        INTERRUPT = 1u << 0u, // Entering an NMI or IRQ rather than executing the instruction at pc
+    };
+
+    uint64_t cycle;
+    uint16_t pc;
+    uint16_t scanline;
+    uint16_t dot;
+    uint8_t bytes[3]; // Opcode and operand. Bytes past the instruction length are whatever follows it
+    uint8_t a, x, y, s, p;
+    uint8_t flags;
+};
+static_assert(sizeof(trace_record) == 24 && std::is_trivially_copyable_v<trace_record>);
+
+// Fixed size ring of trace records, either in memory or in a memory mapped file
+// The file is the header followed by the ring, so after a crash it still holds the last capacity() instructions
+class TraceBuffer {
+public:
+    struct header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t capacity;
+        uint64_t written; // Total records appended. The oldest record is at written - capacity (if it has wrapped)
+    };
+    static constexpr char magic[8] = {'I', 'M', 'N', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t version = 1;
+
+    // capacity is rounded up to a power of two
+    explicit TraceBuffer(size_t capacity);
+
+    // N.B. throws runtime_error if the file can't be created and mapped
+    TraceBuffer(const std::filesystem::path &p, size_t capacity);
+
+    ~TraceBuffer();
+    TraceBuffer(const TraceBuffer &) = delete;
+    TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+    void append(const trace_record &r) {
+        next() = r;
+        commit();
+    }
+
+    // Fill in the record from next() then commit() it. Saves building the record twice on the hot path
+    trace_record &next() { return records[head & mask]; }
+    void commit() { hdr->written = ++head; }
+
+    void clear() { head = hdr->written = 0; }
+
+    size_t capacity() const { return mask + 1; }
+
+    // Number of records held
+    size_t size() const { return head < capacity() ? head : capacity(); }
+
+    uint64_t written() const { return head; }
+
+    // i = 0 is the oldest record held
+    const trace_record &operator[](size_t i) const { return records[(head - size() + i) & mask]; }
+
+    // Writes the header and records, in the same format as a mapped file
+    // N.B. throws runtime_error on failure
+    void save(const std::filesystem::path &p) const;
+
+private:
+    void init(uint8_t *storage, size_t capacity);
+
+    std::unique_ptr<uint8_t[]> memory;
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+
+    header *hdr = nullptr;
+    trace_record *records = nullptr;
+    uint64_t head = 0;
+    size_t mask = 0;
+};
+
+// Bytes needed for a ring of capacity records, including the header
+size_t trace_storage_size(size_t capacity);
+
+
+#endif //IMNES_TRACE_H
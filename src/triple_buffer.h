@@ -0,0 +1,47 @@
+#ifndef IMNES_TRIPLE_BUFFER_H
+#define IMNES_TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Single producer, single consumer "latest value" exchange
+// The writer fills back() and calls publish(), the reader calls update() and then reads front()
+// Neither side ever blocks, and the reader always sees a complete value
+// See https://remis-thoughts.blogspot.com/2012/01/triple-buffering-as-concurrency_30.html
+template<typename T>
+class triple_buffer {
+public:
+    // Writer side
+    T &back() { return slots[back_index]; }
+
+    void publish() {
+        back_index = static_cast<uint8_t>(middle.exchange(static_cast<uint8_t>(back_index | fresh_bit), std::memory_order_acq_rel) & index_mask);
+    }
+
+    // Reader side
+    // Returns true if a newer value was picked up
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & fresh_bit) == 0) {
+            return false;
+        }
+        front_index = static_cast<uint8_t>(middle.exchange(front_index, std::memory_order_acq_rel) & index_mask);
+        return true;
+    }
+
+    const T &front() const { return slots[front_index]; }
+
+    T &front() { return slots[front_index]; }
+
+private:
+    static constexpr uint8_t fresh_bit = 0x4;
+    static constexpr uint8_t index_mask = 0x3;
+
+    std::array<T, 3> slots{};
+    uint8_t back_index = 0;
+    std::atomic<uint8_t> middle{1};
+    uint8_t front_index = 2;
+};
+
+
+#endif //IMNES_TRIPLE_BUFFER_H
@@ -0,0 +1,183 @@
+#include <charconv>
+#include <cstring>
+#include <string_view>
+
+#include "verify.h"
+
+namespace {
+
+// Value of a hex or decimal field, false if it isn't a number
+template<typename T>
+bool parseField(std::string_view text, int base, T &out) {
+    uint64_t v = 0;
+    const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), v, base);
+    if (ec != std::errc{} || end == text.data()) {
+        return false;
+    }
+    out = static_cast<T>(v);
+    return true;
+}
+
+}
+
+ReferenceTrace::ReferenceTrace(const std::filesystem::path &p) : file(p, std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    file.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+    is_binary = file && std::memcmp(hdr.magic, TraceBuffer::magic, sizeof(hdr.magic)) == 0;
+    if (is_binary) {
+        if (hdr.version != TraceBuffer::version || hdr.record_size != sizeof(trace_record) || hdr.capacity == 0 ||
+            (hdr.capacity & (hdr.capacity - 1)) != 0) {
+            throw std::runtime_error(p.string() + " is a trace from a different version of imnes");
+        }
+        // Start from the oldest record held
+        index = hdr.written - std::min(hdr.written, hdr.capacity);
+    } else {
+        file.clear();
+        file.seekg(0);
+    }
+}
+
+bool ReferenceTrace::next(reference_step &step) {
+    if (!is_binary) {
+        while (std::getline(file, line)) {
+            index++;
+            if (parse_reference_line(line, step)) {
+                step.line = index;
+                step.text = line;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (index == hdr.written) {
+        return false;
+    }
+    const uint64_t slot = index & (hdr.capacity - 1);
+    // Records are read in order, so only seek at the start and where the ring wraps
+    if (index == hdr.written - std::min(hdr.written, hdr.capacity) || slot == 0) {
+        file.seekg(static_cast<std::streamoff>(sizeof(hdr) + slot * sizeof(trace_record)));
+    }
+    trace_record r{};
+    if (!file.read(reinterpret_cast<char *>(&r), sizeof(r))) {
+        throw std::runtime_error("Trace file is truncated");
+    }
+    index++;
+    step.fields = reference_step::PC | reference_step::A | reference_step::X | reference_step::Y | reference_step::P |
+                  reference_step::S | reference_step::CYCLE | reference_step::INTERRUPT;
+    step.pc = r.pc;
+    step.a = r.a;
+    step.x = r.x;
+    step.y = r.y;
+    step.p = r.p;
+    step.s = r.s;
+    step.cycle = r.cycle;
+    step.interrupt = r.flags & trace_record::INTERRUPT;
+    step.line = index - (hdr.written - std::min(hdr.written, hdr.capacity));
+    step.text.clear();
+    return true;
+}
+
+bool parse_reference_line(std::string_view line, reference_step &step) {
+    step = reference_step{};
+    if (line.size() < 4 || !parseField(line.substr(0, 4), 16, step.pc)) {
+        return false;
+    }
+    step.fields = reference_step::PC;
+
+    struct register_field
+    {
+        std::string_view name;
+        reference_step::field field;
+        uint8_t *value;
+    };
+    const std::array<register_field, 6> registers = {{
+            {"A:", reference_step::A, &step.a},
+            {"X:", reference_step::X, &step.x},
+            {"Y:", reference_step::Y, &step.y},
+            {"P:", reference_step::P, &step.p},
+            {"SP:", reference_step::S, &step.s},
+            {"S:", reference_step::S, &step.s},
+    }};
+    // Whitespace separated tokens, after the instruction bytes and disassembly which can't contain them
+    size_t pos = 4;
+    while (pos < line.size()) {
+        const size_t start = line.find_first_not_of(' ', pos);
+        if (start == std::string_view::npos) {
+            break;
+        }
+        pos = std::min(line.find(' ', start), line.size());
+        const std::string_view token = line.substr(start, pos - start);
+        if (token.starts_with("CYC:")) {
+            if (parseField(token.substr(4), 10, step.cycle)) {
+                step.fields |= reference_step::CYCLE;
+            }
+            continue;
+        }
+        for (const register_field &r : registers) {
+            if (token.size() == r.name.size() + 2 && token.starts_with(r.name) && parseField(token.substr(r.name.size()), 16, *r.value)) {
+                step.fields |= r.field;
+            }
+        }
+    }
+    return true;
+}
+
+trace_mismatch compare_with_trace(Console &console, ReferenceTrace &reference, uint64_t max_steps) {
+    trace_mismatch m;
+    TraceBuffer actual(1);
+    TraceBuffer *const previous = console.trace();
+    console.setTrace(&actual);
+
+    bool first = true;
+    reference_step expected;
+    while ((max_steps == 0 || m.steps < max_steps) && reference.next(expected)) {
+        if (first && reference.binary() && console.cycles < expected.cycle) {
+            console.setTrace(nullptr);
+            console.runCycles(expected.cycle - console.cycles);
+            console.setTrace(&actual);
+        }
+        // Text traces don't list interrupt entries, so step through them
+        do {
+            console.step();
+        } while (!(expected.fields & reference_step::INTERRUPT) && (actual[0].flags & trace_record::INTERRUPT));
+        const trace_record &r = actual[0];
+        if (first && !reference.binary() && (expected.fields & reference_step::CYCLE)) {
+            m.cycle_offset = static_cast<int64_t>(expected.cycle - r.cycle);
+        }
+        first = false;
+
+        unsigned fields = 0;
+        fields |= r.pc != expected.pc ? reference_step::PC : 0u;
+        fields |= r.a != expected.a ? reference_step::A : 0u;
+        fields |= r.x != expected.x ? reference_step::X : 0u;
+        fields |= r.y != expected.y ? reference_step::Y : 0u;
+        fields |= r.p != expected.p ? reference_step::P : 0u;
+        fields |= r.s != expected.s ? reference_step::S : 0u;
+        fields |= r.cycle + static_cast<uint64_t>(m.cycle_offset) != expected.cycle ? reference_step::CYCLE : 0u;
+        fields |= bool(r.flags & trace_record::INTERRUPT) != expected.interrupt ? reference_step::INTERRUPT : 0u;
+        fields &= expected.fields;
+        if (fields != 0) {
+            m.found = true;
+            m.expected = expected;
+            m.actual = r;
+            m.fields = fields;
+            break;
+        }
+        m.steps++;
+    }
+    console.setTrace(previous);
+    return m;
+}
+
+void ConsoleCore::memory(std::span<uint8_t, 0x10000> out) const {
+    console->bus.flat_ram.copyTo(out);
+}
+
+void LockstepCore::memory(std::span<uint8_t, 0x10000> out) const {
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = cpus->peek(0, static_cast<uint16_t>(i));
+    }
+}
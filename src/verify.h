@@ -0,0 +1,296 @@
+#ifndef IMNES_VERIFY_H
+#define IMNES_VERIFY_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "console.h"
+#include "Cpu6502.h"
+#include "hash.h"
+#include "lockstep.h"
+#include "trace.h"
+
+// Checking one run of a program against another, to find the first instruction where they part
+
+// One instruction of a reference trace, as the machine was before it ran
+struct reference_step
+{
+    // The fields the trace gave. Only those are compared
+    enum field : unsigned
+    {
+        PC = 1u << 0u,
+        A = 1u << 1u,
+        X = 1u << 2u,
+        Y = 1u << 3u,
+        P = 1u << 4u,
+        S = 1u << 5u,
+        CYCLE = 1u << 6u,
+        INTERRUPT = 1u << 7u,
+    };
+
+    unsigned fields = 0;
+    uint16_t pc = 0;
+    uint8_t a = 0, x = 0, y = 0, p = 0, s = 0;
+    uint64_t cycle = 0;
+    bool interrupt = false;
+    uint64_t line = 0;  // Line of a text trace, or record of a binary one, from 1
+    std::string text;   // The line, for text traces
+};
+
+// Reads a reference trace: either a binary trace from TraceBuffer (saved or memory mapped), whose records are
+// compared in full, or a text log in the style of nestest.log
+// ("C000  4C F5 C5  JMP $C5F5    A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7"). Text logs only need the PC first
+// on the line; A:, X:, Y:, P:, SP: (or S:) and CYC: are compared when they are there
+class ReferenceTrace {
+public:
+    // N.B. throws runtime_error if the file can't be opened or is a binary trace of a different version
+    explicit ReferenceTrace(const std::filesystem::path &p);
+
+    // The next instruction, or false at the end of the trace
+    // N.B. throws runtime_error if a binary trace is truncated
+    bool next(reference_step &step);
+
+    // Binary traces have the console's own cycle counts, and may start part way through a run
+    bool binary() const { return is_binary; }
+
+private:
+    std::ifstream file;
+    bool is_binary = false;
+    TraceBuffer::header hdr{};
+    uint64_t index = 0; // Next record or line
+    std::string line;
+};
+
+// Parse one line of a nestest.log style trace. False if it doesn't start with a PC
+bool parse_reference_line(std::string_view line, reference_step &step);
+
+struct trace_mismatch
+{
+    bool found = false;
+    uint64_t steps = 0;          // Reference instructions that matched
+    int64_t cycle_offset = 0;    // Added to the console's cycles to get the reference's
+    reference_step expected;     // At the mismatch
+    trace_record actual{};
+    unsigned fields = 0;         // reference_step::field that differ
+};
+
+// Steps the console one instruction at a time alongside the reference, comparing their states before each one, and
+// stops at the first difference or the end of the reference
+// A text trace's cycles are compared relative to its first line (nestest.log starts at 7, after the reset). Interrupt
+// entries only count as instructions when the reference is a binary trace, which records them. The console is
+// run forward to the start of a binary trace that doesn't start at the beginning. max_steps of 0 is the whole trace
+trace_mismatch compare_with_trace(Console &console, ReferenceTrace &reference, uint64_t max_steps = 0);
+
+struct divergence_options
+{
+    uint64_t cycles = 0;                // Compare this many CPU cycles
+    uint64_t check_interval = 1000000;  // Cycles between state hashes
+    uint64_t step_below = 256;          // Stop bisecting and step instructions once the gap is this many cycles
+};
+
+// The first instruction after which two cores' states differ
+struct divergence
+{
+    bool found = false;
+    uint64_t cycle = 0;                   // Where that instruction started, in both
+    Cpu6502 before{};                     // Registers going in to it, the same in both
+    Cpu6502 a{}, b{};                     // Registers after it
+    uint64_t a_cycles = 0, b_cycles = 0;  // Cycles after it
+    std::vector<uint16_t> memory;         // Addresses that differ after it, lowest first, up to max_memory
+    static constexpr size_t max_memory = 16;
+
+    // Work done
+    uint64_t checks = 0;       // State hashes compared
+    uint64_t bisections = 0;   // Reruns from a keyframe
+    uint64_t steps = 0;        // Instructions stepped at the end
+};
+
+// A core for find_divergence. Each has a keyframe it can go back to, and 64K of memory to compare
+// Runs a flat image on the console
+class ConsoleCore {
+public:
+    ConsoleCore(std::span<const uint8_t> image, uint16_t load_addr, uint16_t start_pc)
+            : console(std::make_unique<Console>(image, load_addr, start_pc)) {}
+
+    uint64_t cycles() const { return console->cycles; }
+    Cpu6502 registers() const { return console->cpu; }
+    void memory(std::span<uint8_t, 0x10000> out) const;
+    // Stops at the first instruction boundary at or after cycle, as Console::runCycles
+    void runTo(uint64_t cycle) {
+        if (console->cycles < cycle) {
+            console->runCycles(cycle - console->cycles);
+        }
+    }
+    void step() { console->step(); }
+    void save() { keyframe = console->fork(); }
+    void restore() { console = keyframe->fork(); }
+
+    Console &get() { return *console; }
+
+private:
+    std::unique_ptr<Console> console;
+    std::unique_ptr<Console> keyframe;
+};
+
+// Runs a flat image on a one lane lockstep engine, so every step it has a vector version of goes through that code
+// rather than Cpu6502::step. The rest (BRK, RTI, decimal mode) go through the same scalar core as the console
+class LockstepCore {
+public:
+    using engine = LockstepCpus<1>;
+
+    LockstepCore(std::span<const uint8_t> image, uint16_t load_addr, uint16_t start_pc)
+            : cpus(std::make_unique<engine>(image, load_addr, start_pc)) {}
+
+    uint64_t cycles() const { return cpus->cycles[0]; }
+    Cpu6502 registers() const { return cpus->cpu(0); }
+    void memory(std::span<uint8_t, 0x10000> out) const;
+    void runTo(uint64_t cycle) {
+        if (cpus->cycles[0] < cycle) {
+            cpus->runCycles(cycle - cpus->cycles[0]);
+        }
+    }
+    void step() { cpus->runCycles(1); }
+    void save() { keyframe = std::make_unique<engine>(*cpus); }
+    void restore() {
+        // The steps being thrown away still ran
+        discarded.vector_steps += cpus->getStats().vector_steps - keyframe->getStats().vector_steps;
+        discarded.vector_lanes += cpus->getStats().vector_lanes - keyframe->getStats().vector_lanes;
+        discarded.scalar_steps += cpus->getStats().scalar_steps - keyframe->getStats().scalar_steps;
+        *cpus = *keyframe;
+    }
+
+    // Every step run, including those since thrown away by restore()
+    engine::stats stats() const {
+        engine::stats s = cpus->getStats();
+        s.vector_steps += discarded.vector_steps;
+        s.vector_lanes += discarded.vector_lanes;
+        s.scalar_steps += discarded.scalar_steps;
+        return s;
+    }
+
+private:
+    std::unique_ptr<engine> cpus;
+    std::unique_ptr<engine> keyframe;
+    engine::stats discarded;
+};
+
+// Runs both cores to cycle, the second on its own thread, as they don't share anything
+template<typename A, typename B>
+void run_both_to(A &a, B &b, uint64_t cycle) {
+    std::thread other([&b, cycle] { b.runTo(cycle); });
+    a.runTo(cycle);
+    other.join();
+}
+
+// Registers, cycles and memory of a core, hashed
+// Fills memory, which is then the core's 64K
+template<typename Core>
+uint64_t core_hash(const Core &core, std::span<uint8_t, 0x10000> memory) {
+    const Cpu6502 r = core.registers();
+    const std::array<uint8_t, 8> regs = {r.a, r.x, r.y, r.s, r.p, static_cast<uint8_t>(r.pc), static_cast<uint8_t>(r.pc >> 8u), 0};
+    const uint64_t cycles = core.cycles();
+    core.memory(memory);
+    Hash64 h;
+    h.update(regs);
+    h.update(&cycles, sizeof(cycles));
+    h.update(memory);
+    return h.digest();
+}
+
+// Runs two cores from the same state for opt.cycles, and finds the first instruction where they differ
+// Only a hash of each core's state is compared, every check_interval cycles, with a keyframe kept at the last check
+// that matched. When a check fails, both cores go back to the keyframe and the gap is bisected with more hashes until
+// it is under step_below cycles, then the cores are stepped an instruction at a time to find the exact one. So a
+// difference half a billion cycles in costs the run to get there, plus a few reruns of one interval. The cores run on
+// a thread each between checks
+// N.B. throws runtime_error if the cores don't repeat themselves when rerun from a keyframe
+template<typename A, typename B>
+divergence find_divergence(A &a, B &b, const divergence_options &opt) {
+    divergence d;
+    std::vector<uint8_t> memory_a(0x10000);
+    std::vector<uint8_t> memory_b(0x10000);
+    const auto same = [&] {
+        d.checks++;
+        return core_hash(a, std::span<uint8_t, 0x10000>(memory_a)) == core_hash(b, std::span<uint8_t, 0x10000>(memory_b));
+    };
+    const auto report = [&](const Cpu6502 &before, uint64_t cycle) {
+        d.found = true;
+        d.cycle = cycle;
+        d.before = before;
+        d.a = a.registers();
+        d.b = b.registers();
+        d.a_cycles = a.cycles();
+        d.b_cycles = b.cycles();
+        for (size_t i = 0; i < memory_a.size() && d.memory.size() < divergence::max_memory; i++) {
+            if (memory_a[i] != memory_b[i]) {
+                d.memory.push_back(static_cast<uint16_t>(i));
+            }
+        }
+        return d;
+    };
+
+    if (!same()) {
+        return report(a.registers(), a.cycles());
+    }
+    a.save();
+    b.save();
+    uint64_t lo = a.cycles();
+    const uint64_t end = lo + opt.cycles;
+    while (lo < end) {
+        uint64_t hi = std::min(lo + std::max<uint64_t>(opt.check_interval, 1), end);
+        run_both_to(a, b, hi);
+        if (same()) {
+            a.save();
+            b.save();
+            lo = a.cycles();
+            continue;
+        }
+
+        while (hi - lo > opt.step_below) {
+            const uint64_t mid = lo + (hi - lo) / 2;
+            a.restore();
+            b.restore();
+            run_both_to(a, b, mid);
+            d.bisections++;
+            if (same()) {
+                a.save();
+                b.save();
+                lo = a.cycles();
+                if (lo >= hi) {
+                    break;
+                }
+            } else {
+                hi = mid;
+            }
+        }
+
+        a.restore();
+        b.restore();
+        // The states differed at the first boundary at or after hi, so the instruction that made them differ starts
+        // before it
+        while (a.cycles() < hi + opt.step_below) {
+            const Cpu6502 before = a.registers();
+            const uint64_t cycle = a.cycles();
+            a.step();
+            b.step();
+            d.steps++;
+            if (!same()) {
+                return report(before, cycle);
+            }
+        }
+        throw std::runtime_error("The cores differed at cycle " + std::to_string(hi) + ", but not when rerun");
+    }
+    return d;
+}
+
+
+#endif //IMNES_VERIFY_H
@@ -0,0 +1,131 @@
+#include <algorithm>
+
+#include "work_stealing_pool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+WorkStealingPool::WorkStealingPool(unsigned count, bool pin)
+        : ranges(count != 0 ? count : std::max(1u, std::thread::hardware_concurrency())) {
+    for (unsigned i = 0; i < ranges.size(); i++) {
+        threads.emplace_back(&WorkStealingPool::work, this, i, pin);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard lock(mutex);
+        quit = true;
+    }
+    start.notify_all();
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+void WorkStealingPool::forEach(size_t count, const std::function<void(size_t, unsigned)> &job) {
+    const size_t n = ranges.size();
+    for (size_t i = 0; i < n; i++) {
+        std::lock_guard lock(ranges[i].mutex);
+        ranges[i].begin = count * i / n;
+        ranges[i].end = count * (i + 1) / n;
+    }
+    std::unique_lock lock(mutex);
+    current = &job;
+    error = nullptr;
+    running = static_cast<unsigned>(n);
+    generation++;
+    start.notify_all();
+    done.wait(lock, [this] { return running == 0; });
+    current = nullptr;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void WorkStealingPool::work(unsigned worker, bool pin) {
+#ifdef __linux__
+    if (pin) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker % std::max(1u, std::thread::hardware_concurrency()), &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)pin;
+#endif
+    uint64_t seen = 0;
+    while (true) {
+        const std::function<void(size_t, unsigned)> *job;
+        {
+            std::unique_lock lock(mutex);
+            start.wait(lock, [this, seen] { return quit || generation != seen; });
+            if (quit) {
+                return;
+            }
+            seen = generation;
+            job = current;
+        }
+        size_t index;
+        while (take(worker, index)) {
+            try {
+                (*job)(index, worker);
+            } catch (...) {
+                std::lock_guard lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        std::lock_guard lock(mutex);
+        if (--running == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+bool WorkStealingPool::take(unsigned worker, size_t &index) {
+    {
+        range &own = ranges[worker];
+        std::lock_guard lock(own.mutex);
+        if (own.begin != own.end) {
+            index = own.begin++;
+            return true;
+        }
+    }
+    // Steal the back half of the fullest range. Sizes can change once each lock is dropped, so retry if it has gone
+    for (size_t attempt = 0; attempt < ranges.size(); attempt++) {
+        size_t victim = ranges.size();
+        size_t most = 0;
+        for (size_t i = 0; i < ranges.size(); i++) {
+            std::lock_guard lock(ranges[i].mutex);
+            if (ranges[i].end - ranges[i].begin > most) {
+                most = ranges[i].end - ranges[i].begin;
+                victim = i;
+            }
+        }
+        if (victim == ranges.size()) {
+            return false;
+        }
+        size_t begin;
+        size_t end;
+        {
+            std::lock_guard lock(ranges[victim].mutex);
+            const size_t left = ranges[victim].end - ranges[victim].begin;
+            if (left == 0) {
+                continue;
+            }
+            end = ranges[victim].end;
+            begin = end - (left + 1) / 2;
+            ranges[victim].end = begin;
+        }
+        std::lock_guard lock(ranges[worker].mutex);
+        ranges[worker].begin = begin + 1;
+        ranges[worker].end = end;
+        index = begin;
+        return true;
+    }
+    return false;
+}
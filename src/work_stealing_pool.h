@@ -0,0 +1,58 @@
+#ifndef IMNES_WORK_STEALING_POOL_H
+#define IMNES_WORK_STEALING_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for running many independent jobs, such as one console each
+// forEach() splits the index range evenly between the workers. A worker that runs out takes the back half of
+// whatever another has left, so uneven jobs still finish together. Workers can be pinned one per core
+class WorkStealingPool {
+public:
+    // threads of 0 means one per core. pin is ignored where thread affinity isn't supported
+    explicit WorkStealingPool(unsigned threads = 0, bool pin = false);
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // Calls job(index, worker) for every index in [0, count), and returns once they are all done
+    // One forEach at a time. If a job throws, the first exception is rethrown here once the rest have finished
+    void forEach(size_t count, const std::function<void(size_t index, unsigned worker)> &job);
+
+    unsigned size() const { return static_cast<unsigned>(threads.size()); }
+
+private:
+    // Indices a worker has yet to run
+    struct alignas(64) range
+    {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void work(unsigned worker, bool pin);
+    bool take(unsigned worker, size_t &index);
+
+    std::vector<range> ranges;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    unsigned running = 0;
+    bool quit = false;
+    const std::function<void(size_t, unsigned)> *current = nullptr;
+    std::exception_ptr error;
+
+    std::vector<std::thread> threads;
+};
+
+
+#endif //IMNES_WORK_STEALING_POOL_H
@@ -0,0 +1,195 @@
+// Checks that the steady state frame loop doesn't use the heap
+// A small NROM program is run that turns on NMIs and rendering, and does OAM DMA, PPU register and VRAM writes and
+// controller reads every frame. Each frame is drawn and saved for rewinding, and every few frames one is loaded back,
+// as the emulator does. Once warmed up, none of that may allocate
+// With IMNES_ENABLE_ALLOCATION_GUARD the frames run in an armed allocation free scope, so an allocation aborts with a
+// stack trace. Otherwise this test counts allocations with its own operator new
+// Exits 0 if there were none, 1 if there were, 2 on error
+// Usage: imnes-allocation-free
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "allocation_guard.h"
+#include "console.h"
+#include "ines.h"
+#include "machine_state.h"
+#include "ppu_render.h"
+#include "timeline.h"
+
+#ifndef IMNES_ENABLE_ALLOCATION_GUARD
+namespace {
+std::atomic<uint64_t> allocations{0};
+}
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(void *p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+namespace {
+
+constexpr unsigned warm_up_frames = 120;
+constexpr unsigned checked_frames = 600;
+constexpr unsigned load_interval = 10;
+
+uint64_t allocationCount()
+{
+#ifdef IMNES_ENABLE_ALLOCATION_GUARD
+    return thread_allocation_counts().allocations;
+#else
+    return allocations.load(std::memory_order_relaxed);
+#endif
+}
+
+// NROM-128, with code at $C000 and the NMI handler at $C100
+std::vector<uint8_t> testRom()
+{
+    std::vector<uint8_t> prg(0x4000);
+    const auto put = [&prg](uint16_t addr, std::initializer_list<uint8_t> bytes) {
+        std::copy(bytes.begin(), bytes.end(), prg.begin() + (addr - 0xC000));
+    };
+    put(0xC000, {
+            0x78,             // SEI
+            0xD8,             // CLD
+            0xA2, 0xFF,       // LDX #$FF
+            0x9A,             // TXS
+            0xA9, 0x80,       // LDA #$80
+            0x8D, 0x00, 0x20, // STA $2000   NMI on
+            0xA9, 0x1E,       // LDA #$1E
+            0x8D, 0x01, 0x20, // STA $2001   Background and sprites on
+            // loop:
+            0xAD, 0x02, 0x20, // LDA $2002
+            0xE6, 0x10,       // INC $10
+            0xA5, 0x10,       // LDA $10
+            0x8D, 0x00, 0x02, // STA $0200   First sprite's Y
+            0x4C, 0x0F, 0xC0, // JMP loop
+    });
+    put(0xC100, {
+            0x48,             // PHA
+            0xA9, 0x00,       // LDA #$00
+            0x8D, 0x03, 0x20, // STA $2003
+            0xA9, 0x02,       // LDA #$02
+            0x8D, 0x14, 0x40, // STA $4014   OAM DMA from $0200
+            0xA9, 0x20,       // LDA #$20
+            0x8D, 0x06, 0x20, // STA $2006
+            0xA9, 0x00,       // LDA #$00
+            0x8D, 0x06, 0x20, // STA $2006
+            0xA5, 0x10,       // LDA $10
+            0x8D, 0x07, 0x20, // STA $2007   A nametable byte
+            0xA9, 0x01,       // LDA #$01
+            0x8D, 0x16, 0x40, // STA $4016
+            0xA9, 0x00,       // LDA #$00
+            0x8D, 0x16, 0x40, // STA $4016
+            0xAD, 0x16, 0x40, // LDA $4016   Controller 1's A button
+            0x8D, 0x05, 0x20, // STA $2005
+            0x8D, 0x05, 0x20, // STA $2005
+            0x68,             // PLA
+            0x40,             // RTI
+    });
+    put(0xFFFA, {0x00, 0xC1, 0x00, 0xC0, 0x00, 0xC0});
+
+    std::vector<uint8_t> rom = {'N', 'E', 'S', 0x1A, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    rom.insert(rom.end(), prg.begin(), prg.end());
+    std::vector<uint8_t> chr(0x2000);
+    for(size_t i = 0; i < chr.size(); i++)
+    {
+        chr[i] = static_cast<uint8_t>(i * 37u);
+    }
+    rom.insert(rom.end(), chr.begin(), chr.end());
+    return rom;
+}
+
+std::shared_ptr<const Ines> loadTestRom()
+{
+    const std::filesystem::path p = std::filesystem::temp_directory_path() / "imnes-allocation-free.nes";
+    const std::vector<uint8_t> bytes = testRom();
+    {
+        std::ofstream file(p, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if(!file)
+        {
+            throw std::runtime_error("Could not write " + p.string());
+        }
+    }
+    auto rom = std::make_shared<const Ines>(p);
+    std::filesystem::remove(p);
+    return rom;
+}
+
+}
+
+int main()
+{
+    try
+    {
+        Console console(loadTestRom());
+        // Everything the loop needs is made up front, as the emulation thread's are
+        std::vector<uint8_t> frame(frame_pixels);
+        auto states = std::make_unique<std::array<machine_state, 2>>();
+        timeline_scanlines.store(true, std::memory_order_relaxed);
+
+        uint64_t before = 0;
+        for(unsigned i = 0; i < warm_up_frames + checked_frames; i++)
+        {
+            if(i == warm_up_frames)
+            {
+                before = allocationCount();
+                arm_allocation_guard(true);
+            }
+            IMNES_ALLOCATION_FREE("frame loop");
+            console.bus.buttons[0] = static_cast<uint8_t>(i & 1u);
+            console.runFrame();
+            render_frame(console.ppu, frame);
+            console.saveState((*states)[i % 2]);
+            if(i % load_interval == load_interval - 1)
+            {
+                console.loadState((*states)[(i + 1) % 2]);
+            }
+        }
+        arm_allocation_guard(false);
+        const uint64_t allocated = allocationCount() - before;
+
+        // Each load goes back a frame
+        constexpr unsigned frames = warm_up_frames + checked_frames;
+        if(console.ppu.frame != frames - frames / load_interval || console.bus.read(0x10) == 0)
+        {
+            std::fprintf(stderr, "The test program didn't run\n");
+            return 2;
+        }
+        std::printf("%llu allocations in %u frames after warming up\n", static_cast<unsigned long long>(allocated), checked_frames);
+        return allocated == 0 ? 0 : 1;
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+}
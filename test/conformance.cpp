@@ -0,0 +1,489 @@
+// Conformance suite runner
+// Runs every test ROM in a catalog, headless and as fast as it will go, one test per job on a work stealing pool, and
+// reports whether each passed along with how many emulated CPU cycles it ran per wall second. So a change that breaks
+// a test or slows the core down shows up in the same run
+// Catalog lines are "rom check limit [args...]", with # comments. ROM paths are relative to the ROM directory:
+//   status  limit frames. Passes when the ROM reports 0 through the $6000 status protocol used by blargg's tests
+//   hash    limit frames. Passes when the picture after that many frames has the hash given (16 hex digits)
+//   trap    limit cycles, args load_addr start_pc trap_addr. A flat 6502 image that passes when it loops at trap_addr
+//   trace   limit instructions (- for all), args log [start_pc]. Passes when it matches the log (see ReferenceTrace)
+// A test whose ROM isn't there is skipped, and one whose mapper isn't supported is counted as unsupported
+// Exits 0 if every test that ran passed, 1 if any failed, 2 on error and 77 if none could run
+// Usage: imnes-conformance [-j threads] [--roms dir] [--filter text] [--strict] [--print-hashes] [--json file] catalog
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "console.h"
+#include "frame_hash.h"
+#include "ines.h"
+#include "verify.h"
+#include "work_stealing_pool.h"
+
+namespace {
+
+struct options
+{
+    unsigned threads = 0;
+    const char *roms = nullptr; // Defaults to the directory the catalog is in
+    const char *catalog = nullptr;
+    const char *filter = nullptr;
+    const char *json = nullptr;
+    bool strict = false;       // Count unsupported tests as failures
+    bool print_hashes = false; // Show the picture hash of every hash test, to fill in the catalog
+};
+
+enum class check
+{
+    STATUS,
+    HASH,
+    TRAP,
+    TRACE,
+};
+
+struct test
+{
+    std::string rom;
+    check kind = check::STATUS;
+    uint64_t limit = 0;
+    std::vector<std::string> args;
+};
+
+enum class outcome
+{
+    PASS,
+    FAIL,
+    UNSUPPORTED,
+    SKIPPED,
+};
+
+constexpr const char *outcome_names[] = {"PASS", "FAIL", "UNSUPPORTED", "SKIPPED"};
+
+struct result
+{
+    outcome out = outcome::SKIPPED;
+    std::string message;
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+    double seconds = 0;
+    uint64_t hash = 0;
+};
+
+// The $6000 protocol https://github.com/christopherpow/nes-test-roms/blob/master/readme.txt
+constexpr uint16_t status_addr = 0x6000;
+constexpr uint8_t status_running = 0x80;
+constexpr uint8_t status_reset = 0x81;
+constexpr uint8_t signature[3] = {0xDE, 0xB0, 0x61};
+// A reset is asked for with at least 100ms to spare
+constexpr uint64_t reset_delay_frames = 8;
+// Trap tests are run in chunks of this many cycles between checks
+constexpr uint64_t trap_chunk = 100000;
+
+void usage()
+{
+    std::fprintf(stderr, "Usage: imnes-conformance [-j threads] [--roms dir] [--filter text] [--strict] [--print-hashes] [--json file] catalog\n"
+                         "  --roms          directory the catalog's ROM paths are relative to (default the catalog's)\n"
+                         "  --filter        only run tests whose ROM path contains text\n"
+                         "  --strict        count tests of unsupported mappers as failures\n"
+                         "  --print-hashes  print the picture hash each hash test got\n");
+}
+
+bool parseArgs(int argc, char **argv, options &opt)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "-j" && has_value)
+        {
+            opt.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if(arg == "--roms" && has_value)
+        {
+            opt.roms = argv[++i];
+        }
+        else if(arg == "--filter" && has_value)
+        {
+            opt.filter = argv[++i];
+        }
+        else if(arg == "--json" && has_value)
+        {
+            opt.json = argv[++i];
+        }
+        else if(arg == "--strict")
+        {
+            opt.strict = true;
+        }
+        else if(arg == "--print-hashes")
+        {
+            opt.print_hashes = true;
+        }
+        else if(!arg.empty() && arg[0] != '-' && !opt.catalog)
+        {
+            opt.catalog = argv[i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return opt.catalog != nullptr;
+}
+
+// N.B. throws runtime_error on a line it doesn't understand
+std::vector<test> readCatalog(const std::filesystem::path &p, const char *filter)
+{
+    std::ifstream file(p);
+    if(!file)
+    {
+        throw std::runtime_error("Could not open " + p.string());
+    }
+    std::vector<test> tests;
+    std::string line;
+    for(size_t n = 1; std::getline(file, line); n++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        test t;
+        std::string kind;
+        std::string limit;
+        if(!(fields >> t.rom))
+        {
+            continue;
+        }
+        if(!(fields >> kind >> limit))
+        {
+            throw std::runtime_error(p.string() + ":" + std::to_string(n) + ": expected rom check limit");
+        }
+        for(std::string a; fields >> a;)
+        {
+            t.args.push_back(a);
+        }
+        t.limit = limit == "-" ? 0 : std::strtoull(limit.c_str(), nullptr, 10);
+        size_t args_needed = 0;
+        if(kind == "status")
+        {
+            t.kind = check::STATUS;
+        }
+        else if(kind == "hash")
+        {
+            t.kind = check::HASH;
+            args_needed = 1;
+        }
+        else if(kind == "trap")
+        {
+            t.kind = check::TRAP;
+            args_needed = 3;
+        }
+        else if(kind == "trace")
+        {
+            t.kind = check::TRACE;
+            args_needed = 1;
+        }
+        else
+        {
+            throw std::runtime_error(p.string() + ":" + std::to_string(n) + ": unknown check " + kind);
+        }
+        if(t.args.size() < args_needed || (t.kind != check::TRACE && t.limit == 0))
+        {
+            throw std::runtime_error(p.string() + ":" + std::to_string(n) + ": missing limit or arguments for " + kind);
+        }
+        if(filter == nullptr || t.rom.find(filter) != std::string::npos)
+        {
+            tests.push_back(std::move(t));
+        }
+    }
+    return tests;
+}
+
+uint16_t hexArg(const std::string &s)
+{
+    return static_cast<uint16_t>(std::strtoul(s.c_str(), nullptr, 16));
+}
+
+// N.B. Console's constructor throws runtime_error for an unsupported mapper, which is told apart from other errors
+std::unique_ptr<Console> makeConsole(const std::filesystem::path &rom, result &r)
+{
+    const auto ines = std::make_shared<const Ines>(rom);
+    try
+    {
+        return std::make_unique<Console>(ines);
+    }
+    catch(const std::runtime_error &e)
+    {
+        r.out = outcome::UNSUPPORTED;
+        r.message = e.what();
+        return nullptr;
+    }
+}
+
+void runStatus(const test &t, Console &console, result &r)
+{
+    uint64_t reset_at = 0;
+    for(; r.frames < t.limit; r.frames++)
+    {
+        console.runFrame();
+        // Nothing there is valid until the signature is
+        bool has_signature = true;
+        for(uint16_t i = 0; i < std::size(signature); i++)
+        {
+            has_signature = has_signature && console.bus.peek(static_cast<uint16_t>(status_addr + 1 + i)) == signature[i];
+        }
+        if(!has_signature)
+        {
+            continue;
+        }
+        const uint8_t status = console.bus.peek(status_addr);
+        if(status == status_reset)
+        {
+            if(reset_at == 0)
+            {
+                reset_at = r.frames + reset_delay_frames;
+            }
+            else if(r.frames >= reset_at)
+            {
+                console.reset();
+                reset_at = 0;
+            }
+        }
+        else if(status != status_running)
+        {
+            // The text output is at $6004, up to the end of PRG RAM
+            std::string text;
+            for(uint16_t a = status_addr + 4; a < 0x8000 && console.bus.peek(a) != 0; a++)
+            {
+                text += static_cast<char>(console.bus.peek(a));
+            }
+            std::replace(text.begin(), text.end(), '\n', ' ');
+            r.out = status == 0 ? outcome::PASS : outcome::FAIL;
+            r.message = (status == 0 ? "" : "result " + std::to_string(status) + ": ") + text;
+            return;
+        }
+    }
+    r.out = outcome::FAIL;
+    r.message = "no result after " + std::to_string(t.limit) + " frames";
+}
+
+void runHash(const test &t, Console &console, result &r)
+{
+    for(; r.frames < t.limit; r.frames++)
+    {
+        console.runFrame();
+    }
+    FrameHasher hasher(FrameHasher::VIDEO);
+    r.hash = hasher.hash(console).video;
+    const uint64_t expected = std::strtoull(t.args[0].c_str(), nullptr, 16);
+    r.out = r.hash == expected ? outcome::PASS : outcome::FAIL;
+    if(r.out == outcome::FAIL)
+    {
+        char text[64];
+        std::snprintf(text, sizeof(text), "picture hash %016llx", static_cast<unsigned long long>(r.hash));
+        r.message = text;
+    }
+}
+
+void runTrap(const test &t, const std::filesystem::path &rom, result &r)
+{
+    const std::vector<uint8_t> image = read_file(rom);
+    Console console(image, hexArg(t.args[0]), hexArg(t.args[1]));
+    const uint16_t trap = hexArg(t.args[2]);
+    while(console.cycles < t.limit)
+    {
+        console.runCycles(std::min(trap_chunk, t.limit - console.cycles));
+        // Both passing and failing end in a branch or jump to itself
+        const uint16_t pc = console.cpu.pc;
+        console.step();
+        if(console.cpu.pc == pc)
+        {
+            r.out = pc == trap ? outcome::PASS : outcome::FAIL;
+            if(pc != trap)
+            {
+                char text[64];
+                std::snprintf(text, sizeof(text), "trapped at %04X", pc);
+                r.message = text;
+            }
+            r.cycles = console.cycles;
+            return;
+        }
+    }
+    r.cycles = console.cycles;
+    r.out = outcome::FAIL;
+    r.message = "still running after " + std::to_string(t.limit) + " cycles";
+}
+
+void runTrace(const test &t, const std::filesystem::path &dir, Console &console, result &r)
+{
+    if(t.args.size() > 1)
+    {
+        console.cpu.pc = hexArg(t.args[1]);
+    }
+    ReferenceTrace reference(dir / t.args[0]);
+    const trace_mismatch m = compare_with_trace(console, reference, t.limit);
+    r.out = m.found ? outcome::FAIL : outcome::PASS;
+    if(m.found)
+    {
+        r.message = "differs at line " + std::to_string(m.expected.line) + ": " + m.expected.text;
+    }
+}
+
+result runTest(const test &t, const std::filesystem::path &dir)
+{
+    result r;
+    const std::filesystem::path rom = dir / t.rom;
+    if(!std::filesystem::exists(rom) || (t.kind == check::TRACE && !std::filesystem::exists(dir / t.args[0])))
+    {
+        r.message = "not found";
+        return r;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    try
+    {
+        if(t.kind == check::TRAP)
+        {
+            runTrap(t, rom, r);
+        }
+        else if(auto console = makeConsole(rom, r))
+        {
+            switch(t.kind)
+            {
+                case check::STATUS:
+                    runStatus(t, *console, r);
+                    break;
+                case check::HASH:
+                    runHash(t, *console, r);
+                    break;
+                case check::TRACE:
+                    runTrace(t, dir, *console, r);
+                    break;
+                case check::TRAP:
+                    break;
+            }
+            r.cycles = console->cycles;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        r.out = outcome::FAIL;
+        r.message = e.what();
+    }
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return r;
+}
+
+double mhz(uint64_t cycles, double seconds)
+{
+    return seconds > 0 ? static_cast<double>(cycles) / seconds / 1e6 : 0.0;
+}
+
+std::string jsonString(std::string_view s)
+{
+    std::string out = "\"";
+    for(const char c : s)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+        }
+        if(static_cast<unsigned char>(c) >= 0x20)
+        {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+bool writeJson(const char *path, const std::vector<test> &tests, const std::vector<result> &results, double wall)
+{
+    FILE *f = std::fopen(path, "w");
+    if(f == nullptr)
+    {
+        std::fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+    uint64_t cycles = 0;
+    std::fprintf(f, "{\n  \"tests\": [\n");
+    for(size_t i = 0; i < tests.size(); i++)
+    {
+        const result &r = results[i];
+        cycles += r.cycles;
+        std::fprintf(f, "    {\"rom\": %s, \"result\": \"%s\", \"frames\": %llu, \"cycles\": %llu, \"seconds\": %.6f, \"mhz\": %.2f, \"message\": %s}%s\n",
+                     jsonString(tests[i].rom).c_str(), outcome_names[static_cast<int>(r.out)],
+                     static_cast<unsigned long long>(r.frames), static_cast<unsigned long long>(r.cycles), r.seconds,
+                     mhz(r.cycles, r.seconds), jsonString(r.message).c_str(), i + 1 < tests.size() ? "," : "");
+    }
+    std::fprintf(f, "  ],\n  \"total\": {\"cycles\": %llu, \"seconds\": %.6f, \"mhz\": %.2f}\n}\n",
+                 static_cast<unsigned long long>(cycles), wall, mhz(cycles, wall));
+    const bool ok = std::ferror(f) == 0;
+    return std::fclose(f) == 0 && ok;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+    if(!parseArgs(argc, argv, opt))
+    {
+        usage();
+        return 2;
+    }
+
+    std::vector<test> tests;
+    try
+    {
+        tests = readCatalog(opt.catalog, opt.filter);
+    }
+    catch(const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+    const std::filesystem::path dir = opt.roms && *opt.roms ? std::filesystem::path(opt.roms) : std::filesystem::path(opt.catalog).parent_path();
+
+    std::vector<result> results(tests.size());
+    WorkStealingPool pool(opt.threads);
+    const auto start = std::chrono::steady_clock::now();
+    pool.forEach(tests.size(), [&](size_t i, unsigned) { results[i] = runTest(tests[i], dir); });
+    const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    size_t counts[4] = {};
+    uint64_t cycles = 0;
+    for(size_t i = 0; i < tests.size(); i++)
+    {
+        const result &r = results[i];
+        counts[static_cast<int>(r.out)]++;
+        cycles += r.cycles;
+        std::printf("%-11s %-48s %8.1f MHz %7.2fs  %s\n", outcome_names[static_cast<int>(r.out)], tests[i].rom.c_str(),
+                    mhz(r.cycles, r.seconds), r.seconds, r.message.c_str());
+        if(opt.print_hashes && tests[i].kind == check::HASH && r.out != outcome::SKIPPED)
+        {
+            std::printf("            %s hash %016llx after %llu frames\n", tests[i].rom.c_str(),
+                        static_cast<unsigned long long>(r.hash), static_cast<unsigned long long>(tests[i].limit));
+        }
+    }
+    std::printf("%zu passed, %zu failed, %zu unsupported, %zu skipped in %.2fs on %u threads, %.1f MHz total\n",
+                counts[0], counts[1], counts[2], counts[3], wall, pool.size(), mhz(cycles, wall));
+
+    if(opt.json && !writeJson(opt.json, tests, results, wall))
+    {
+        return 2;
+    }
+    if(counts[1] != 0 || (opt.strict && counts[2] != 0))
+    {
+        return 1;
+    }
+    return counts[0] == 0 ? 77 : 0;
+}